@@ -0,0 +1,373 @@
+#include <SDL2/SDL.h>
+#include "animation.h"
+#include <iostream>
+#include <sstream>
+#include <cmath>
+#include <algorithm>
+#include <unordered_map>
+
+static bool parseIndexedObj(const std::string &filename, skinnedMesh &skinned)
+{
+    std::ifstream file(filename);
+    if (!file.is_open()) {
+        std::cout << "Failed to open file: " << filename << std::endl;
+        return false;
+    }
+
+    std::vector<coord> tex;
+
+    std::string line;
+    while (std::getline(file, line)) {
+        std::istringstream ss(line);
+        std::string prefix;
+        ss >> prefix;
+
+        if (prefix == "v") {
+            float x, y, z;
+            ss >> x >> y >> z;
+            skinned.x.push_back(x);
+            skinned.y.push_back(y);
+            skinned.z.push_back(z);
+        } else if (prefix == "vt") {
+            coord t;
+            ss >> t.u >> t.v;
+            tex.push_back(t);
+        } else if (prefix == "f") {
+            // Accepts v, v/t, v/t/n and v//n, polygons are split into a fan
+            std::vector<int> vIndex;
+            std::vector<int> tIndex;
+            std::string vertexData;
+            while (ss >> vertexData) {
+                size_t firstSlash = vertexData.find('/');
+                vIndex.push_back(std::stoi(vertexData.substr(0, firstSlash)) - 1);
+                int t = -1;
+                if (firstSlash != std::string::npos && firstSlash + 1 < vertexData.size() && vertexData[firstSlash + 1] != '/')
+                    t = std::stoi(vertexData.substr(firstSlash + 1)) - 1;
+                tIndex.push_back(t);
+            }
+            for (size_t i = 2; i < vIndex.size(); i++) {
+                size_t corners[3] = { 0, i - 1, i };
+                for (size_t c : corners) {
+                    skinned.indices.push_back(vIndex[c]);
+                    skinned.uvs.push_back(tIndex[c] >= 0 && tIndex[c] < int(tex.size()) ? tex[tIndex[c]] : coord{ 0.0f, 0.0f });
+                }
+            }
+        }
+    }
+
+    for (int index : skinned.indices) {
+        if (index < 0 || index >= int(skinned.x.size())) {
+            std::cout << filename << ": face refers to a missing vertex" << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+// Each vertex follows its two nearest joints, weighted by inverse squared distance
+static void autoWeights(skinnedMesh &skinned)
+{
+    size_t count = skinned.x.size();
+    for (size_t i = 0; i < count; i++)
+    {
+        int best[2] = { 0, 0 };
+        float bestDistance[2] = { 1e30f, 1e30f };
+        for (int b = 0; b < int(skinned.bones.size()); b++)
+        {
+            vertex d = { skinned.x[i] - skinned.bones[b].head.x, skinned.y[i] - skinned.bones[b].head.y, skinned.z[i] - skinned.bones[b].head.z };
+            float distance = dotProduct(d, d);
+            if (distance < bestDistance[0])
+            {
+                best[1] = best[0];
+                bestDistance[1] = bestDistance[0];
+                best[0] = b;
+                bestDistance[0] = distance;
+            }
+            else if (distance < bestDistance[1])
+            {
+                best[1] = b;
+                bestDistance[1] = distance;
+            }
+        }
+
+        float w0 = 1.0f / (bestDistance[0] + 1e-4f);
+        float w1 = skinned.bones.size() > 1 ? 1.0f / (bestDistance[1] + 1e-4f) : 0.0f;
+        skinned.boneIndex[0][i] = best[0];
+        skinned.boneIndex[1][i] = best[1];
+        skinned.boneWeight[0][i] = w0 / (w0 + w1);
+        skinned.boneWeight[1][i] = w1 / (w0 + w1);
+    }
+}
+
+bool loadSkinnedMesh(const std::string &filename, const std::string &rigname, skinnedMesh &skinned)
+{
+    if (!parseIndexedObj(filename, skinned))
+        return false;
+
+    std::ifstream file(rigname);
+    if (!file.is_open()) {
+        std::cout << "Failed to open rig: " << rigname << std::endl;
+        return false;
+    }
+
+    size_t count = skinned.x.size();
+    for (int k = 0; k < 4; k++)
+    {
+        skinned.boneIndex[k].assign(count, 0);
+        skinned.boneWeight[k].assign(count, 0.0f);
+    }
+    // Until told otherwise everything follows the first bone
+    skinned.boneWeight[0].assign(count, 1.0f);
+
+    std::unordered_map<std::string, int> boneNames;
+    bool automatic = false;
+    int lineNumber = 0;
+
+    std::string line;
+    while (std::getline(file, line))
+    {
+        lineNumber++;
+        std::istringstream ss(line);
+        std::string prefix;
+        ss >> prefix;
+
+        if (prefix.empty() || prefix[0] == '#')
+            continue;
+
+        if (prefix == "bone")
+        {
+            bone b;
+            std::string parent;
+            ss >> b.name >> parent >> b.head.x >> b.head.y >> b.head.z;
+            if (skinned.bones.size() >= 256 || !skinned.clips.empty())
+            {
+                std::cout << rigname << ":" << lineNumber << ": bones must come before clips, at most 256" << std::endl;
+                return false;
+            }
+            b.parent = -1;
+            if (parent != "-")
+            {
+                auto found = boneNames.find(parent);
+                if (found == boneNames.end())
+                {
+                    std::cout << rigname << ":" << lineNumber << ": parent '" << parent << "' must be declared first" << std::endl;
+                    return false;
+                }
+                b.parent = found->second;
+            }
+            boneNames[b.name] = int(skinned.bones.size());
+            skinned.bones.push_back(b);
+        }
+        else if (prefix == "weight")
+        {
+            int index;
+            ss >> index;
+            index -= 1; // OBJ numbering
+            if (index < 0 || index >= int(count))
+            {
+                std::cout << rigname << ":" << lineNumber << ": no vertex " << index + 1 << std::endl;
+                return false;
+            }
+
+            float total = 0.0f;
+            int k = 0;
+            std::string name;
+            float weight;
+            while (k < 4 && ss >> name >> weight)
+            {
+                auto found = boneNames.find(name);
+                if (found == boneNames.end())
+                {
+                    std::cout << rigname << ":" << lineNumber << ": unknown bone '" << name << "'" << std::endl;
+                    return false;
+                }
+                skinned.boneIndex[k][index] = found->second;
+                skinned.boneWeight[k][index] = weight;
+                total += weight;
+                k++;
+            }
+            for (int slot = 0; slot < 4; slot++)
+            {
+                if (slot >= k)
+                    skinned.boneWeight[slot][index] = 0.0f;
+                else if (total > 0.0f)
+                    skinned.boneWeight[slot][index] /= total;
+            }
+        }
+        else if (prefix == "autoweights")
+        {
+            automatic = true;
+        }
+        else if (prefix == "clip")
+        {
+            animationClip clip;
+            ss >> clip.name >> clip.duration;
+            clip.tracks.resize(skinned.bones.size());
+            skinned.clips.push_back(clip);
+        }
+        else if (prefix == "key")
+        {
+            std::string name;
+            boneKey key;
+            key.translation = { 0.0f, 0.0f, 0.0f };
+            ss >> name >> key.time >> key.rotation.x >> key.rotation.y >> key.rotation.z;
+            ss >> key.translation.x >> key.translation.y >> key.translation.z;
+            key.rotation = scaleV(key.rotation, 3.14159f / 180.0f);
+
+            auto found = boneNames.find(name);
+            if (skinned.clips.empty() || found == boneNames.end())
+            {
+                std::cout << rigname << ":" << lineNumber << ": key needs a clip and a known bone" << std::endl;
+                return false;
+            }
+            skinned.clips.back().tracks[found->second].push_back(key);
+        }
+        else
+        {
+            std::cout << rigname << ":" << lineNumber << ": unknown entry '" << prefix << "'" << std::endl;
+            return false;
+        }
+    }
+
+    if (skinned.bones.empty())
+    {
+        std::cout << rigname << ": no bones" << std::endl;
+        return false;
+    }
+    if (automatic)
+        autoWeights(skinned);
+
+    skinned.influences = 1;
+    for (int k = 1; k < 4; k++)
+    {
+        if (std::any_of(skinned.boneWeight[k].begin(), skinned.boneWeight[k].end(), [](float w) { return w != 0.0f; }))
+            skinned.influences = k + 1;
+    }
+
+    for (auto &clip : skinned.clips)
+    {
+        for (auto &track : clip.tracks)
+        {
+            std::sort(track.begin(), track.end(), [](const boneKey &a, const boneKey &b) { return a.time < b.time; });
+        }
+    }
+    return true;
+}
+
+void skinnedBounds(const skinnedMesh &skinned, vertex &boundsMin, vertex &boundsMax)
+{
+    boundsMin = { 0.0f, 0.0f, 0.0f };
+    boundsMax = { 0.0f, 0.0f, 0.0f };
+    if (skinned.x.empty())
+        return;
+
+    boundsMin = { skinned.x[0], skinned.y[0], skinned.z[0] };
+    boundsMax = boundsMin;
+    for (size_t i = 0; i < skinned.x.size(); i++)
+    {
+        boundsMin = { std::min(boundsMin.x, skinned.x[i]), std::min(boundsMin.y, skinned.y[i]), std::min(boundsMin.z, skinned.z[i]) };
+        boundsMax = { std::max(boundsMax.x, skinned.x[i]), std::max(boundsMax.y, skinned.y[i]), std::max(boundsMax.z, skinned.z[i]) };
+    }
+}
+
+static boneKey sampleTrack(const std::vector<boneKey> &track, float time)
+{
+    if (track.empty())
+        return boneKey{ time, { 0.0f, 0.0f, 0.0f }, { 0.0f, 0.0f, 0.0f } };
+    if (time <= track.front().time)
+        return track.front();
+    if (time >= track.back().time)
+        return track.back();
+
+    size_t next = 1;
+    while (track[next].time < time)
+        next++;
+    const boneKey &a = track[next - 1];
+    const boneKey &b = track[next];
+    float t = (time - a.time) / std::max(b.time - a.time, 1e-6f);
+
+    boneKey key;
+    key.time = time;
+    key.rotation = addV(a.rotation, scaleV(subtractV(b.rotation, a.rotation), t));
+    key.translation = addV(a.translation, scaleV(subtractV(b.translation, a.translation), t));
+    return key;
+}
+
+void poseSkeleton(const skinnedMesh &skinned, const animationClip &clip, float time, const matrix4 &world, std::vector<matrix4> &boneMatrices)
+{
+    if (clip.duration > 0.0f)
+    {
+        time = fmodf(time, clip.duration);
+        if (time < 0.0f)
+            time += clip.duration;
+    }
+
+    boneMatrices.resize(skinned.bones.size());
+    for (size_t b = 0; b < skinned.bones.size(); b++)
+    {
+        const bone &joint = skinned.bones[b];
+        boneKey key = sampleTrack(clip.tracks[b], time);
+
+        // Rotate around the joint, then move, then follow the parent.
+        // Parents come first, so their matrices (world included) are ready
+        vertex inverseHead = scaleV(joint.head, -1.0f);
+        matrix4 rotate = multiplyM(matrixRotateX(key.rotation.x), multiplyM(matrixRotateY(key.rotation.y), matrixRotateZ(key.rotation.z)));
+        matrix4 local = multiplyM(multiplyM(matrixTranslate(inverseHead), rotate), matrixTranslate(addV(joint.head, key.translation)));
+        boneMatrices[b] = multiplyM(local, joint.parent >= 0 ? boneMatrices[joint.parent] : world);
+    }
+}
+
+void skinMesh(const skinnedMesh &skinned, skinningState &state)
+{
+    size_t count = skinned.x.size();
+    state.x.resize(count);
+    state.y.resize(count);
+    state.z.resize(count);
+
+    const float *sx = skinned.x.data();
+    const float *sy = skinned.y.data();
+    const float *sz = skinned.z.data();
+    float *ox = state.x.data();
+    float *oy = state.y.data();
+    float *oz = state.z.data();
+    const matrix4 *bones = state.boneMatrices.data();
+
+    // One pass per influence slot, each a straight loop over the streams
+    for (int k = 0; k < 4; k++)
+    {
+        const Uint8 *index = skinned.boneIndex[k].data();
+        const float *weight = skinned.boneWeight[k].data();
+        bool first = k == 0;
+        if (k >= skinned.influences)
+            break;
+
+        for (size_t i = 0; i < count; i++)
+        {
+            const matrix4 &m = bones[index[i]];
+            float w = weight[i];
+            float px = sx[i];
+            float py = sy[i];
+            float pz = sz[i];
+            float rx = w * (px * m.m[0][0] + py * m.m[1][0] + pz * m.m[2][0] + m.m[3][0]);
+            float ry = w * (px * m.m[0][1] + py * m.m[1][1] + pz * m.m[2][1] + m.m[3][1]);
+            float rz = w * (px * m.m[0][2] + py * m.m[1][2] + pz * m.m[2][2] + m.m[3][2]);
+            ox[i] = first ? rx : ox[i] + rx;
+            oy[i] = first ? ry : oy[i] + ry;
+            oz[i] = first ? rz : oz[i] + rz;
+        }
+    }
+
+    // Expand into the triangle list the rest of the pipeline reads
+    size_t triangles = skinned.indices.size() / 3;
+    state.triangles.resize(triangles);
+    const int *indices = skinned.indices.data();
+    for (size_t n = 0; n < triangles; n++)
+    {
+        for (int c = 0; c < 3; c++)
+        {
+            int i = indices[n * 3 + c];
+            state.triangles[n].v[c] = { ox[i], oy[i], oz[i] };
+            state.triangles[n].t[c] = skinned.uvs[n * 3 + c];
+        }
+    }
+}
@@ -0,0 +1,70 @@
+#include <SDL2/SDL.h>
+#include "graphicsEngine.h"
+
+#ifndef ANIMATION_H
+#define ANIMATION_H
+
+struct bone
+{
+    std::string name;
+    int parent;         // -1 for a root, otherwise always an earlier bone
+    vertex head;        // the joint it rotates around, in model space
+};
+
+struct boneKey
+{
+    float time;
+    vertex rotation;    // x, y, z angles in radians
+    vertex translation;
+};
+
+struct animationClip
+{
+    std::string name;
+    float duration;
+    std::vector<std::vector<boneKey>> tracks;   // one per bone, sorted by time
+};
+
+// Bind pose and bone influences kept as separate streams (one array per
+// component) so the skinning loops walk memory linearly
+struct skinnedMesh
+{
+    meshVector<float> x;
+    meshVector<float> y;
+    meshVector<float> z;
+    meshVector<Uint8> boneIndex[4];
+    meshVector<float> boneWeight[4];
+    int influences;             // how many of the four slots any vertex uses
+
+    meshVector<int> indices;   // three per triangle
+    meshVector<coord> uvs;     // one per triangle corner
+
+    std::vector<bone> bones;
+    std::vector<animationClip> clips;
+};
+
+// Per instance buffers reused from frame to frame
+struct skinningState
+{
+    std::vector<matrix4> boneMatrices;
+    frameVector<float> x;
+    frameVector<float> y;
+    frameVector<float> z;
+    frameVector<triangle> triangles;
+};
+
+// Rig files describe the skeleton, weights and clips for an OBJ:
+//     bone <name> <parent | -> <x y z>
+//     weight <obj vertex> <bone> <w> [<bone> <w> ...]   (up to four bones)
+//     autoweights                                       (weights from distance to the joints)
+//     clip <name> <seconds>
+//     key <bone> <time> <rx ry rz degrees> [tx ty tz]   (belongs to the last clip)
+bool loadSkinnedMesh(const std::string &filename, const std::string &rigname, skinnedMesh &skinned);
+void skinnedBounds(const skinnedMesh &skinned, vertex &boundsMin, vertex &boundsMax);
+
+// Bone matrices for a point in a clip, with world already multiplied in
+void poseSkeleton(const skinnedMesh &skinned, const animationClip &clip, float time, const matrix4 &world, std::vector<matrix4> &boneMatrices);
+// Linear blend skinning into the state's streams, then expanded into world space triangles
+void skinMesh(const skinnedMesh &skinned, skinningState &state);
+
+#endif
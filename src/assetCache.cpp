@@ -0,0 +1,479 @@
+#include <SDL2/SDL.h>
+#include "graphicsEngine.h"
+#include "quantizedMesh.h"
+#include "meshOptimizer.h"
+#include "bspTree.h"
+#include "meshBvh.h"
+#include "animation.h"
+#include "meshStreaming.h"
+#include "terrain.h"
+#include <iostream>
+#include <sstream>
+#include <filesystem>
+
+std::shared_ptr<SDL_Texture> trackedTexture(SDL_Texture *texture, size_t bytes)
+{
+    trackAllocation(MemoryTag::Textures, bytes);
+    return std::shared_ptr<SDL_Texture>(texture, [bytes](SDL_Texture *t)
+    {
+        trackFree(MemoryTag::Textures, bytes);
+        SDL_DestroyTexture(t);
+    });
+}
+
+bool parseObjFile(const std::string &filename, mesh &obj)
+{
+    std::ifstream file(filename);
+    if (!file.is_open())
+    {
+        std::cout << "Failed to open file: " << filename << std::endl;
+        return false;
+    }
+
+    std::vector<vertex> vertices;
+
+    while (!file.eof())
+    {
+        char line[128];
+        file.getline(line, 128);
+
+        std::stringstream s;
+        s << line;
+
+        char junk;
+
+        if (line[0] == 'v')
+        {
+            vertex v;
+            s >> junk >> v.x >> v.y >> v.z;
+            vertices.push_back(v);
+        }
+
+        if (line[0] == 'f')
+        {
+            int f[3];
+            s >> junk >> f[0] >> f[1] >> f[2];
+            obj.triangles.push_back({vertices[f[0] - 1], vertices[f[1] - 1], vertices[f[2] - 1]});
+        }
+    }
+    return true;
+}
+
+bool parseObjTextureFile(const std::string &filename, mesh &obj)
+{
+    std::ifstream file(filename);
+    if (!file.is_open()) {
+        std::cout << "Failed to open file: " << filename << std::endl;
+        return false;
+    }
+
+    std::vector<vertex> vertices;
+    std::vector<coord> tex;
+
+    std::string line;
+    while (std::getline(file, line)) {
+        std::istringstream ss(line);
+        std::string prefix;
+        ss >> prefix;
+
+        if (prefix == "v") {
+            vertex v;
+            ss >> v.x >> v.y >> v.z;
+            vertices.push_back(v);
+        } else if (prefix == "vt") {
+            coord t;
+            ss >> t.u >> t.v;
+            tex.push_back(t);
+        } else if (prefix == "f") {
+            triangle tri;
+            for (int i = 0; i < 3; ++i) {
+                std::string vertexData;
+                ss >> vertexData;
+
+                size_t firstSlash = vertexData.find('/');
+                size_t secondSlash = vertexData.find('/', firstSlash + 1);
+
+                int vIndex = std::stoi(vertexData.substr(0, firstSlash)) - 1;
+                int tIndex = std::stoi(vertexData.substr(firstSlash + 1, secondSlash - firstSlash - 1)) - 1;
+
+                tri.v[i] = vertices[vIndex];
+                tri.t[i] = tex[tIndex];
+            }
+            obj.triangles.push_back(tri);
+        }
+    }
+    return true;
+}
+
+AssetCache::AssetCache(SDL_Renderer *_render) : loader(_render)
+{
+    render = _render;
+    streamingBudget = size_t(256) * 1024 * 1024;
+}
+
+std::string AssetCache::canonicalPath(const std::string &filename)
+{
+    std::error_code error;
+    std::filesystem::path path = std::filesystem::weakly_canonical(filename, error);
+    if (error)
+    {
+        return filename;
+    }
+    return path.string();
+}
+
+std::shared_ptr<const mesh> AssetCache::loadMesh(const std::string &filename, bool textured)
+{
+    // The two parsers produce different meshes from the same file, so they are cached apart
+    std::string key = canonicalPath(filename) + (textured ? "#uv" : "");
+
+    auto found = meshes.find(key);
+    if (found != meshes.end())
+    {
+        std::shared_ptr<const mesh> cached = found->second.lock();
+        if (cached)
+        {
+            return cached;
+        }
+    }
+
+    std::shared_ptr<mesh> obj = std::make_shared<mesh>();
+    bool loaded = textured ? parseObjTextureFile(filename, *obj) : parseObjFile(filename, *obj);
+    if (!loaded)
+    {
+        return nullptr;
+    }
+
+    meshes[key] = obj;
+    return obj;
+}
+
+std::shared_ptr<const quantizedMesh> AssetCache::loadQuantizedMesh(const std::string &filename, bool textured)
+{
+    std::string key = canonicalPath(filename) + (textured ? "#uv" : "");
+
+    auto found = quantizedMeshes.find(key);
+    if (found != quantizedMeshes.end())
+    {
+        std::shared_ptr<const quantizedMesh> cached = found->second.lock();
+        if (cached)
+        {
+            return cached;
+        }
+    }
+
+    // The float mesh is only kept for as long as it takes to pack it
+    mesh obj;
+    bool loaded = textured ? parseObjTextureFile(filename, obj) : parseObjFile(filename, obj);
+    if (!loaded)
+    {
+        return nullptr;
+    }
+
+    std::shared_ptr<quantizedMesh> packed = std::make_shared<quantizedMesh>();
+    quantizeMesh(obj, *packed);
+
+    size_t floatBytes = obj.triangles.size() * sizeof(triangle);
+    size_t packedBytes = packed->triangles.size() * sizeof(quantizedTriangle);
+    std::cout << "Packed " << filename << ": " << floatBytes / 1024 << " KB -> " << packedBytes / 1024 << " KB, max error "
+              << quantizationError(obj, *packed) << " (bound " << quantizationBound(*packed) << ")" << std::endl;
+
+    quantizedMeshes[key] = packed;
+    return packed;
+}
+
+std::shared_ptr<const indexedMesh> AssetCache::loadIndexedMesh(const std::string &filename, bool textured)
+{
+    std::string key = canonicalPath(filename) + (textured ? "#uv" : "");
+
+    auto found = indexedMeshes.find(key);
+    if (found != indexedMeshes.end())
+    {
+        std::shared_ptr<const indexedMesh> cached = found->second.lock();
+        if (cached)
+        {
+            return cached;
+        }
+    }
+
+    mesh obj;
+    bool loaded = textured ? parseObjTextureFile(filename, obj) : parseObjFile(filename, obj);
+    if (!loaded)
+    {
+        return nullptr;
+    }
+
+    std::shared_ptr<indexedMesh> indexed = std::make_shared<indexedMesh>();
+    buildIndexedMesh(obj, *indexed);
+    float before = computeACMR(indexed->indices, indexed->positions.size());
+    optimizeVertexCache(*indexed);
+    optimizeVertexFetch(*indexed);
+    float after = computeACMR(indexed->indices, indexed->positions.size());
+
+    std::cout << "Optimized " << filename << ": " << indexed->positions.size() << " vertices for " << obj.triangles.size()
+              << " triangles, ACMR " << before << " -> " << after << " (16 entry FIFO)" << std::endl;
+
+    indexedMeshes[key] = indexed;
+    return indexed;
+}
+
+std::shared_ptr<const bspTree> AssetCache::loadBspTree(const std::string &filename, bool textured)
+{
+    std::string key = canonicalPath(filename) + (textured ? "#uv" : "");
+
+    auto found = bspTrees.find(key);
+    if (found != bspTrees.end())
+    {
+        std::shared_ptr<const bspTree> cached = found->second.lock();
+        if (cached)
+        {
+            return cached;
+        }
+    }
+
+    mesh obj;
+    bool loaded = textured ? parseObjTextureFile(filename, obj) : parseObjFile(filename, obj);
+    if (!loaded)
+    {
+        return nullptr;
+    }
+
+    std::shared_ptr<bspTree> tree = std::make_shared<bspTree>();
+    buildBspTree(obj, *tree);
+    std::cout << "BSP " << filename << ": " << obj.triangles.size() << " triangles -> " << tree->geometry.triangles.size()
+              << " after splits, " << tree->nodes.size() << " nodes, depth " << bspTreeDepth(*tree) << std::endl;
+
+    bspTrees[key] = tree;
+    return tree;
+}
+
+std::shared_ptr<const meshBvh> AssetCache::loadMeshBvh(const std::string &filename, bool textured, MeshStorage storage)
+{
+    // Triangle numbers follow the storage, BSP splits and vertex cache order change them
+    static const char *storageNames[] = { "", "#packed", "#indexed", "#bsp" };
+    std::string key = canonicalPath(filename) + (textured ? "#uv" : "") + storageNames[int(storage)];
+
+    auto found = meshBvhs.find(key);
+    if (found != meshBvhs.end())
+    {
+        std::shared_ptr<const meshBvh> cached = found->second.lock();
+        if (cached)
+        {
+            return cached;
+        }
+    }
+
+    // Built from the mesh as the storage already holds it, decoded only for the
+    // build, so the file isn't parsed again and only the tree stays around
+    std::shared_ptr<meshBvh> bvh = std::make_shared<meshBvh>();
+    frameVector<triangle> decoded;
+    if (storage == MeshStorage::Quantized)
+    {
+        std::shared_ptr<const quantizedMesh> packed = loadQuantizedMesh(filename, textured);
+        if (!packed)
+        {
+            return nullptr;
+        }
+        transformQuantized(*packed, matrixScale(1.0f), decoded);
+        buildMeshBvh(decoded.data(), int(decoded.size()), textured, *bvh);
+    }
+    else if (storage == MeshStorage::Indexed)
+    {
+        std::shared_ptr<const indexedMesh> indexed = loadIndexedMesh(filename, textured);
+        if (!indexed)
+        {
+            return nullptr;
+        }
+        frameVector<vertex> positions;
+        transformIndexed(*indexed, matrixScale(1.0f), positions, decoded);
+        buildMeshBvh(decoded.data(), int(decoded.size()), textured, *bvh);
+    }
+    else if (storage == MeshStorage::Bsp)
+    {
+        std::shared_ptr<const bspTree> tree = loadBspTree(filename, textured);
+        if (!tree)
+        {
+            return nullptr;
+        }
+        buildMeshBvh(tree->geometry.triangles.data(), int(tree->geometry.triangles.size()), textured, *bvh);
+    }
+    else
+    {
+        std::shared_ptr<const mesh> source = loadMesh(filename, textured);
+        if (!source)
+        {
+            return nullptr;
+        }
+        buildMeshBvh(source->triangles.data(), int(source->triangles.size()), textured, *bvh);
+    }
+
+    meshBvhs[key] = bvh;
+    return bvh;
+}
+
+bool AssetCache::loadInstanceMesh(const std::string &filename, bool textured, MeshStorage storage, meshInstance &instance)
+{
+    instance.model = nullptr;
+    instance.packed = nullptr;
+    instance.indexed = nullptr;
+    instance.bsp = nullptr;
+    instance.streamed = nullptr;
+    instance.bvh = nullptr;
+    if (filename.size() > 7 && filename.compare(filename.size() - 7, 7, ".chunks") == 0)
+        instance.streamed = loadStreamedMesh(filename);
+    else if (storage == MeshStorage::Quantized)
+        instance.packed = loadQuantizedMesh(filename, textured);
+    else if (storage == MeshStorage::Indexed)
+        instance.indexed = loadIndexedMesh(filename, textured);
+    else if (storage == MeshStorage::Bsp)
+        instance.bsp = loadBspTree(filename, textured);
+    else
+        instance.model = loadMesh(filename, textured);
+    // Streamed meshes are never all in memory to build one from
+    if (instance.model || instance.packed || instance.indexed || instance.bsp)
+        instance.bvh = loadMeshBvh(filename, textured, storage);
+    return instance.model || instance.packed || instance.indexed || instance.bsp || instance.streamed;
+}
+
+std::shared_ptr<MeshStreamer> AssetCache::loadStreamedMesh(const std::string &filename)
+{
+    if (!streaming)
+        streaming = std::make_shared<StreamingPool>(streamingBudget);
+    std::shared_ptr<MeshStreamer> streamed = std::make_shared<MeshStreamer>(filename, streaming);
+    if (!streamed->isOpen())
+    {
+        return nullptr;
+    }
+    return streamed;
+}
+
+std::shared_ptr<Terrain> AssetCache::loadTerrain(const std::string &heightmap, const terrainSettings &settings)
+{
+    std::shared_ptr<Terrain> terrain = std::make_shared<Terrain>(heightmap, loader, settings);
+    if (!terrain->isOpen())
+    {
+        return nullptr;
+    }
+    return terrain;
+}
+
+void AssetCache::setStreamingBudget(size_t bytes)
+{
+    streamingBudget = bytes;
+    if (streaming)
+        streaming->setBudget(bytes);
+}
+
+std::shared_ptr<const skinnedMesh> AssetCache::loadSkinnedMesh(const std::string &filename, const std::string &rigname)
+{
+    std::string key = canonicalPath(filename) + "#" + canonicalPath(rigname);
+
+    auto found = skinnedMeshes.find(key);
+    if (found != skinnedMeshes.end())
+    {
+        std::shared_ptr<const skinnedMesh> cached = found->second.lock();
+        if (cached)
+        {
+            return cached;
+        }
+    }
+
+    std::shared_ptr<skinnedMesh> skinned = std::make_shared<skinnedMesh>();
+    if (!::loadSkinnedMesh(filename, rigname, *skinned))
+    {
+        return nullptr;
+    }
+
+    skinnedMeshes[key] = skinned;
+    return skinned;
+}
+
+std::shared_ptr<SDL_Texture> AssetCache::loadTexture(const std::string &filename)
+{
+    std::string key = canonicalPath(filename);
+
+    auto found = textures.find(key);
+    if (found != textures.end())
+    {
+        std::shared_ptr<SDL_Texture> cached = found->second.lock();
+        if (cached)
+        {
+            return cached;
+        }
+    }
+
+    int width = 0;
+    int height = 0;
+    SDL_Texture *created = loader.loadBMP(filename, width, height);
+    if (!created)
+    {
+        return nullptr;
+    }
+    std::shared_ptr<SDL_Texture> texture = trackedTexture(created, size_t(width) * height * 4);
+
+    textures[key] = texture;
+    return texture;
+}
+
+void AssetCache::setTextureCacheDirectory(const std::string &directory)
+{
+    loader.setCacheDirectory(directory);
+}
+
+TextureLoader &AssetCache::textureLoader()
+{
+    return loader;
+}
+
+std::string AssetCache::textureFile(const SDL_Texture *texture)
+{
+    for (const auto &entry : textures)
+    {
+        std::shared_ptr<SDL_Texture> cached = entry.second.lock();
+        if (cached && cached.get() == texture)
+            return entry.first;
+    }
+    return "";
+}
+
+int AssetCache::liveMeshCount()
+{
+    int count = 0;
+    for (const auto &entry : meshes)
+    {
+        if (!entry.second.expired())
+            count++;
+    }
+    for (const auto &entry : quantizedMeshes)
+    {
+        if (!entry.second.expired())
+            count++;
+    }
+    for (const auto &entry : indexedMeshes)
+    {
+        if (!entry.second.expired())
+            count++;
+    }
+    for (const auto &entry : bspTrees)
+    {
+        if (!entry.second.expired())
+            count++;
+    }
+    for (const auto &entry : skinnedMeshes)
+    {
+        if (!entry.second.expired())
+            count++;
+    }
+    return count;
+}
+
+int AssetCache::liveTextureCount()
+{
+    int count = 0;
+    for (const auto &entry : textures)
+    {
+        if (!entry.second.expired())
+            count++;
+    }
+    return count;
+}
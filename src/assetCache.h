@@ -0,0 +1,91 @@
+#include <SDL2/SDL.h>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include "textureLoader.h"
+
+#ifndef ASSETCACHE_H
+#define ASSETCACHE_H
+
+struct mesh;
+struct quantizedMesh;
+struct indexedMesh;
+struct bspTree;
+struct meshBvh;
+struct skinnedMesh;
+struct meshInstance;
+class MeshStreamer;
+class StreamingPool;
+class Terrain;
+struct terrainSettings;
+
+// How static meshes are held once loaded
+enum class MeshStorage
+{
+    Float,          // expanded float triangles, as parsed
+    Quantized,      // 16 bit positions and UVs
+    Indexed,        // shared vertices, reordered for the vertex cache
+    Bsp             // split into a BSP tree for exact back to front order
+};
+
+// Parse an OBJ file into a mesh (positions only / positions + UVs)
+bool parseObjFile(const std::string &filename, mesh &obj);
+bool parseObjTextureFile(const std::string &filename, mesh &obj);
+
+// Takes ownership of a texture and counts bytes against MemoryTag::Textures
+// until the last reference lets go. Texture memory lives with the driver,
+// so bytes is what the pixels would take
+std::shared_ptr<SDL_Texture> trackedTexture(SDL_Texture *texture, size_t bytes);
+
+// Meshes and textures are keyed by canonical path and shared by refcount,
+// so loading the same file twice hands back the same copy.
+// The cache only holds weak references: an asset is freed once the last
+// instance using it lets go, and reloaded on the next request.
+class AssetCache
+{
+    public:
+        AssetCache(SDL_Renderer *_render);
+        std::shared_ptr<const mesh> loadMesh(const std::string &filename, bool textured);
+        std::shared_ptr<const quantizedMesh> loadQuantizedMesh(const std::string &filename, bool textured);
+        std::shared_ptr<const indexedMesh> loadIndexedMesh(const std::string &filename, bool textured);
+        std::shared_ptr<const bspTree> loadBspTree(const std::string &filename, bool textured);
+        // Ray queries for the mesh, built from it as storage keeps it for drawing
+        std::shared_ptr<const meshBvh> loadMeshBvh(const std::string &filename, bool textured, MeshStorage storage);
+        // Opens a chunked mesh for streaming. Never cached, each caller gets its own,
+        // but they all share one streaming pool and its memory budget
+        std::shared_ptr<MeshStreamer> loadStreamedMesh(const std::string &filename);
+        // Memory all streamed meshes together may keep loaded
+        void setStreamingBudget(size_t bytes);
+        // Heightmap terrain. Never cached either, what it builds follows the placement
+        std::shared_ptr<Terrain> loadTerrain(const std::string &heightmap, const terrainSettings &settings);
+        // Sets whichever of the instance's mesh pointers the storage uses.
+        // Chunked (.chunks) files are always streamed whatever the storage
+        bool loadInstanceMesh(const std::string &filename, bool textured, MeshStorage storage, meshInstance &instance);
+        std::shared_ptr<const skinnedMesh> loadSkinnedMesh(const std::string &filename, const std::string &rigname);
+        std::shared_ptr<SDL_Texture> loadTexture(const std::string &filename);
+        // Keeps converted textures on disk there, empty (the default) turns it off
+        void setTextureCacheDirectory(const std::string &directory);
+        TextureLoader &textureLoader();
+        // Path a cached texture was loaded from, empty if it didn't come from the cache
+        std::string textureFile(const SDL_Texture *texture);
+        int liveMeshCount();
+        int liveTextureCount();
+    private:
+        std::string canonicalPath(const std::string &filename);
+
+        SDL_Renderer *render;
+        size_t streamingBudget;
+        // Started with the first streamed mesh
+        std::shared_ptr<StreamingPool> streaming;
+        TextureLoader loader;
+
+        std::unordered_map<std::string, std::weak_ptr<const mesh>> meshes;
+        std::unordered_map<std::string, std::weak_ptr<const quantizedMesh>> quantizedMeshes;
+        std::unordered_map<std::string, std::weak_ptr<const indexedMesh>> indexedMeshes;
+        std::unordered_map<std::string, std::weak_ptr<const bspTree>> bspTrees;
+        std::unordered_map<std::string, std::weak_ptr<const meshBvh>> meshBvhs;
+        std::unordered_map<std::string, std::weak_ptr<const skinnedMesh>> skinnedMeshes;
+        std::unordered_map<std::string, std::weak_ptr<SDL_Texture>> textures;
+};
+
+#endif
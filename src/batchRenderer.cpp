@@ -0,0 +1,162 @@
+#include <SDL2/SDL.h>
+#include "batchRenderer.h"
+#include "graphicsEngine.h"
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include <chrono>
+#include <cmath>
+#include <algorithm>
+
+bool loadBatchFile(const std::string &filename, std::vector<batchJob> &jobs)
+{
+    std::ifstream file(filename);
+    if (!file.is_open())
+    {
+        std::cout << "Failed to open batch file: " << filename << std::endl;
+        return false;
+    }
+
+    int lineNumber = 0;
+    std::string line;
+    while (std::getline(file, line))
+    {
+        lineNumber++;
+        std::istringstream ss(line);
+        batchJob job;
+        if (!(ss >> job.meshFile) || job.meshFile[0] == '#')
+        {
+            continue;
+        }
+        if (!(ss >> job.textureFile >> job.width >> job.height) || job.width <= 0 || job.height <= 0)
+        {
+            std::cout << filename << ":" << lineNumber << ": expected <mesh> <texture | -> <width> <height> [views]" << std::endl;
+            return false;
+        }
+        if (!(ss >> job.views) || job.views < 1)
+        {
+            job.views = 1;
+        }
+        jobs.push_back(job);
+    }
+    return true;
+}
+
+BatchRenderer::BatchRenderer(const std::vector<batchJob> &_jobs, const std::string &_outputPrefix, int _threads)
+{
+    jobs = _jobs;
+    outputPrefix = _outputPrefix;
+    threads = _threads > 0 ? _threads : std::max(1u, std::thread::hardware_concurrency());
+    nextJob = 0;
+    rendersDone = 0;
+    jobsFailed = 0;
+}
+
+bool BatchRenderer::run()
+{
+    auto startTime = std::chrono::high_resolution_clock::now();
+
+    std::vector<std::thread> pool;
+    int workers = std::min(threads, int(jobs.size()));
+    for (int i = 0; i < workers; i++)
+    {
+        pool.emplace_back(&BatchRenderer::worker, this);
+    }
+    for (auto &thread : pool)
+    {
+        thread.join();
+    }
+
+    std::chrono::duration<double> duration = std::chrono::high_resolution_clock::now() - startTime;
+    std::cout << "Batch: " << jobs.size() << " jobs, " << rendersDone << " renders on " << workers << " threads in "
+              << duration.count() << " s (" << rendersDone / duration.count() << " renders/s)" << std::endl;
+    if (jobsFailed > 0)
+    {
+        std::cout << "  " << jobsFailed << " jobs failed" << std::endl;
+    }
+    return jobsFailed == 0;
+}
+
+void BatchRenderer::worker()
+{
+    while (true)
+    {
+        int index = nextJob++;
+        if (index >= int(jobs.size()))
+            return;
+
+        int renders = renderJob(jobs[index]);
+        if (renders < 0)
+            jobsFailed++;
+        else
+            rendersDone += renders;
+    }
+}
+
+int BatchRenderer::renderJob(const batchJob &job)
+{
+    SDL_Surface *surface = SDL_CreateRGBSurfaceWithFormat(0, job.width, job.height, 32, SDL_PIXELFORMAT_RGBA32);
+    if (!surface)
+    {
+        std::cout << "Failed to create surface for " << job.meshFile << ": " << SDL_GetError() << std::endl;
+        return -1;
+    }
+    SDL_Renderer *render = SDL_CreateSoftwareRenderer(surface);
+    if (!render)
+    {
+        std::cout << "Failed to create renderer for " << job.meshFile << ": " << SDL_GetError() << std::endl;
+        SDL_FreeSurface(surface);
+        return -1;
+    }
+
+    std::string name = job.meshFile.substr(job.meshFile.find_last_of("/\\") + 1);
+    name = name.substr(0, name.find_last_of('.'));
+
+    int renders = 0;
+    {
+        Renderer renderer(render, job.width, job.height);
+        renderer.setShowHud(false);
+
+        bool loaded = job.textureFile == "-" ? renderer.loadObjFile(job.meshFile, 0)
+                                             : renderer.loadObjTextureFile(job.meshFile, job.textureFile, 0);
+        if (loaded)
+        {
+            // Orbit the centre of the model at a distance that keeps it in frame
+            vertex boundsMin, boundsMax;
+            renderer.sceneBounds(boundsMin, boundsMax);
+            vertex center = scaleV(addV(boundsMin, boundsMax), 0.5f);
+            vertex extent = subtractV(boundsMax, boundsMin);
+            float radius = 0.5f * sqrtf(dotProduct(extent, extent));
+            float distance = std::max(radius * 1.6f, 0.5f);
+
+            for (int view = 0; view < job.views; view++)
+            {
+                cameraState &cam = renderer.getCamera();
+                cam.yaw = 2.0f * 3.14159f * view / job.views;
+                cam.pitch = 0.0f;
+                cam.position = { center.x + distance * sinf(cam.yaw), center.y, center.z - distance * cosf(cam.yaw) };
+
+                renderer.frameRender();
+
+                char filename[512];
+                snprintf(filename, sizeof(filename), "%s%s_%02d.bmp", outputPrefix.c_str(), name.c_str(), view);
+                if (SDL_SaveBMP(surface, filename) != 0)
+                {
+                    std::cout << "Failed to save " << filename << ": " << SDL_GetError() << std::endl;
+                    // Missing images fail the job, not just cut it short
+                    renders = -1;
+                    break;
+                }
+                renders++;
+            }
+        }
+        else
+        {
+            renders = -1;
+        }
+    }
+
+    SDL_DestroyRenderer(render);
+    SDL_FreeSurface(surface);
+    return renders;
+}
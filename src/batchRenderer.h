@@ -0,0 +1,44 @@
+#include <SDL2/SDL.h>
+#include <string>
+#include <vector>
+#include <atomic>
+
+#ifndef BATCHRENDERER_H
+#define BATCHRENDERER_H
+
+// One model rendered from several points on a circle around it
+struct batchJob
+{
+    std::string meshFile;
+    std::string textureFile;    // "-" for an untextured model
+    int width;
+    int height;
+    int views;
+};
+
+// Batch files list one job per line:
+//     <mesh.obj> <texture.bmp | -> <width> <height> [views]
+bool loadBatchFile(const std::string &filename, std::vector<batchJob> &jobs);
+
+// Runs jobs on a pool of threads, each job with its own offscreen software
+// renderer, so no SDL or Renderer state is shared between threads
+class BatchRenderer
+{
+    public:
+        BatchRenderer(const std::vector<batchJob> &_jobs, const std::string &_outputPrefix, int _threads = 0);
+        bool run();
+
+    private:
+        void worker();
+        int renderJob(const batchJob &job);
+
+        std::vector<batchJob> jobs;
+        std::string outputPrefix;
+        int threads;
+
+        std::atomic<int> nextJob;
+        std::atomic<int> rendersDone;
+        std::atomic<int> jobsFailed;
+};
+
+#endif
@@ -0,0 +1,384 @@
+#include <SDL2/SDL.h>
+#include "graphicsEngine.h"
+#include "meshOptimizer.h"
+#include "meshBvh.h"
+#include "lightClusters.h"
+#include <iostream>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <algorithm>
+#include <functional>
+
+// Microbenchmarks for the engine's inner kernels, run on triangles from Models/.
+//     benchmark [--reps n] [--filter name]
+// Every kernel is warmed up, then timed over a number of repetitions. Each
+// repetition runs the kernel enough times to last at least a few milliseconds.
+// Output is one line per kernel with fixed columns so runs can be diffed:
+//     name  items  reps  ns/op  stddev%  min ns/op  items/s
+
+struct benchResult
+{
+    double mean;    // ns per item
+    double stddev;  // ns per item
+    double best;    // ns per item
+};
+
+// Written by every kernel so the work can't be optimized away
+static volatile float sink;
+
+static double secondsSince(std::chrono::high_resolution_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+static benchResult runBenchmark(size_t items, int reps, const std::function<void()> &kernel)
+{
+    // Warm caches, branch predictors and the clock for at least 100 ms
+    int calls = 0;
+    auto warmStart = std::chrono::high_resolution_clock::now();
+    do
+    {
+        kernel();
+        calls++;
+    } while (secondsSince(warmStart) < 0.1);
+
+    // Enough calls per repetition to last about 20 ms
+    double perCall = secondsSince(warmStart) / calls;
+    int inner = std::max(1, int(0.02 / perCall));
+
+    std::vector<double> samples;
+    for (int rep = 0; rep < reps; rep++)
+    {
+        auto start = std::chrono::high_resolution_clock::now();
+        for (int i = 0; i < inner; i++)
+            kernel();
+        samples.push_back(secondsSince(start) * 1e9 / (double(inner) * items));
+    }
+
+    benchResult result = { 0.0, 0.0, samples[0] };
+    for (double sample : samples)
+    {
+        result.mean += sample;
+        result.best = std::min(result.best, sample);
+    }
+    result.mean /= samples.size();
+    for (double sample : samples)
+        result.stddev += (sample - result.mean) * (sample - result.mean);
+    result.stddev = samples.size() > 1 ? sqrt(result.stddev / (samples.size() - 1)) : 0.0;
+    return result;
+}
+
+static void report(const char *name, size_t items, int reps, const benchResult &result)
+{
+    printf("%-24s %10zu %5d %12.3f %8.2f %12.3f %14.0f\n", name, items, reps, result.mean,
+           result.mean > 0.0 ? 100.0 * result.stddev / result.mean : 0.0, result.best, 1e9 / result.mean);
+}
+
+int main(int argc, char* argv[])
+{
+    int reps = 10;
+    std::string filter;
+    for (int arg = 1; arg < argc; arg++)
+    {
+        std::string option = argv[arg];
+        if (option == "--reps" && arg + 1 < argc)
+            reps = std::max(1, std::stoi(argv[++arg]));
+        else if (option == "--filter" && arg + 1 < argc)
+            filter = argv[++arg];
+    }
+
+    // Realistic inputs: a textured scan-sized model and a large untextured one
+    const std::string texturedFile = "Models/skeleton.obj";
+    const std::string plainFile = "Models/chess.obj";
+    mesh model;
+    if (!parseObjTextureFile(texturedFile, model) || model.triangles.empty())
+    {
+        return 1;
+    }
+
+    std::vector<vertex> points;
+    for (const auto &tri : model.triangles)
+        for (int i = 0; i < 3; i++)
+            points.push_back(tri.v[i]);
+
+    vertex boundsMin, boundsMax;
+    meshBounds(model, boundsMin, boundsMax);
+    vertex center = scaleV(addV(boundsMin, boundsMax), 0.5f);
+
+    // A camera looking at the model from the side, so projected depths spread out
+    matrix4 world = multiplyM(multiplyM(matrixRotateY(0.6f), matrixRotateX(0.3f)), matrixTranslate({0.0f, 0.0f, 20.0f}));
+    std::vector<matrix4> matrices;
+    for (int i = 0; i < 256; i++)
+        matrices.push_back(multiplyM(matrixRotateY(i * 0.01f), matrixTranslate({float(i), 0.0f, 1.0f})));
+
+    printf("# %s: %zu triangles, %s, %d repetitions\n", texturedFile.c_str(), model.triangles.size(), plainFile.c_str(), reps);
+    printf("%-24s %10s %5s %12s %8s %12s %14s\n", "# name", "items", "reps", "ns/op", "stddev%", "min ns/op", "items/s");
+
+    auto wanted = [&](const char *name)
+    {
+        return filter.empty() || std::string(name).find(filter) != std::string::npos;
+    };
+
+    if (wanted("multiplyVM"))
+    {
+        std::vector<vertex> out(points.size());
+        report("multiplyVM", points.size(), reps, runBenchmark(points.size(), reps, [&]
+        {
+            for (size_t i = 0; i < points.size(); i++)
+                multiplyVM(points[i], out[i], world);
+            sink = out[points.size() / 2].x;
+        }));
+    }
+
+    if (wanted("multiplyM"))
+    {
+        matrix4 product = world;
+        report("multiplyM", matrices.size(), reps, runBenchmark(matrices.size(), reps, [&]
+        {
+            for (const auto &m : matrices)
+                product = multiplyM(product, m);
+            sink = product.m[0][0];
+            product = world;
+        }));
+    }
+
+    if (wanted("normalize"))
+    {
+        report("normalize", points.size(), reps, runBenchmark(points.size(), reps, [&]
+        {
+            float total = 0.0f;
+            for (const auto &p : points)
+                total += normalize(p).x;
+            sink = total;
+        }));
+    }
+
+    // A plane through the middle of the model, so about half the triangles are cut
+    vertex plane = center;
+    vertex planeNormal = {0.0f, 1.0f, 0.0f};
+
+    if (wanted("intersectPlane"))
+    {
+        size_t segments = points.size() - 1;
+        report("intersectPlane", segments, reps, runBenchmark(segments, reps, [&]
+        {
+            float total = 0.0f;
+            for (size_t i = 0; i < segments; i++)
+                total += intersectPlane(plane, planeNormal, points[i], points[i + 1]).y;
+            sink = total;
+        }));
+    }
+
+    if (wanted("clipTriangle"))
+    {
+        report("clipTriangle", model.triangles.size(), reps, runBenchmark(model.triangles.size(), reps, [&]
+        {
+            int total = 0;
+            triangle out1, out2;
+            for (auto &tri : model.triangles)
+                total += clipTriangle(plane, planeNormal, tri, out1, out2);
+            sink = float(total);
+        }));
+    }
+
+    if (wanted("clipPolygon"))
+    {
+        // Through the engine's projection, with the camera inside the model so
+        // the near plane and the guard band both get work
+        matrix4 projection;
+        projection.m[0][0] = 0.5625f;
+        projection.m[1][1] = 1.0f;
+        projection.m[2][2] = 1000.0f / 999.9f;
+        projection.m[3][2] = -100.0f / 999.9f;
+        projection.m[2][3] = 1.0f;
+        matrix4 inside = matrixTranslate(scaleV(center, -1.0f));
+        std::vector<clipVertex> projected(points.size());
+        for (size_t i = 0; i < points.size(); i++)
+        {
+            vertex viewed;
+            multiplyVM(points[i], viewed, inside);
+            projectVM(scaleV(viewed, 4.0f), projected[i], projection);
+        }
+        size_t count = projected.size() / 3;
+        report("clipPolygon", count, reps, runBenchmark(count, reps, [&]
+        {
+            int total = 0;
+            clipVertex poly[maxClipVertices];
+            for (size_t i = 0; i < count; i++)
+            {
+                std::copy(&projected[i * 3], &projected[i * 3] + 3, poly);
+                if (clipOutcode(poly[0], 1.0f) & clipOutcode(poly[1], 1.0f) & clipOutcode(poly[2], 1.0f))
+                    continue;
+                if (clipOutcode(poly[0], 4.0f) | clipOutcode(poly[1], 4.0f) | clipOutcode(poly[2], 4.0f))
+                    total += clipPolygon(poly, 3, 4.0f);
+                else
+                    total += 3;
+            }
+            sink = float(total);
+        }));
+    }
+
+    if (wanted("sortByDepth"))
+    {
+        frameVector<visibleTriangle> unsorted;
+        for (const auto &tri : model.triangles)
+        {
+            visibleTriangle visible = { tri, NULL };
+            for (int i = 0; i < 3; i++)
+                multiplyVM(tri.v[i], visible.tri.v[i], world);
+            unsorted.push_back(visible);
+        }
+        // The copy back to the unsorted order is part of every call, it is
+        // linear and small next to the sort itself
+        frameVector<visibleTriangle> work = unsorted;
+        report("sortByDepth", unsorted.size(), reps, runBenchmark(unsorted.size(), reps, [&]
+        {
+            std::copy(unsorted.begin(), unsorted.end(), work.begin());
+            sortByDepth(work);
+            sink = work[0].tri.v[0].z;
+        }));
+    }
+
+    // The geometry stage as frameRender runs it, expanded triangles against
+    // shared vertices in exporter order and in vertex cache order
+    if (wanted("transform"))
+    {
+        frameVector<triangle> out;
+        frameVector<vertex> scratch;
+        report("transformTriangles", model.triangles.size(), reps, runBenchmark(model.triangles.size(), reps, [&]
+        {
+            transformTriangles(model, world, out);
+            sink = out[0].v[0].x;
+        }));
+
+        indexedMesh indexed;
+        buildIndexedMesh(model, indexed);
+        report("transformIndexed", model.triangles.size(), reps, runBenchmark(model.triangles.size(), reps, [&]
+        {
+            transformIndexed(indexed, world, scratch, out);
+            sink = out[0].v[0].x;
+        }));
+
+        optimizeVertexCache(indexed);
+        optimizeVertexFetch(indexed);
+        report("transformOptimized", model.triangles.size(), reps, runBenchmark(model.triangles.size(), reps, [&]
+        {
+            transformIndexed(indexed, world, scratch, out);
+            sink = out[0].v[0].x;
+        }));
+    }
+
+    // Rays from around the model through random points near it, half of them hitting
+    if (wanted("buildMeshBvh") || wanted("intersectMeshBvh"))
+    {
+        meshBvh bvh;
+        report("buildMeshBvh", model.triangles.size(), reps, runBenchmark(model.triangles.size(), reps, [&]
+        {
+            buildMeshBvh(model, bvh);
+            sink = float(bvh.nodes.size());
+        }));
+
+        std::vector<rayQuery> rays;
+        vertex extent = subtractV(boundsMax, boundsMin);
+        float radius = sqrtf(dotProduct(extent, extent));
+        Uint32 seed = 12345;
+        auto random = [&seed]()
+        {
+            seed = seed * 1664525u + 1013904223u;
+            return float(seed >> 8) / float(1 << 24) - 0.5f;
+        };
+        for (int i = 0; i < 1024; i++)
+        {
+            vertex origin = addV(center, scaleV(normalize({ random(), random(), random() }), radius));
+            vertex target = addV(center, multiplyV(extent, { random(), random(), random() }));
+            rays.push_back({ origin, subtractV(target, origin), 2.0f });
+        }
+        report("intersectMeshBvh", rays.size(), reps, runBenchmark(rays.size(), reps, [&]
+        {
+            int hits = 0;
+            for (const auto &ray : rays)
+            {
+                rayHit hit;
+                hit.distance = ray.maxDistance;
+                hits += intersectMeshBvh(bvh, ray.origin, ray.direction, hit) ? 1 : 0;
+            }
+            sink = float(hits);
+        }));
+    }
+
+    if (wanted("shadeClustered") || wanted("shadeUnclustered"))
+    {
+        // The model's faces in front of the camera, under 256 small lights scattered
+        // through its bounds. Unclustered is one cluster holding every light
+        vertex extent = subtractV(boundsMax, boundsMin);
+        float radius = sqrtf(dotProduct(extent, extent));
+        matrix4 view = matrixTranslate({ -center.x, -center.y, radius - center.z });
+        matrix4 projection;
+        projection.m[0][0] = 0.5625f;
+        projection.m[1][1] = 1.0f;
+        projection.m[2][2] = 1000.0f / (1000.0f - 0.1f);
+        projection.m[3][2] = (-1000.0f * 0.1f) / (1000.0f - 0.1f);
+        projection.m[2][3] = 1.0f;
+
+        Uint32 seed = 777;
+        auto random = [&seed]()
+        {
+            seed = seed * 1664525u + 1013904223u;
+            return float(seed >> 8) / float(1 << 24);
+        };
+        std::vector<sceneLight> lights(256);
+        for (sceneLight &light : lights)
+        {
+            light.position = addV(boundsMin, multiplyV(extent, { random(), random(), random() }));
+            light.radius = radius * 0.08f;
+            light.color = { random(), random(), random() };
+        }
+
+        LightClusters clustered;
+        LightClusters unclustered(1 << 20, 1);
+        for (LightClusters *clusters : { &clustered, &unclustered })
+        {
+            clusters->build(lights, view, projection, 0.1f, 1000.0f, 1280, 720);
+            litSurfaces faces;
+            for (const triangle &tri : model.triangles)
+            {
+                vertex centroid = scaleV(addV(addV(tri.v[0], tri.v[1]), tri.v[2]), 1.0f / 3.0f);
+                vertex normal = normalize(crossProduct(subtractV(tri.v[1], tri.v[0]), subtractV(tri.v[2], tri.v[0])));
+                vertex viewCentroid;
+                multiplyVM(centroid, viewCentroid, view);
+                faces.push(centroid, normal, clusters->clusterOf(viewCentroid), { 0.0f, 0.0f, 0.0f });
+            }
+            report(clusters == &clustered ? "shadeClustered" : "shadeUnclustered", faces.size(), reps, runBenchmark(faces.size(), reps, [&]
+            {
+                sink = float(clusters->shade(faces));
+            }));
+        }
+    }
+
+    // Parsers are timed per triangle produced, file reads included
+    if (wanted("parseObjFile"))
+    {
+        mesh probe;
+        parseObjFile(plainFile, probe);
+        size_t count = std::max<size_t>(probe.triangles.size(), 1);
+        report("parseObjFile", count, reps, runBenchmark(count, reps, [&]
+        {
+            mesh parsed;
+            parseObjFile(plainFile, parsed);
+            sink = float(parsed.triangles.size());
+        }));
+    }
+
+    if (wanted("parseObjTextureFile"))
+    {
+        report("parseObjTextureFile", model.triangles.size(), reps, runBenchmark(model.triangles.size(), reps, [&]
+        {
+            mesh parsed;
+            parseObjTextureFile(texturedFile, parsed);
+            sink = float(parsed.triangles.size());
+        }));
+    }
+
+    return 0;
+}
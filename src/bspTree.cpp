@@ -0,0 +1,265 @@
+#include <SDL2/SDL.h>
+#include "bspTree.h"
+#include <cmath>
+#include <algorithm>
+
+// Triangles waiting to be placed under a node side
+struct bspTask
+{
+    std::vector<triangle> triangles;
+    int parent;         // -1 for the root
+    bool front;
+};
+
+static bool trianglePlane(const triangle &tri, vertex &normal, float &distance)
+{
+    vertex n = crossProduct(subtractV(tri.v[1], tri.v[0]), subtractV(tri.v[2], tri.v[0]));
+    float length = sqrtf(dotProduct(n, n));
+    if (length <= 0.0f)
+        return false;
+    normal = scaleV(n, 1.0f / length);
+    distance = dotProduct(normal, tri.v[0]);
+    return true;
+}
+
+enum { onPlane = 0, inFront = 1, behind = 2, spanning = 3 };
+
+static int classifyTriangle(const triangle &tri, const vertex &normal, float distance, float epsilon, float d[3])
+{
+    int side = onPlane;
+    for (int i = 0; i < 3; i++)
+    {
+        d[i] = dotProduct(normal, tri.v[i]) - distance;
+        if (d[i] > epsilon)
+            side |= inFront;
+        else if (d[i] < -epsilon)
+            side |= behind;
+    }
+    return side;
+}
+
+// Cuts a spanning triangle along the plane, fanning each side's polygon back into triangles
+static void splitTriangle(const triangle &tri, const float d[3], float epsilon, std::vector<triangle> &front, std::vector<triangle> &back)
+{
+    vertex frontV[4], backV[4];
+    coord frontT[4], backT[4];
+    int frontCount = 0, backCount = 0;
+
+    for (int i = 0; i < 3; i++)
+    {
+        int j = (i + 1) % 3;
+        if (d[i] >= -epsilon)
+        {
+            frontV[frontCount] = tri.v[i];
+            frontT[frontCount++] = tri.t[i];
+        }
+        if (d[i] <= epsilon)
+        {
+            backV[backCount] = tri.v[i];
+            backT[backCount++] = tri.t[i];
+        }
+        if ((d[i] > epsilon && d[j] < -epsilon) || (d[i] < -epsilon && d[j] > epsilon))
+        {
+            float t = d[i] / (d[i] - d[j]);
+            vertex v = addV(tri.v[i], scaleV(subtractV(tri.v[j], tri.v[i]), t));
+            coord uv = { tri.t[i].u + (tri.t[j].u - tri.t[i].u) * t, tri.t[i].v + (tri.t[j].v - tri.t[i].v) * t };
+            frontV[frontCount] = v;
+            frontT[frontCount++] = uv;
+            backV[backCount] = v;
+            backT[backCount++] = uv;
+        }
+    }
+
+    for (int n = 1; n + 1 < frontCount; n++)
+    {
+        triangle piece = { { frontV[0], frontV[n], frontV[n + 1] }, { frontT[0], frontT[n], frontT[n + 1] }, tri.lightIntensity };
+        front.push_back(piece);
+    }
+    for (int n = 1; n + 1 < backCount; n++)
+    {
+        triangle piece = { { backV[0], backV[n], backV[n + 1] }, { backT[0], backT[n], backT[n + 1] }, tri.lightIntensity };
+        back.push_back(piece);
+    }
+}
+
+// Few splits first, then balance. Candidates and the triangles they are
+// scored against are both sampled, so a node costs linear time to build
+static int chooseSplitter(const std::vector<triangle> &triangles, float epsilon)
+{
+    const int candidates = 24;
+    const int samples = 256;
+    size_t count = triangles.size();
+    size_t sampleStep = std::max<size_t>(1, count / samples);
+
+    int best = -1;
+    long long bestScore = 0;
+    for (int c = 0; c < candidates; c++)
+    {
+        int index = int((count * c) / candidates);
+        vertex normal;
+        float distance;
+        if (!trianglePlane(triangles[index], normal, distance))
+            continue;
+
+        long long frontCount = 0, backCount = 0, splits = 0;
+        for (size_t i = 0; i < count; i += sampleStep)
+        {
+            float d[3];
+            int side = classifyTriangle(triangles[i], normal, distance, epsilon, d);
+            if (side == inFront)
+                frontCount++;
+            else if (side == behind)
+                backCount++;
+            else if (side == spanning)
+                splits++;
+        }
+        long long score = splits * 8 + std::llabs(frontCount - backCount);
+        if (best < 0 || score < bestScore)
+        {
+            best = index;
+            bestScore = score;
+        }
+        if (count <= 1)
+            break;
+    }
+
+    // Only degenerate triangles sampled, take any with an area
+    for (size_t i = 0; best < 0 && i < count; i++)
+    {
+        vertex normal;
+        float distance;
+        if (trianglePlane(triangles[i], normal, distance))
+            best = int(i);
+    }
+    return best;
+}
+
+void buildBspTree(const mesh &m, bspTree &tree)
+{
+    tree.nodes.clear();
+    tree.geometry.triangles.clear();
+    tree.root = -1;
+    if (m.triangles.empty())
+        return;
+
+    // Coplanar tolerance scaled to the model
+    vertex boundsMin, boundsMax;
+    meshBounds(m, boundsMin, boundsMax);
+    vertex extent = subtractV(boundsMax, boundsMin);
+    float epsilon = 1e-5f * std::max(std::max(extent.x, extent.y), std::max(extent.z, 1e-3f));
+
+    // Explicit stack, convex parts of a mesh can make the tree as deep as it has triangles
+    std::vector<bspTask> tasks;
+    tasks.push_back({ std::vector<triangle>(m.triangles.begin(), m.triangles.end()), -1, false });
+    while (!tasks.empty())
+    {
+        bspTask task = std::move(tasks.back());
+        tasks.pop_back();
+
+        bspNode node;
+        node.front = -1;
+        node.back = -1;
+        node.first = int(tree.geometry.triangles.size());
+        node.count = 0;
+
+        std::vector<triangle> front, back;
+        int splitter = chooseSplitter(task.triangles, epsilon);
+        if (splitter < 0)
+        {
+            // Nothing but zero area triangles, their order can't show
+            node.normal = { 0.0f, 1.0f, 0.0f };
+            node.distance = dotProduct(node.normal, task.triangles[0].v[0]);
+            for (const auto &tri : task.triangles)
+                tree.geometry.triangles.push_back(tri);
+        }
+        else
+        {
+            trianglePlane(task.triangles[splitter], node.normal, node.distance);
+            for (const auto &tri : task.triangles)
+            {
+                float d[3];
+                int side = classifyTriangle(tri, node.normal, node.distance, epsilon, d);
+                if (side == onPlane)
+                    tree.geometry.triangles.push_back(tri);
+                else if (side == inFront)
+                    front.push_back(tri);
+                else if (side == behind)
+                    back.push_back(tri);
+                else
+                    splitTriangle(tri, d, epsilon, front, back);
+            }
+        }
+        node.count = int(tree.geometry.triangles.size()) - node.first;
+
+        int index = int(tree.nodes.size());
+        tree.nodes.push_back(node);
+        if (task.parent < 0)
+            tree.root = index;
+        else if (task.front)
+            tree.nodes[task.parent].front = index;
+        else
+            tree.nodes[task.parent].back = index;
+
+        task.triangles = std::vector<triangle>();
+        if (!front.empty())
+            tasks.push_back({ std::move(front), index, true });
+        if (!back.empty())
+            tasks.push_back({ std::move(back), index, false });
+    }
+}
+
+void traverseBspTree(const bspTree &tree, const vertex &eye, frameVector<int> &order)
+{
+    order.clear();
+    if (tree.root < 0)
+        return;
+
+    // Entries >= 0 visit a node, ~node emits its own triangles.
+    // Kept between calls so a steady frame doesn't allocate
+    static thread_local std::vector<int> stack;
+    stack.clear();
+    stack.push_back(tree.root);
+    while (!stack.empty())
+    {
+        int entry = stack.back();
+        stack.pop_back();
+        if (entry < 0)
+        {
+            const bspNode &node = tree.nodes[~entry];
+            for (int i = node.first; i < node.first + node.count; i++)
+                order.push_back(i);
+            continue;
+        }
+
+        // Far side first, then the plane, then the near side (pushed in reverse)
+        const bspNode &node = tree.nodes[entry];
+        bool eyeInFront = dotProduct(node.normal, eye) - node.distance >= 0.0f;
+        int nearChild = eyeInFront ? node.front : node.back;
+        int farChild = eyeInFront ? node.back : node.front;
+        if (nearChild >= 0)
+            stack.push_back(nearChild);
+        stack.push_back(~entry);
+        if (farChild >= 0)
+            stack.push_back(farChild);
+    }
+}
+
+int bspTreeDepth(const bspTree &tree)
+{
+    if (tree.root < 0)
+        return 0;
+    int deepest = 0;
+    std::vector<std::pair<int, int>> stack = { { tree.root, 1 } };
+    while (!stack.empty())
+    {
+        auto entry = stack.back();
+        stack.pop_back();
+        deepest = std::max(deepest, entry.second);
+        const bspNode &node = tree.nodes[entry.first];
+        if (node.front >= 0)
+            stack.push_back({ node.front, entry.second + 1 });
+        if (node.back >= 0)
+            stack.push_back({ node.back, entry.second + 1 });
+    }
+    return deepest;
+}
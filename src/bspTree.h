@@ -0,0 +1,34 @@
+#include <SDL2/SDL.h>
+#include "graphicsEngine.h"
+
+#ifndef BSPTREE_H
+#define BSPTREE_H
+
+// One splitting plane and the triangles lying in it
+struct bspNode
+{
+    vertex normal;
+    float distance;     // plane is dot(normal, p) == distance
+    int front;          // child node index, -1 for none
+    int back;
+    int first;          // range of coplanar triangles in geometry
+    int count;
+};
+
+// Built once per mesh in model space, so every instance of the mesh shares
+// it whatever its transform. Triangles crossing a plane are split, which is
+// what makes the order exact where a centroid sort gets it wrong
+struct bspTree
+{
+    mesh geometry;              // the mesh after splitting, grouped by node
+    std::vector<bspNode> nodes;
+    int root = -1;
+};
+
+void buildBspTree(const mesh &m, bspTree &tree);
+// Triangle indices into geometry from farthest to nearest as seen from eye,
+// which is in the same model space as the tree
+void traverseBspTree(const bspTree &tree, const vertex &eye, frameVector<int> &order);
+int bspTreeDepth(const bspTree &tree);
+
+#endif
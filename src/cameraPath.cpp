@@ -0,0 +1,83 @@
+#include <SDL2/SDL.h>
+#include "cameraPath.h"
+#include <iostream>
+
+static const char pathMagic[4] = { 'C', 'P', 'T', 'H' };
+// Bumped whenever cameraPathFrame changes layout
+static const Uint32 pathVersion = 1;
+static const size_t pathHeader = sizeof(pathMagic) + sizeof(pathVersion);
+
+CameraPathRecorder::CameraPathRecorder(const std::string &filename)
+{
+    frames = 0;
+    file.open(filename, std::ios::binary | std::ios::trunc);
+    if (!file.is_open())
+    {
+        std::cout << "Failed to open camera path: " << filename << std::endl;
+        return;
+    }
+    file.write(pathMagic, sizeof(pathMagic));
+    file.write(reinterpret_cast<const char*>(&pathVersion), sizeof(pathVersion));
+}
+
+bool CameraPathRecorder::isOpen()
+{
+    return file.is_open() && file.good();
+}
+
+void CameraPathRecorder::record(const cameraPathFrame &frame)
+{
+    if (isOpen())
+    {
+        file.write(reinterpret_cast<const char*>(&frame), sizeof(frame));
+        frames++;
+    }
+}
+
+int CameraPathRecorder::framesWritten()
+{
+    return frames;
+}
+
+CameraPathPlayer::CameraPathPlayer(const std::string &filename)
+{
+    frames = 0;
+    file.open(filename, std::ios::binary);
+    if (!file.is_open())
+    {
+        std::cout << "Failed to open camera path: " << filename << std::endl;
+        return;
+    }
+    char magic[4];
+    Uint32 version = 0;
+    file.read(magic, sizeof(magic));
+    file.read(reinterpret_cast<char*>(&version), sizeof(version));
+    if (!file || std::string(magic, 4) != std::string(pathMagic, 4) || version != pathVersion)
+    {
+        std::cout << "Failed to read camera path: " << filename << std::endl;
+        file.close();
+        return;
+    }
+
+    // Records are fixed size, so the length says how many there are
+    file.seekg(0, std::ios::end);
+    frames = int((size_t(file.tellg()) - pathHeader) / sizeof(cameraPathFrame));
+    file.seekg(pathHeader);
+}
+
+bool CameraPathPlayer::isOpen()
+{
+    return file.is_open();
+}
+
+bool CameraPathPlayer::next(cameraPathFrame &frame)
+{
+    if (!file.is_open())
+        return false;
+    return bool(file.read(reinterpret_cast<char*>(&frame), sizeof(frame)));
+}
+
+int CameraPathPlayer::frameCount()
+{
+    return frames;
+}
@@ -0,0 +1,48 @@
+#include <SDL2/SDL.h>
+#include <fstream>
+#include <string>
+#include "graphicsEngine.h"
+#include "inputHandler.h"
+
+#ifndef CAMERAPATH_H
+#define CAMERAPATH_H
+
+// One frame of a recorded session: what was pressed, the frame time it was
+// scaled by, and where that left the camera (rotation included)
+struct cameraPathFrame
+{
+    inputFrame input;
+    float time;
+    cameraState cam;
+};
+
+// Appends a fixed size record per frame, around 60 bytes
+class CameraPathRecorder
+{
+    public:
+        CameraPathRecorder(const std::string &filename);
+        bool isOpen();
+        void record(const cameraPathFrame &frame);
+        int framesWritten();
+    private:
+        std::ofstream file;
+        int frames;
+};
+
+// Plays a recording back frame by frame. The camera is set from the stored
+// pose rather than by applying the input again, so changes to how input
+// moves the camera don't bend old paths
+class CameraPathPlayer
+{
+    public:
+        CameraPathPlayer(const std::string &filename);
+        bool isOpen();
+        // False once the path has run out
+        bool next(cameraPathFrame &frame);
+        int frameCount();
+    private:
+        std::ifstream file;
+        int frames;
+};
+
+#endif
@@ -0,0 +1,107 @@
+#include <SDL2/SDL.h>
+#include "commandBuffer.h"
+
+void CommandBuffer::reset()
+{
+    commands.clear();
+    vertices.clear();
+    text.clear();
+    textures.clear();
+}
+
+void CommandBuffer::clear(SDL_Color color)
+{
+    drawCommand command = {};
+    command.type = DrawCommandType::Clear;
+    command.texture = -1;
+    command.color = color;
+    commands.push_back(command);
+}
+
+Sint32 CommandBuffer::textureIndex(SDL_Texture *texture)
+{
+    if (!texture)
+        return -1;
+    // A frame binds a handful of textures at most, a scan beats a map
+    for (size_t i = 0; i < textures.size(); i++)
+    {
+        if (textures[i] == texture)
+            return Sint32(i);
+    }
+    textures.push_back(texture);
+    return Sint32(textures.size() - 1);
+}
+
+void CommandBuffer::drawTriangle(SDL_Texture *texture, const SDL_Vertex triangleVertices[3])
+{
+    Sint32 index = textureIndex(texture);
+    if (commands.empty() || commands.back().type != DrawCommandType::Geometry || commands.back().texture != index)
+    {
+        drawCommand command = {};
+        command.type = DrawCommandType::Geometry;
+        command.texture = index;
+        command.first = Uint32(vertices.size());
+        commands.push_back(command);
+    }
+    vertices.insert(vertices.end(), triangleVertices, triangleVertices + 3);
+    commands.back().count += 3;
+}
+
+SDL_Vertex *CommandBuffer::appendGeometry(SDL_Texture *texture, Uint32 count)
+{
+    Sint32 index = textureIndex(texture);
+    if (commands.empty() || commands.back().type != DrawCommandType::Geometry || commands.back().texture != index)
+    {
+        drawCommand command = {};
+        command.type = DrawCommandType::Geometry;
+        command.texture = index;
+        command.first = Uint32(vertices.size());
+        commands.push_back(command);
+    }
+    size_t first = vertices.size();
+    vertices.resize(first + count);
+    commands.back().count += count;
+    return vertices.data() + first;
+}
+
+void CommandBuffer::drawText(const std::string &_text, int x, int y, float scale, SDL_Color color, bool centered)
+{
+    drawCommand command = {};
+    command.type = DrawCommandType::Text;
+    command.texture = -1;
+    command.first = Uint32(text.size());
+    command.count = Uint32(_text.size());
+    command.color = color;
+    command.x = float(x);
+    command.y = float(y);
+    command.scale = scale;
+    command.centered = centered ? 1 : 0;
+    commands.push_back(command);
+    text += _text;
+}
+
+void CommandBuffer::setViewport(const SDL_Rect *rect)
+{
+    drawCommand command = {};
+    command.type = DrawCommandType::Viewport;
+    command.texture = -1;
+    if (rect)
+    {
+        command.x = float(rect->x);
+        command.y = float(rect->y);
+        command.first = Uint32(rect->w);
+        command.count = Uint32(rect->h);
+    }
+    commands.push_back(command);
+}
+
+int CommandBuffer::batchCount() const
+{
+    int count = 0;
+    for (const auto &command : commands)
+    {
+        if (command.type == DrawCommandType::Geometry)
+            count++;
+    }
+    return count;
+}
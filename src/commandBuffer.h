@@ -0,0 +1,57 @@
+#include <SDL2/SDL.h>
+#include <string>
+#include <vector>
+#include "memoryTracker.h"
+
+#ifndef COMMANDBUFFER_H
+#define COMMANDBUFFER_H
+
+enum class DrawCommandType : Uint32
+{
+    Clear,
+    Geometry,
+    Text,
+    Viewport        // x, y and first, count as width, height. Width 0 is the whole target
+};
+
+// Plain data so a frame can be written to disk as is
+struct drawCommand
+{
+    DrawCommandType type;
+    Sint32 texture;     // index into the frame's texture table, -1 for none
+    Uint32 first;       // first vertex, or first byte of text
+    Uint32 count;
+    SDL_Color color;
+    float x;
+    float y;
+    float scale;
+    Uint32 centered;
+};
+
+// Everything one frame draws, recorded by the pipeline and handed to a
+// backend afterwards. Storage is kept between frames so recording doesn't allocate
+class CommandBuffer
+{
+    public:
+        void reset();
+        void clear(SDL_Color color);
+        // Joins the previous geometry command when the texture is the same
+        void drawTriangle(SDL_Texture *texture, const SDL_Vertex vertices[3]);
+        // Room for count vertices drawn with texture, joined the same way, for
+        // callers that write their geometry in place
+        SDL_Vertex *appendGeometry(SDL_Texture *texture, Uint32 count);
+        void drawText(const std::string &_text, int x, int y, float scale, SDL_Color color, bool centered);
+        // Later commands draw relative to rect and are clipped to it, NULL goes back to the whole target
+        void setViewport(const SDL_Rect *rect);
+        // Geometry commands, i.e. texture binds a backend has to make
+        int batchCount() const;
+
+        std::vector<drawCommand> commands;
+        frameVector<SDL_Vertex> vertices;
+        std::string text;
+        std::vector<SDL_Texture*> textures;
+    private:
+        Sint32 textureIndex(SDL_Texture *texture);
+};
+
+#endif
@@ -3,19 +3,26 @@
 #include <unordered_map>
 #include <iostream>
 #include "fontRenderer.h"
+#include "textureLoader.h"
 
 FontRenderer::FontRenderer(SDL_Renderer* renderer, const std::string& fontFile)
 {
-    SDL_Surface* surface = SDL_LoadBMP("Textures/font.bmp");
-    if (!surface) {
-        std::cout << "Failed to open texture: " << "font.bmp" << std::endl;
-    }
-    texture = SDL_CreateTextureFromSurface(renderer, surface);
-    SDL_FreeSurface(surface);    
+    TextureLoader loader(renderer);
+    int width = 0;
+    int height = 0;
+    texture = loader.loadBMP("Textures/font.bmp", width, height);
+    textureBytes = texture ? size_t(width) * height * 4 : 0;
+    trackAllocation(MemoryTag::Text, textureBytes);
 
     initializeGlyphs();
 }
 
+FontRenderer::~FontRenderer()
+{
+    SDL_DestroyTexture(texture);
+    trackFree(MemoryTag::Text, textureBytes);
+}
+
 void FontRenderer::renderText(SDL_Renderer* renderer, const std::string& text, int x, int y, float scale)
 {
     SDL_SetTextureColorMod(texture, 255, 255, 255);
@@ -2,11 +2,16 @@
 #include <string>
 #include <unordered_map>
 #include <iostream>
+#include "memoryTracker.h"
+
+#ifndef FONTRENDERER_H
+#define FONTRENDERER_H
 
 class FontRenderer
 {
     public:
         FontRenderer(SDL_Renderer* renderer, const std::string& fontFile);
+        ~FontRenderer();
         void renderText(SDL_Renderer* renderer, const std::string& text, int x, int y, float scale);
         void renderText(SDL_Renderer* renderer, const std::string& text, int x, int y, float scale, int r, int g, int b);
         void renderTextCentered(SDL_Renderer* renderer, const std::string& text, int x, int y, float scale);
@@ -14,7 +19,11 @@ class FontRenderer
 
     private:
         SDL_Texture* texture;
-        std::unordered_map<char, SDL_Rect> glyphs;
+        size_t textureBytes;
+        std::unordered_map<char, SDL_Rect, std::hash<char>, std::equal_to<char>,
+                           TrackedAllocator<std::pair<const char, SDL_Rect>, MemoryTag::Text>> glyphs;
 
         void initializeGlyphs();
-};
\ No newline at end of file
+};
+
+#endif
\ No newline at end of file
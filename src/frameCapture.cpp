@@ -0,0 +1,239 @@
+#include <SDL2/SDL.h>
+#include "frameCapture.h"
+#include <iostream>
+#include <chrono>
+#include <algorithm>
+
+FrameCapture::FrameCapture(const std::string &_path, CaptureFormat _format, int _width, int _height, int _fps, int poolSize)
+{
+    path = _path;
+    format = _format;
+    width = _width;
+    height = _height;
+    fps = _fps;
+    stopping = false;
+
+    captured = 0;
+    readbackSeconds = 0.0;
+    stallSeconds = 0.0;
+    written = 0;
+    bytesWritten = 0.0;
+    writeSeconds = 0.0;
+
+    if (format != CaptureFormat::PPM)
+    {
+        stream.open(path, std::ios::binary);
+        if (!stream.is_open())
+        {
+            std::cout << "Failed to open capture file: " << path << std::endl;
+            open = false;
+            return;
+        }
+    }
+    if (format == CaptureFormat::Y4M)
+    {
+        stream << "YUV4MPEG2 W" << width << " H" << height << " F" << fps << ":1 Ip A1:1 C444 XCOLORRANGE=FULL\n";
+        planes.resize(size_t(width) * height * 3);
+    }
+
+    // Every buffer is allocated once here and recycled for the whole capture
+    buffers.resize(std::max(poolSize, 1));
+    for (size_t i = 0; i < buffers.size(); i++)
+    {
+        buffers[i].resize(size_t(width) * height * 4);
+        freeBuffers.push_back(int(i));
+    }
+
+    open = true;
+    writer = std::thread(&FrameCapture::writerLoop, this);
+}
+
+FrameCapture::~FrameCapture()
+{
+    finish();
+}
+
+bool FrameCapture::isOpen()
+{
+    return open;
+}
+
+int FrameCapture::framesCaptured()
+{
+    return captured;
+}
+
+void FrameCapture::captureFrame(SDL_Renderer *render)
+{
+    if (!open)
+        return;
+
+    auto startTime = std::chrono::high_resolution_clock::now();
+
+    int buffer;
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        // Backpressure: wait for the writer to hand a buffer back
+        bufferFreed.wait(guard, [this] { return !freeBuffers.empty(); });
+        buffer = freeBuffers.back();
+        freeBuffers.pop_back();
+    }
+
+    auto readTime = std::chrono::high_resolution_clock::now();
+    int status = SDL_RenderReadPixels(render, NULL, SDL_PIXELFORMAT_RGBA32, buffers[buffer].data(), width * 4);
+    auto endTime = std::chrono::high_resolution_clock::now();
+
+    stallSeconds += std::chrono::duration<double>(readTime - startTime).count();
+    readbackSeconds += std::chrono::duration<double>(endTime - readTime).count();
+
+    // Whatever is in the buffer is stale, so the frame is dropped
+    if (status != 0)
+    {
+        std::cout << "Failed to read back frame " << captured << ": " << SDL_GetError() << std::endl;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            freeBuffers.push_back(buffer);
+        }
+        bufferFreed.notify_one();
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        pending.push_back({buffer, captured});
+    }
+    frameQueued.notify_one();
+    captured++;
+}
+
+void FrameCapture::finish()
+{
+    if (!open)
+        return;
+
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+    frameQueued.notify_one();
+    writer.join();
+    stream.close();
+    open = false;
+}
+
+void FrameCapture::writerLoop()
+{
+    while (true)
+    {
+        pendingFrame frame;
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            frameQueued.wait(guard, [this] { return stopping || !pending.empty(); });
+            if (pending.empty())
+                return; // stopping and fully drained
+            frame = pending.front();
+            pending.pop_front();
+        }
+
+        auto startTime = std::chrono::high_resolution_clock::now();
+        writeFrame(buffers[frame.buffer], frame.number);
+        auto endTime = std::chrono::high_resolution_clock::now();
+
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            freeBuffers.push_back(frame.buffer);
+            written++;
+            writeSeconds += std::chrono::duration<double>(endTime - startTime).count();
+        }
+        bufferFreed.notify_one();
+    }
+}
+
+void FrameCapture::writeFrame(const frameVector<Uint8> &pixels, int number)
+{
+    size_t frameBytes = 0;
+
+    if (format == CaptureFormat::RawRGBA)
+    {
+        stream.write(reinterpret_cast<const char*>(pixels.data()), pixels.size());
+        frameBytes = pixels.size();
+    }
+    else if (format == CaptureFormat::PPM)
+    {
+        char filename[512];
+        snprintf(filename, sizeof(filename), "%s%05d.ppm", path.c_str(), number);
+        std::ofstream file(filename, std::ios::binary);
+        if (!file.is_open())
+        {
+            std::cout << "Failed to open capture file: " << filename << std::endl;
+            return;
+        }
+        file << "P6\n" << width << " " << height << "\n255\n";
+
+        // PPM has no alpha, drop it one row at a time
+        std::vector<Uint8> row(size_t(width) * 3);
+        for (int y = 0; y < height; y++)
+        {
+            const Uint8 *src = &pixels[size_t(y) * width * 4];
+            for (int x = 0; x < width; x++)
+            {
+                row[x * 3 + 0] = src[x * 4 + 0];
+                row[x * 3 + 1] = src[x * 4 + 1];
+                row[x * 3 + 2] = src[x * 4 + 2];
+            }
+            file.write(reinterpret_cast<const char*>(row.data()), row.size());
+        }
+        frameBytes = size_t(width) * height * 3;
+    }
+    else
+    {
+        writeY4MFrame(pixels);
+        frameBytes = planes.size();
+    }
+
+    std::lock_guard<std::mutex> guard(lock);
+    bytesWritten += frameBytes;
+}
+
+void FrameCapture::writeY4MFrame(const frameVector<Uint8> &pixels)
+{
+    // Full range BT.601, the same conversion JPEG uses
+    size_t count = size_t(width) * height;
+    Uint8 *yPlane = &planes[0];
+    Uint8 *uPlane = &planes[count];
+    Uint8 *vPlane = &planes[count * 2];
+
+    for (size_t i = 0; i < count; i++)
+    {
+        float r = pixels[i * 4 + 0];
+        float g = pixels[i * 4 + 1];
+        float b = pixels[i * 4 + 2];
+        float y = 0.299f * r + 0.587f * g + 0.114f * b;
+        float u = 128.0f - 0.168736f * r - 0.331264f * g + 0.5f * b;
+        float v = 128.0f + 0.5f * r - 0.418688f * g - 0.081312f * b;
+        yPlane[i] = static_cast<Uint8>(std::min(std::max(y, 0.0f), 255.0f) + 0.5f);
+        uPlane[i] = static_cast<Uint8>(std::min(std::max(u, 0.0f), 255.0f) + 0.5f);
+        vPlane[i] = static_cast<Uint8>(std::min(std::max(v, 0.0f), 255.0f) + 0.5f);
+    }
+
+    stream << "FRAME\n";
+    stream.write(reinterpret_cast<const char*>(planes.data()), planes.size());
+}
+
+void FrameCapture::printStats()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    double megabytes = bytesWritten / (1024.0 * 1024.0);
+    std::cout << "Capture: " << captured << " frames read back, " << written << " written, "
+              << megabytes << " MB" << std::endl;
+    if (captured > 0)
+    {
+        std::cout << "  readback " << readbackSeconds * 1000.0 / captured << " ms/frame, "
+                  << "stalled on writer " << stallSeconds * 1000.0 << " ms total" << std::endl;
+    }
+    if (writeSeconds > 0.0)
+    {
+        std::cout << "  writer " << written / writeSeconds << " frames/s, "
+                  << megabytes / writeSeconds << " MB/s" << std::endl;
+    }
+}
@@ -0,0 +1,75 @@
+#include <SDL2/SDL.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <fstream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "memoryTracker.h"
+
+#ifndef FRAMECAPTURE_H
+#define FRAMECAPTURE_H
+
+enum class CaptureFormat
+{
+    RawRGBA,    // every frame appended to one file, width * height * 4 bytes each
+    PPM,        // one binary PPM per frame, path is used as a filename prefix
+    Y4M         // YUV4MPEG2 4:4:4 video stream
+};
+
+// Reads back presented frames into a small pool of reused buffers and hands
+// them to a writer thread. When every buffer is waiting on disk the render
+// thread blocks in captureFrame until one frees up, so memory stays bounded.
+class FrameCapture
+{
+    public:
+        FrameCapture(const std::string &_path, CaptureFormat _format, int _width, int _height, int _fps, int poolSize = 4);
+        ~FrameCapture();
+        bool isOpen();
+        void captureFrame(SDL_Renderer *render);
+        void finish();
+        void printStats();
+        int framesCaptured();
+
+    private:
+        struct pendingFrame
+        {
+            int buffer;
+            int number;
+        };
+
+        void writerLoop();
+        void writeFrame(const frameVector<Uint8> &pixels, int number);
+        void writeY4MFrame(const frameVector<Uint8> &pixels);
+
+        std::string path;
+        CaptureFormat format;
+        int width;
+        int height;
+        int fps;
+        bool open;
+
+        std::ofstream stream;
+        std::vector<frameVector<Uint8>> buffers;
+        std::vector<int> freeBuffers;
+        std::deque<pendingFrame> pending;
+        frameVector<Uint8> planes;
+
+        std::mutex lock;
+        std::condition_variable bufferFreed;
+        std::condition_variable frameQueued;
+        std::thread writer;
+        bool stopping;
+
+        // Stats, render thread side
+        int captured;
+        double readbackSeconds;
+        double stallSeconds;
+        // Stats, writer thread side (read under lock)
+        int written;
+        double bytesWritten;
+        double writeSeconds;
+};
+
+#endif
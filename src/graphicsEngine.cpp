@@ -1,8 +1,25 @@
 #include <SDL2/SDL.h>
 #include "graphicsEngine.h"
+#include "scene.h"
+#include "frameCapture.h"
+#include "quantizedMesh.h"
+#include "meshOptimizer.h"
+#include "bspTree.h"
+#include "animation.h"
+#include "workerPool.h"
+#include "textureAtlas.h"
+#include "renderBackend.h"
+#include "meshStreaming.h"
+#include "meshBvh.h"
+#include "lightClusters.h"
+#include "stressScene.h"
+#include "particleSystem.h"
+#include "terrain.h"
 #include <iostream>
 #include <chrono>
 #include <sstream>
+#include <cmath>
+#include <algorithm>
 
 vertex crossProduct(const vertex& a, const vertex& b)
 {
@@ -38,7 +55,7 @@ vertex multiplyV(const vertex& a, const vertex& b)
     return vertex{a.x * b.x, a.y * b.y, a.z * b.z};
 }
 
-void multiplyVM(vertex &v, vertex &product, matrix4 &m)
+void multiplyVM(const vertex &v, vertex &product, const matrix4 &m)
 {
     product.x = v.x * m.m[0][0] + v.y * m.m[1][0] + v.z * m.m[2][0] + m.m[3][0];
     product.y = v.x * m.m[0][1] + v.y * m.m[1][1] + v.z * m.m[2][1] + m.m[3][1];
@@ -118,6 +135,91 @@ matrix4 matrixRotateY(float _yaw)
 	return matrix;
 }
 
+matrix4 matrixRotateZ(float _roll)
+{
+    matrix4 matrix;
+    matrix.m[0][0] = cosf(_roll);
+    matrix.m[0][1] = sinf(_roll);
+    matrix.m[1][0] = -sinf(_roll);
+    matrix.m[1][1] = cosf(_roll);
+    matrix.m[2][2] = 1.0f;
+    matrix.m[3][3] = 1.0f;
+    return matrix;
+}
+
+matrix4 matrixTranslate(const vertex &offset)
+{
+    matrix4 matrix;
+    matrix.m[0][0] = 1.0f;
+    matrix.m[1][1] = 1.0f;
+    matrix.m[2][2] = 1.0f;
+    matrix.m[3][0] = offset.x;
+    matrix.m[3][1] = offset.y;
+    matrix.m[3][2] = offset.z;
+    matrix.m[3][3] = 1.0f;
+    return matrix;
+}
+
+matrix4 matrixScale(float _scale)
+{
+    matrix4 matrix;
+    matrix.m[0][0] = _scale;
+    matrix.m[1][1] = _scale;
+    matrix.m[2][2] = _scale;
+    matrix.m[3][3] = 1.0f;
+    return matrix;
+}
+
+void meshBounds(const mesh &m, vertex &boundsMin, vertex &boundsMax)
+{
+    boundsMin = { 0.0f, 0.0f, 0.0f };
+    boundsMax = { 0.0f, 0.0f, 0.0f };
+    if (m.triangles.empty())
+        return;
+
+    boundsMin = m.triangles[0].v[0];
+    boundsMax = m.triangles[0].v[0];
+    for (const auto &tri : m.triangles)
+    {
+        for (int i = 0; i < 3; i++)
+        {
+            boundsMin.x = std::min(boundsMin.x, tri.v[i].x);
+            boundsMin.y = std::min(boundsMin.y, tri.v[i].y);
+            boundsMin.z = std::min(boundsMin.z, tri.v[i].z);
+            boundsMax.x = std::max(boundsMax.x, tri.v[i].x);
+            boundsMax.y = std::max(boundsMax.y, tri.v[i].y);
+            boundsMax.z = std::max(boundsMax.z, tri.v[i].z);
+        }
+    }
+}
+
+void transformTriangles(const mesh &m, const matrix4 &world, frameVector<triangle> &out)
+{
+    // Model matrices are affine, so unlike multiplyVM there is no w to divide by
+    const float m00 = world.m[0][0], m01 = world.m[0][1], m02 = world.m[0][2];
+    const float m10 = world.m[1][0], m11 = world.m[1][1], m12 = world.m[1][2];
+    const float m20 = world.m[2][0], m21 = world.m[2][1], m22 = world.m[2][2];
+    const float m30 = world.m[3][0], m31 = world.m[3][1], m32 = world.m[3][2];
+
+    size_t count = m.triangles.size();
+    out.resize(count);
+    const triangle *in = m.triangles.data();
+    triangle *result = out.data();
+    for (size_t n = 0; n < count; n++)
+    {
+        for (int i = 0; i < 3; i++)
+        {
+            float x = in[n].v[i].x;
+            float y = in[n].v[i].y;
+            float z = in[n].v[i].z;
+            result[n].v[i].x = x * m00 + y * m10 + z * m20 + m30;
+            result[n].v[i].y = x * m01 + y * m11 + z * m21 + m31;
+            result[n].v[i].z = x * m02 + y * m12 + z * m22 + m32;
+            result[n].t[i] = in[n].t[i];
+        }
+    }
+}
+
 matrix4 inverseMatrix4(matrix4& m)
 {
     matrix4 matrix;
@@ -140,58 +242,101 @@ matrix4 inverseMatrix4(matrix4& m)
     return matrix;
 }
 
+matrix4 inverseAffine(const matrix4 &m)
+{
+    // Inverse of the upper 3x3 from its cofactors, then the translation pulled back through it
+    float a = m.m[0][0], b = m.m[0][1], c = m.m[0][2];
+    float d = m.m[1][0], e = m.m[1][1], f = m.m[1][2];
+    float g = m.m[2][0], h = m.m[2][1], k = m.m[2][2];
+    float det = a * (e * k - f * h) - b * (d * k - f * g) + c * (d * h - e * g);
+    float inv = det != 0.0f ? 1.0f / det : 0.0f;
+
+    matrix4 matrix;
+    matrix.m[0][0] = (e * k - f * h) * inv;
+    matrix.m[0][1] = (c * h - b * k) * inv;
+    matrix.m[0][2] = (b * f - c * e) * inv;
+    matrix.m[1][0] = (f * g - d * k) * inv;
+    matrix.m[1][1] = (a * k - c * g) * inv;
+    matrix.m[1][2] = (c * d - a * f) * inv;
+    matrix.m[2][0] = (d * h - e * g) * inv;
+    matrix.m[2][1] = (b * g - a * h) * inv;
+    matrix.m[2][2] = (a * e - b * d) * inv;
+    for (int col = 0; col < 3; col++)
+        matrix.m[3][col] = -(m.m[3][0] * matrix.m[0][col] + m.m[3][1] * matrix.m[1][col] + m.m[3][2] * matrix.m[2][col]);
+    matrix.m[3][3] = 1.0f;
+    return matrix;
+}
+
+void sortByDepth(frameVector<visibleTriangle> &triangles, size_t first)
+{
+    // Sorts depth and index pairs rather than the triangles themselves, with
+    // each depth worked out once. Same comparisons in the same order, so the
+    // order comes out as sorting the triangles directly would give
+    static thread_local frameVector<std::pair<float, uint32_t>> keys;
+    static thread_local frameVector<visibleTriangle> sorted;
+    size_t count = triangles.size() - first;
+    keys.resize(count);
+    for (size_t i = 0; i < count; i++)
+    {
+        const triangle &tri = triangles[first + i].tri;
+        keys[i] = { (tri.v[0].z + tri.v[1].z + tri.v[2].z) / 3.0f, uint32_t(i) };
+    }
+    sort(keys.begin(), keys.end(), [](const std::pair<float, uint32_t> &k1, const std::pair<float, uint32_t> &k2)
+    {
+        return k1.first > k2.first;
+    });
+    sorted.resize(count);
+    for (size_t i = 0; i < count; i++)
+        sorted[i] = triangles[first + keys[i].second];
+    std::copy(sorted.begin(), sorted.end(), triangles.begin() + first);
+}
+
 vertex intersectPlane(vertex &plane, vertex &planeNormal, vertex &start, vertex &end)
+{
+    float t;
+    return intersectPlane(plane, planeNormal, start, end, t);
+}
+
+vertex intersectPlane(vertex &plane, vertex &planeNormal, vertex &start, vertex &end, float &t)
 {
     float planeD = -dotProduct(plane, planeNormal);
     float ad = dotProduct(start, planeNormal);
     float bd = dotProduct(end, planeNormal);
-    float t = (-planeD - ad) / (bd - ad);
+    t = (-planeD - ad) / (bd - ad);
     vertex line = subtractV(end, start);
     vertex intersect = scaleV(line, t);
     return addV(start, intersect);
 }
 
+static coord lerpCoord(const coord &a, const coord &b, float t)
+{
+    return { a.u + (b.u - a.u) * t, a.v + (b.v - a.v) * t };
+}
+
 int clipTriangle(vertex plane, vertex planeNormal, triangle &in, triangle &out1, triangle &out2)
 {
     auto dist = [&](vertex &p)
     {
-        vertex n = normalize(p);
         return (planeNormal.x * p.x + planeNormal.y * p.y + planeNormal.z * p.z - dotProduct(planeNormal, plane));
     };
     
-    vertex* insidePoints[3];
+    // Corners by index so texture coordinates travel with their vertex
+    int insidePoints[3];
     int numInsidePoints = 0;
-    vertex* outsidePoints[3];
+    int outsidePoints[3];
     int numOutsidePoints = 0;
 
-    float d0 = dist(in.v[0]);
-    float d1 = dist(in.v[1]);
-    float d2 = dist(in.v[2]);
-
-    if (d0 >= 0)
-    {
-        insidePoints[numInsidePoints++] = &in.v[0];
-    }
-    else
-    {
-        outsidePoints[numOutsidePoints++] = &in.v[0];
-    }
-    if (d1 >= 0)
+    for (int i = 0; i < 3; i++)
     {
-        insidePoints[numInsidePoints++] = &in.v[1];
-    }
-    else
-    {
-        outsidePoints[numOutsidePoints++] = &in.v[1];
-    }
-    if (d2 >= 0)
-    {
-        insidePoints[numInsidePoints++] = &in.v[2];
+        if (dist(in.v[i]) >= 0)
+        {
+            insidePoints[numInsidePoints++] = i;
+        }
+        else
+        {
+            outsidePoints[numOutsidePoints++] = i;
+        }
     }
-    else
-    {
-        outsidePoints[numOutsidePoints++] = &in.v[2];
-    }    
 
     if (numInsidePoints == 0)
     {
@@ -204,52 +349,180 @@ int clipTriangle(vertex plane, vertex planeNormal, triangle &in, triangle &out1,
         return 1;
     }
 
+    float t;
+    int a = insidePoints[0];
     if (numInsidePoints == 1 && numOutsidePoints == 2)
     {
-        out1.v[0] = *insidePoints[0];
-        out1.v[1] = intersectPlane(plane, planeNormal, *insidePoints[0], *outsidePoints[0]);
-        out1.v[2] = intersectPlane(plane, planeNormal, *insidePoints[0], *outsidePoints[1]);
+        int b = outsidePoints[0];
+        int c = outsidePoints[1];
+        out1.v[0] = in.v[a];
+        out1.t[0] = in.t[a];
+        out1.v[1] = intersectPlane(plane, planeNormal, in.v[a], in.v[b], t);
+        out1.t[1] = lerpCoord(in.t[a], in.t[b], t);
+        out1.v[2] = intersectPlane(plane, planeNormal, in.v[a], in.v[c], t);
+        out1.t[2] = lerpCoord(in.t[a], in.t[c], t);
+        out1.lightIntensity = in.lightIntensity;
 
         return 1;
     }
 
     if (numInsidePoints == 2 && numOutsidePoints == 1)
     {
-        out1.v[0] = *insidePoints[0];
-        out1.v[1] = *insidePoints[1];
-        out1.v[2] = intersectPlane(plane, planeNormal, *insidePoints[0], *outsidePoints[0]);
-
-        out2.v[0] = *insidePoints[1];
+        int b = insidePoints[1];
+        int c = outsidePoints[0];
+        out1.v[0] = in.v[a];
+        out1.t[0] = in.t[a];
+        out1.v[1] = in.v[b];
+        out1.t[1] = in.t[b];
+        out1.v[2] = intersectPlane(plane, planeNormal, in.v[a], in.v[c], t);
+        out1.t[2] = lerpCoord(in.t[a], in.t[c], t);
+        out1.lightIntensity = in.lightIntensity;
+
+        out2.v[0] = in.v[b];
+        out2.t[0] = in.t[b];
         out2.v[1] = out1.v[2];
-        out2.v[2] = intersectPlane(plane, planeNormal, *insidePoints[1], *outsidePoints[0]);
+        out2.t[1] = out1.t[2];
+        out2.v[2] = intersectPlane(plane, planeNormal, in.v[b], in.v[c], t);
+        out2.t[2] = lerpCoord(in.t[b], in.t[c], t);
+        out2.lightIntensity = in.lightIntensity;
         return 2;
     }
 
     return 0;
 }
 
-Renderer::Renderer(SDL_Window *_window, SDL_Renderer *_render, const std::vector<mesh> &_models)
-{   
-    window = _window;
-    SDL_GetWindowSize(_window, &windowWidth, &windowHeight);
+void projectVM(const vertex &v, clipVertex &out, const matrix4 &m)
+{
+    out.x = v.x * m.m[0][0] + v.y * m.m[1][0] + v.z * m.m[2][0] + m.m[3][0];
+    out.y = v.x * m.m[0][1] + v.y * m.m[1][1] + v.z * m.m[2][1] + m.m[3][1];
+    out.z = v.x * m.m[0][2] + v.y * m.m[1][2] + v.z * m.m[2][2] + m.m[3][2];
+    out.w = v.x * m.m[0][3] + v.y * m.m[1][3] + v.z * m.m[2][3] + m.m[3][3];
+}
+
+// Signed distance to each clip plane, inside is >= 0.
+// Depth runs 0..w with the engine's projection matrix
+static float planeDistance(const clipVertex &v, int plane, float band)
+{
+    switch (plane)
+    {
+        case 0: return v.z;
+        case 1: return v.w - v.z;
+        case 2: return v.x + v.w * band;
+        case 3: return v.w * band - v.x;
+        case 4: return v.y + v.w * band;
+        default: return v.w * band - v.y;
+    }
+}
 
-    texture = NULL;
+int clipOutcode(const clipVertex &v, float band)
+{
+    int code = 0;
+    for (int plane = 0; plane < 6; plane++)
+    {
+        if (planeDistance(v, plane, band) < 0.0f)
+            code |= 1 << plane;
+    }
+    return code;
+}
+
+float boxDistance(const vertex &p, const vertex &boundsMin, const vertex &boundsMax)
+{
+    float dx = std::max(std::max(boundsMin.x - p.x, 0.0f), p.x - boundsMax.x);
+    float dy = std::max(std::max(boundsMin.y - p.y, 0.0f), p.y - boundsMax.y);
+    float dz = std::max(std::max(boundsMin.z - p.z, 0.0f), p.z - boundsMax.z);
+    return sqrtf(dx * dx + dy * dy + dz * dz);
+}
+
+bool boxVisible(const vertex &boundsMin, const vertex &boundsMax, const matrix4 &modelToClip)
+{
+    int shared = 0x3F;
+    for (int corner = 0; corner < 8 && shared; corner++)
+    {
+        vertex v = { corner & 1 ? boundsMax.x : boundsMin.x,
+                     corner & 2 ? boundsMax.y : boundsMin.y,
+                     corner & 4 ? boundsMax.z : boundsMin.z };
+        clipVertex projected;
+        projectVM(v, projected, modelToClip);
+        shared &= clipOutcode(projected, 1.0f);
+    }
+    return shared == 0;
+}
+
+int clipPolygon(clipVertex *poly, int count, float band)
+{
+    clipVertex scratch[maxClipVertices];
+    clipVertex *in = poly;
+    clipVertex *out = scratch;
+
+    for (int plane = 0; plane < 6 && count > 0; plane++)
+    {
+        int outCount = 0;
+        for (int i = 0; i < count; i++)
+        {
+            const clipVertex &a = in[i];
+            const clipVertex &b = in[(i + 1) % count];
+            float da = planeDistance(a, plane, band);
+            float db = planeDistance(b, plane, band);
+
+            if (da >= 0.0f)
+                out[outCount++] = a;
+            if ((da >= 0.0f) != (db >= 0.0f))
+            {
+                // Linear in clip space is perspective correct once divided by w
+                float t = da / (da - db);
+                clipVertex &c = out[outCount++];
+                c.x = a.x + (b.x - a.x) * t;
+                c.y = a.y + (b.y - a.y) * t;
+                c.z = a.z + (b.z - a.z) * t;
+                c.w = a.w + (b.w - a.w) * t;
+                c.t = lerpCoord(a.t, b.t, t);
+            }
+        }
+        std::swap(in, out);
+        count = outCount;
+    }
+
+    if (in != poly)
+        std::copy(in, in + count, poly);
+    return count < 3 ? 0 : count;
+}
+
+Renderer::Renderer(SDL_Renderer *_render, int width, int height) : assets(_render)
+{   
+    // The renderer only draws; windows and input belong to the caller,
+    // which lets several renderers run side by side on offscreen targets
+    windowWidth = width;
+    windowHeight = height;
 
     render = _render;
-    models = _models;
 
-    rYaw = 0.0f;
-    rPitch = 0.0f;
+    controlCamera = false;
+    showHud = true;
+    meshStorage = MeshStorage::Float;
+    showMemory = false;
+    useAtlas = false;
+    maxTextureSize = 0;
+    drawBatches = 0;
+    recordTime = 0.0f;
+    submitTime = 0.0f;
+    fps = 0;
+
+    cam.rYaw = 0.0f;
+    cam.rPitch = 0.0f;
 
     FOV = 100.0f;
-    rotation = 0.0f;
+    cam.rotation = 0.0f;
     time = 0.0f;
+    fixedTimestep = 0.0f;
+    capture = NULL;
 
-    //cameraPos = {0, 0, 100.0f}; // Camera Position for original projection method
-    cameraPos = {0.0f, 2.0f, 0.0f};
-    cameraDir = {0, 0, 1};
+    //cam.position = {0, 0, 100.0f}; // Camera Position for original projection method
+    cam.position = {0.0f, 2.0f, 0.0f};
+    cam.direction = {0, 0, 1};
     nearPlane = 0.1f;
     farPlane = 1000.0f;
+    // Triangles reaching up to this many half-screens from the centre are drawn unclipped
+    guardBand = 4.0f;
 
     projectionMatrix.m[0][0] = (float(windowHeight) / float(windowWidth)) * (1.0f / tanf(FOV * 0.5f / 180.0f * 3.14159f));
     projectionMatrix.m[1][1] = 1.0f / tanf(FOV * 0.5f / 180.0f * 3.14159f);
@@ -260,26 +533,49 @@ Renderer::Renderer(SDL_Window *_window, SDL_Renderer *_render, const std::vector
     lowResWidth = 320;
     lowResHeight = 180;
     lowResTexture = SDL_CreateTexture(render, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_TARGET, lowResWidth, lowResHeight);
+    trackAllocation(MemoryTag::FrameBuffers, size_t(lowResWidth) * lowResHeight * 4);
+
+    fontRenderer = std::make_unique<FontRenderer>(render, "Textures/font.bmp");
+    sdlBackend = std::make_unique<SDLBackend>(render, fontRenderer.get());
+    backend = sdlBackend.get();
+
+    lightClusters = std::make_unique<LightClusters>();
+    surfaces = std::make_unique<litSurfaces>();
+    particles = std::make_unique<ParticleSystem>(render);
+    sunDirection = normalize({ 0.0f, 1.0f, -1.0f });
+    sunColor = { 1.0f, 1.0f, 1.0f };
+    ambientColor = { 0.0f, 0.0f, 0.0f };
+    lightTests = 0;
+    frameBudget = 0.0f;
+    tailTime = 0.0f;
+    cacheWorld = true;
+    worldRebuilds = 0;
+    staleInstances = 0;
+}
 
-    fontRenderer = new FontRenderer(render, "Textures/font.bmp");
+// Out of line so the unique_ptr members can delete types only forward declared in the header
+Renderer::~Renderer()
+{
+    SDL_DestroyTexture(lowResTexture);
+    trackFree(MemoryTag::FrameBuffers, size_t(lowResWidth) * lowResHeight * 4);
 }
 
 void Renderer::renderFrame()
 {
-    userInput();
-
     auto startTime = std::chrono::high_resolution_clock::now();
-    rotation += time;
+    cam.rotation += time;
 
     SDL_SetRenderDrawColor(render, 0, 0, 0, SDL_ALPHA_OPAQUE);
     SDL_RenderClear(render);
     SDL_SetRenderDrawColor(render, 255, 255, 255, SDL_ALPHA_OPAQUE);
 
-    std::vector<triangle> visibleTriangles;
+    visibleTriangles.clear();
     bool i = true;
-    for (const auto &model : models) {
+    for (const auto &instance : instances) {
         i = !i;
-    for (auto &tri : model.triangles)
+        if (!instance.model)
+            continue; // Compressed meshes only go through frameRender
+    for (auto &tri : instance.model->triangles)
     {
         vertex rotatedVertex1;
         vertex rotatedVertex2;
@@ -289,9 +585,9 @@ void Renderer::renderFrame()
         rotatedVertex2 = applyRotation(tri.v[1]);
         rotatedVertex3 = applyRotation(tri.v[2]);
         
-        rotatedVertex1 = subtractV(rotatedVertex1, cameraPos);
-        rotatedVertex2 = subtractV(rotatedVertex2, cameraPos);
-        rotatedVertex3 = subtractV(rotatedVertex3, cameraPos);
+        rotatedVertex1 = subtractV(rotatedVertex1, cam.position);
+        rotatedVertex2 = subtractV(rotatedVertex2, cam.position);
+        rotatedVertex3 = subtractV(rotatedVertex3, cam.position);
 
         // Offset into screen
         rotatedVertex1.z = rotatedVertex1.z + 100.0f;
@@ -316,12 +612,12 @@ void Renderer::renderFrame()
             (rotatedVertex1.y + rotatedVertex2.y + rotatedVertex3.y) / 3,
             (rotatedVertex1.z + rotatedVertex2.z + rotatedVertex3.z) / 3
         };
-        vertex cameraRay = normalize(subtractV(centroid, cameraPos));
+        vertex cameraRay = normalize(subtractV(centroid, cam.position));
         float visibility = dotProduct(normal, cameraRay);
 
-        if (normal.x * (rotatedVertex1.x - cameraPos.x) +
-            normal.y * (rotatedVertex1.y - cameraPos.y) +
-            normal.z * (rotatedVertex1.z - cameraPos.z) > 0)
+        if (normal.x * (rotatedVertex1.x - cam.position.x) +
+            normal.y * (rotatedVertex1.y - cam.position.y) +
+            normal.z * (rotatedVertex1.z - cam.position.z) > 0)
         {
             coord edge1 = projection(rotatedVertex1);
             coord edge2 = projection(rotatedVertex2);
@@ -339,30 +635,28 @@ void Renderer::renderFrame()
             };
             projectedTriangle.lightIntensity = visibility;
 
-            projectedTriangle.t[0] = tri.t[0];
-            projectedTriangle.t[1] = tri.t[1];
-            projectedTriangle.t[2] = tri.t[2];
+            for (int i = 0; i < 3; i++)
+            {
+                projectedTriangle.t[i].u = instance.uvOffset.u + tri.t[i].u * instance.uvScale.u;
+                projectedTriangle.t[i].v = instance.uvOffset.v + tri.t[i].v * instance.uvScale.v;
+            }
 
-            visibleTriangles.push_back(projectedTriangle);
+            visibleTriangles.push_back({projectedTriangle, instance.texture.get()});
         }
     }
     }
     
-    sort(visibleTriangles.begin(), visibleTriangles.end(), [](triangle &t1, triangle &t2)
-    {
-        float z1 = (t1.v[0].z + t1.v[1].z + t1.v[2].z) / 3.0f;
-		float z2 = (t2.v[0].z + t2.v[1].z + t2.v[2].z) / 3.0f;
-		return z1 > z2;
-    });
+    sortByDepth(visibleTriangles);
     
-    for (auto &tri : visibleTriangles)
+    for (auto &visible : visibleTriangles)
     {
+        triangle &tri = visible.tri;
         SDL_Color brightness = {
             static_cast<Uint8>(255 * tri.lightIntensity),
             static_cast<Uint8>(255 * tri.lightIntensity),
             static_cast<Uint8>(255 * tri.lightIntensity),
             0xFF};
-        fillTriangle(render, {tri.v[0].x, tri.v[0].y}, {tri.v[1].x, tri.v[1].y}, {tri.v[2].x, tri.v[2].y}, tri.t[0], tri.t[1], tri.t[2], brightness);
+        fillTriangle(render, visible.texture, {tri.v[0].x, tri.v[0].y}, {tri.v[1].x, tri.v[1].y}, {tri.v[2].x, tri.v[2].y}, tri.t[0], tri.t[1], tri.t[2], brightness);
         //SDL_RenderDrawLine(render, tri.v[0].x, tri.v[0].y, tri.v[1].x, tri.v[1].y);
         //SDL_RenderDrawLine(render, tri.v[1].x, tri.v[1].y, tri.v[2].x, tri.v[2].y);
         //SDL_RenderDrawLine(render, tri.v[2].x, tri.v[2].y, tri.v[0].x, tri.v[0].y);
@@ -377,109 +671,110 @@ void Renderer::renderFrame()
 
 bool Renderer::loadObjFile(const std::string& filename, int index)
 {
-    std::ifstream file(filename);
-    if (!file.is_open())
+    meshInstance loaded;
+    if (!assets.loadInstanceMesh(filename, false, meshStorage, loaded))
     {
-        std::cout << "Failed to open file: " << filename << std::endl;
         return false;
     }
 
-    std::vector<vertex> vertices;
-
-    mesh obj;
+    placeInstance(loaded, index);
+    return true;
+}
 
-    while (!file.eof())
-    {
-        char line[128];
-        file.getline(line, 128);
+bool Renderer::loadObjTextureFile(const std::string &filename, const std::string &texturename, int index)
+{
+    std::shared_ptr<SDL_Texture> texture = assets.loadTexture(texturename);
+    if (!texture) {
+        return false;
+    }
 
-        std::stringstream s;
-        s << line;
+    meshInstance loaded;
+    if (!assets.loadInstanceMesh(filename, true, meshStorage, loaded)) {
+        return false;
+    }
+    loaded.texture = texture;
 
-        char junk;
+    placeInstance(loaded, index);
+    return true;
+}
 
-        if (line[0] == 'v')
-        {
-            vertex v;
-            s >> junk >> v.x >> v.y >> v.z;
-            vertices.push_back(v);
-        }
+void Renderer::placeInstance(meshInstance &loaded, int index)
+{
+    // Replacing an existing slot keeps its transform, everything else comes
+    // from the new mesh so nothing of the old one is left behind
+    if (size_t(index) < instances.size()) {
+        loaded.position = instances[index].position;
+        loaded.yaw = instances[index].yaw;
+        loaded.pitch = instances[index].pitch;
+        loaded.scale = instances[index].scale;
+        instances[index] = loaded;
+    } else {
+        instances.push_back(loaded);
+    }
+    // Budget mode results point at the old mesh's texture, and the world
+    // space copy would keep the old mesh alive until the next frame
+    caches.clear();
+    worldCache.clear();
+    // Views around the scene are placed again from its new bounds
+    for (viewStorage &target : views)
+        target.placed = false;
+}
 
-        if (line[0] == 'f')
-        {
-            int f[3];
-            s >> junk >> f[0] >> f[1] >> f[2];
-            obj.triangles.push_back({vertices[f[0] - 1], vertices[f[1] - 1], vertices[f[2] - 1]});
-        }
+bool Renderer::loadScene(const std::string &filename)
+{
+    // Cached copies hold on to the old scene's meshes, let them go before
+    // the new ones load and are counted
+    worldCache.clear();
+    std::vector<particleEmitter> emitters;
+    if (!loadSceneFile(filename, assets, instances, lights, emitters, meshStorage))
+    {
+        return false;
     }
+    particles->clearEmitters();
+    for (const auto &emitter : emitters)
+        particles->addEmitter(emitter);
 
-    //model = obj;
-    if (index < models.size()) {
-        models[index] = obj;
-    } else {
-        models.push_back(obj);
+    std::cout << "Loaded " << filename << ": " << instances.size() << " instances sharing "
+              << assets.liveMeshCount() << " meshes and " << assets.liveTextureCount() << " textures, "
+              << lights.size() << " lights, " << emitters.size() << " particle emitters" << std::endl;
+
+    if (useAtlas)
+    {
+        atlasSettings settings;
+        settings.maxTextureSize = maxTextureSize;
+        buildTextureAtlas(render, assets, instances, settings);
     }
+    caches.clear();
+    for (viewStorage &target : views)
+        target.placed = false;
     return true;
 }
 
-bool Renderer::loadObjTextureFile(const std::string &filename, const std::string &texturename, int index)
+bool Renderer::loadStressScene(const stressSettings &settings)
 {
-    std::ifstream file(filename);
-    if (!file.is_open()) {
-        std::cout << "Failed to open file: " << filename << std::endl;
+    worldCache.clear();
+    std::vector<meshInstance> generated;
+    if (!generateStressScene(settings, render, cam.position, projectionMatrix.m[0][0], projectionMatrix.m[1][1], generated))
+    {
         return false;
     }
 
-    SDL_Surface* surface = SDL_LoadBMP(texturename.c_str());
-    if (!surface) {
-        std::cout << "Failed to open texture: " << texturename << std::endl;
-        return false;
-    }
-    texture = SDL_CreateTextureFromSurface(render, surface);
-    SDL_FreeSurface(surface);
-
-    std::vector<vertex> vertices;
-    std::vector<coord> tex;
-    mesh m;
-
-    std::string line;
-    while (std::getline(file, line)) {
-        std::istringstream ss(line);
-        std::string prefix;
-        ss >> prefix;
-
-        if (prefix == "v") {
-            vertex v;
-            ss >> v.x >> v.y >> v.z;
-            vertices.push_back(v);
-        } else if (prefix == "vt") {
-            coord t;
-            ss >> t.u >> t.v;
-            tex.push_back(t);
-        } else if (prefix == "f") {
-            triangle tri;
-            for (int i = 0; i < 3; ++i) {
-                std::string vertexData;
-                ss >> vertexData;
-
-                size_t firstSlash = vertexData.find('/');
-                size_t secondSlash = vertexData.find('/', firstSlash + 1);
-
-                int vIndex = std::stoi(vertexData.substr(0, firstSlash)) - 1;
-                int tIndex = std::stoi(vertexData.substr(firstSlash + 1, secondSlash - firstSlash - 1)) - 1;
-
-                tri.v[i] = vertices[vIndex];
-                tri.t[i] = tex[tIndex];
-            }
-            m.triangles.push_back(tri);
-        }
-    }
-    //model = m;
-    if (index < models.size()) {
-        models[index] = m;
-    } else {
-        models.push_back(m);
-    }
+    // Generated meshes have no file to build BVHs or other storage from, so
+    // they stay float meshes and ray queries pass over them
+    instances.swap(generated);
+    lights.clear();
+    particles->clearEmitters();
+    skinning.clear();
+    caches.clear();
+    for (viewStorage &target : views)
+        target.placed = false;
+
+    long long triangles = 0;
+    for (const auto &instance : instances)
+        triangles += instance.model->triangles.size();
+    std::cout << "Generated stress scene: " << instances.size() << " instances, " << triangles << " triangles, depth "
+              << settings.depthComplexity << ", " << settings.textures << " textures, " << settings.offscreen * 100.0f
+              << "% off screen" << std::endl;
     return true;
 }
 
@@ -498,14 +793,14 @@ vertex Renderer::rotateX(vertex v)
     {
         vertex rotatedVertex;
         rotatedVertex.x = v.x;
-        rotatedVertex.y = cos(rotation) * v.y - sin(rotation) * v.z;
-        rotatedVertex.z = sin(rotation) * v.y + cos(rotation) * v.z;
+        rotatedVertex.y = cos(cam.rotation) * v.y - sin(cam.rotation) * v.z;
+        rotatedVertex.z = sin(cam.rotation) * v.y + cos(cam.rotation) * v.z;
         return rotatedVertex;
     } else {
         vertex rotatedVertex;
         rotatedVertex.x = v.x;
-        rotatedVertex.y = cos(rPitch) * v.y - sin(rPitch) * v.z;
-        rotatedVertex.z = sin(rPitch) * v.y + cos(rPitch) * v.z;
+        rotatedVertex.y = cos(cam.rPitch) * v.y - sin(cam.rPitch) * v.z;
+        rotatedVertex.z = sin(cam.rPitch) * v.y + cos(cam.rPitch) * v.z;
         return rotatedVertex;
     }
 }
@@ -515,15 +810,15 @@ vertex Renderer::rotateY(vertex v)
     if (!controlCamera)
     {
         vertex rotatedVertex;
-        rotatedVertex.x = cos(rotation) * v.x - sin(rotation) * v.z;
+        rotatedVertex.x = cos(cam.rotation) * v.x - sin(cam.rotation) * v.z;
         rotatedVertex.y = v.y;
-        rotatedVertex.z = sin(rotation) * v.x + cos(rotation) * v.z;
+        rotatedVertex.z = sin(cam.rotation) * v.x + cos(cam.rotation) * v.z;
         return rotatedVertex;
     } else {
         vertex rotatedVertex;
-        rotatedVertex.x = cos(rYaw) * v.x - sin(rYaw) * v.z;
+        rotatedVertex.x = cos(cam.rYaw) * v.x - sin(cam.rYaw) * v.z;
         rotatedVertex.y = v.y;
-        rotatedVertex.z = sin(rYaw) * v.x + cos(rYaw) * v.z;
+        rotatedVertex.z = sin(cam.rYaw) * v.x + cos(cam.rYaw) * v.z;
         return rotatedVertex;
     }
 }
@@ -539,7 +834,90 @@ vertex Renderer::applyRotation(vertex v)
     return v;
 }
 
-void Renderer::fillTriangle(SDL_Renderer *renderer, coord v1, coord v2, coord v3, coord t1, coord t2, coord t3, SDL_Color color)
+matrix4 Renderer::modelMatrix(const meshInstance &instance)
+{
+    // Same order as before instancing: the instance's own scale and rotation,
+    // then the shared model rotation (applyRotation), then the placement offset
+    float yawAngle = controlCamera ? cam.rYaw : cam.rotation;
+    float pitchAngle = controlCamera ? cam.rPitch : cam.rotation;
+
+    matrix4 local = multiplyM(matrixScale(instance.scale), multiplyM(matrixRotateY(instance.yaw), matrixRotateX(instance.pitch)));
+    matrix4 shared = multiplyM(matrixRotateY(yawAngle), matrixRotateX(pitchAngle));
+    return multiplyM(multiplyM(local, shared), matrixTranslate(instance.position));
+}
+
+matrix4 Renderer::cameraMatrix()
+{
+    // Also points cam.direction where yaw and pitch say
+    vertex up = {0, 1, 0};
+    vertex target = {0, 0, 1};
+    matrix4 cameraRotationMatrix = multiplyM(matrixRotateY(cam.yaw), matrixRotateX(cam.pitch));
+    multiplyVM(target, cam.direction, cameraRotationMatrix);
+    target = addV(cam.position, cam.direction);
+    return pointAtMatrix(cam.position, target, up);
+}
+
+void Renderer::transformInstance(const meshInstance &instance, const matrix4 &world, frameVector<vertex> &vertices, frameVector<triangle> &out, bool culled)
+{
+    if (instance.packed)
+        transformQuantized(*instance.packed, world, out);
+    else if (instance.indexed)
+        transformIndexed(*instance.indexed, world, vertices, out);
+    else if (instance.bsp)
+        transformTriangles(instance.bsp->geometry, world, out);
+    else if (instance.streamed)
+        instance.streamed->gather(world, out, culled);
+    else if (instance.terrain)
+        instance.terrain->gather(world, out, culled);
+    else
+        transformTriangles(*instance.model, world, out);
+}
+
+void Renderer::animateInstances()
+{
+    std::vector<int> animated;
+    for (int i = 0; i < int(instances.size()); i++)
+    {
+        if (instances[i].skinned)
+            animated.push_back(i);
+    }
+    if (animated.empty())
+        return;
+
+    if (skinning.size() < instances.size())
+        skinning.resize(instances.size());
+    for (int i : animated)
+    {
+        if (!skinning[i])
+            skinning[i] = std::make_unique<skinningState>();
+    }
+    // Only started once there is something to animate, batch renders never pay for it
+    if (!workers)
+        workers = std::make_unique<WorkerPool>();
+
+    // Pose and skin one instance per task, straight into world space
+    workers->parallelFor(int(animated.size()), [&](int n)
+    {
+        meshInstance &instance = instances[animated[n]];
+        skinningState &state = *skinning[animated[n]];
+        const skinnedMesh &skinned = *instance.skinned;
+        matrix4 world = modelMatrix(instance);
+
+        if (skinned.clips.empty())
+        {
+            state.boneMatrices.assign(skinned.bones.size(), world);
+        }
+        else
+        {
+            const animationClip &clip = skinned.clips[std::min(std::max(instance.clip, 0), int(skinned.clips.size()) - 1)];
+            poseSkeleton(skinned, clip, instance.clipTime, world, state.boneMatrices);
+        }
+        skinMesh(skinned, state);
+        instance.clipTime += time;
+    });
+}
+
+void Renderer::fillTriangle(SDL_Renderer *renderer, SDL_Texture *texture, coord v1, coord v2, coord v3, coord t1, coord t2, coord t3, SDL_Color color)
 {
     SDL_Color tri_color={155,155,155,255};
     SDL_Vertex vertices[3] = {
@@ -567,218 +945,965 @@ void Renderer::fillTriangle(SDL_Renderer *renderer, coord v1, coord v2, coord v3
     }
 }
 
-void Renderer::userInput()
+void Renderer::setControlCamera(bool _controlCamera)
 {
-    const Uint8 *state = SDL_GetKeyboardState(NULL);
+    controlCamera = _controlCamera;
+}
 
-    float cameraSpeed = 0.001f;
-    float cameraSensitivity = 0.01f;
+void Renderer::setFps(int _fps)
+{
+    fps = _fps;
+}
 
-    int mouseX;
-    int mouseY;
-    SDL_GetMouseState(&mouseX, &mouseY);
+void Renderer::setShowHud(bool _showHud)
+{
+    showHud = _showHud;
+}
 
-    int centerX = windowWidth / 2;
-    int centerY = windowHeight / 2;
-    float dX = (mouseX - centerX) * cameraSensitivity;
-    float dY = (mouseY - centerY) * cameraSensitivity;
+void Renderer::setShowMemory(bool _showMemory)
+{
+    showMemory = _showMemory;
+}
 
-    rYaw += dX;
-    rPitch -= dY;
+void Renderer::setTextureAtlas(bool _useAtlas, int _maxTextureSize)
+{
+    useAtlas = _useAtlas;
+    maxTextureSize = _maxTextureSize;
+}
 
-    //yaw += dX;
-    //pitch += dY;
+int Renderer::getDrawBatches()
+{
+    return drawBatches;
+}
 
-    if (rPitch > 89.0f) rPitch = 89.0f;
-    if (rPitch < -89.0f) rPitch = -89.0f;
+float Renderer::getRecordTime()
+{
+    return recordTime;
+}
 
-    vertex forward = scaleV(cameraDir, time * 8.0f);
-    vertex right = crossProduct({0.0f, 8.0f, 0.0f}, cameraDir);
+float Renderer::getSubmitTime()
+{
+    return submitTime;
+}
 
-    if (state[SDL_SCANCODE_W])
-        cameraPos = addV(cameraPos, forward);
-    if (state[SDL_SCANCODE_S])
-        cameraPos = subtractV(cameraPos, forward);
-    if (state[SDL_SCANCODE_A])
-        cameraPos = subtractV(cameraPos, scaleV(right, time)); //cameraPos.x -= cameraSpeed;
-    if (state[SDL_SCANCODE_D])
-        cameraPos = addV(cameraPos, scaleV(right, time)); //cameraPos.x += cameraSpeed;
-    if (state[SDL_SCANCODE_Q])
-        cameraPos.y -= cameraSpeed * 8.0f;
-    if (state[SDL_SCANCODE_E])
-        cameraPos.y += cameraSpeed * 8.0f;
-    if (state[SDL_SCANCODE_LEFT])
-        yaw += 0.01f;
-    if (state[SDL_SCANCODE_RIGHT])
-        yaw -= 0.01f;
-    if (state[SDL_SCANCODE_UP])
-        pitch += 0.01f;
-    if (state[SDL_SCANCODE_DOWN])
-        pitch -= 0.01f;
-    if (state[SDL_SCANCODE_ESCAPE])
-        exit(0);
+void Renderer::addEmitter(const particleEmitter &emitter)
+{
+    particles->addEmitter(emitter);
+}
 
-    if (controlCamera)
-        SDL_WarpMouseInWindow(SDL_GetWindowFromID(SDL_GetWindowID(window)), centerX, centerY);
+void Renderer::clearEmitters()
+{
+    particles->clearEmitters();
 }
 
-void Renderer::setControlCamera(bool _controlCamera)
+size_t Renderer::getParticleCount()
 {
-    controlCamera = _controlCamera;
+    return particles->liveCount();
 }
 
-void Renderer::setFps(int _fps)
+void Renderer::getTerrainChunks(int &drawn, int &built, long long &triangles)
 {
-    fps = _fps;
+    drawn = built = 0;
+    triangles = 0;
+    for (const auto &instance : instances)
+    {
+        if (!instance.terrain)
+            continue;
+        int chunks = instance.terrain->drawnChunks();
+        drawn += chunks;
+        built += instance.terrain->residentChunks();
+        triangles += (long long)chunks * instance.terrain->chunkTriangles();
+    }
 }
 
-void Renderer::frameRender()
+const frameStages &Renderer::getStageTimes()
 {
-    userInput();
+    return stageTimes;
+}
 
-    auto startTime = std::chrono::high_resolution_clock::now();
-    //rotation += time; // Comment this line out to turn off rotating
+cameraState &Renderer::getCamera()
+{
+    return cam;
+}
 
-    //SDL_SetRenderTarget(render, lowResTexture); // Comment this line out to turn off lowRes
-    SDL_SetRenderDrawColor(render, 0, 0, 0, SDL_ALPHA_OPAQUE);
-    SDL_RenderClear(render);
-    SDL_SetRenderDrawColor(render, 255, 255, 255, SDL_ALPHA_OPAQUE);
+AssetCache &Renderer::getAssets()
+{
+    return assets;
+}
 
-    // Camera Calculations
-    vertex up = {0, 1, 0};
-    vertex target = {0, 0, 1};
-    matrix4 cameraRotationMatrix = multiplyM(matrixRotateY(yaw), matrixRotateX(pitch));
-    multiplyVM(target, cameraDir, cameraRotationMatrix);
-    target = addV(cameraPos, cameraDir);
-    matrix4 cameraMatrix = pointAtMatrix(cameraPos, target, up);
-    matrix4 viewMatrix = inverseMatrix4(cameraMatrix);
+float Renderer::getFrameTime()
+{
+    return time;
+}
 
-    std::vector<triangle> visibleTriangles;
+void Renderer::localBounds(const meshInstance &instance, vertex &boundsMin, vertex &boundsMax)
+{
+    if (instance.packed)
+    {
+        boundsMin = instance.packed->origin;
+        boundsMax = addV(instance.packed->origin, scaleV(instance.packed->step, 65535.0f));
+    }
+    else if (instance.indexed)
+    {
+        boundsMin = boundsMax = instance.indexed->positions.empty() ? vertex{ 0.0f, 0.0f, 0.0f } : instance.indexed->positions[0];
+        for (const auto &p : instance.indexed->positions)
+        {
+            boundsMin = { std::min(boundsMin.x, p.x), std::min(boundsMin.y, p.y), std::min(boundsMin.z, p.z) };
+            boundsMax = { std::max(boundsMax.x, p.x), std::max(boundsMax.y, p.y), std::max(boundsMax.z, p.z) };
+        }
+    }
+    else if (instance.bsp)
+    {
+        meshBounds(instance.bsp->geometry, boundsMin, boundsMax);
+    }
+    else if (instance.streamed)
+    {
+        instance.streamed->bounds(boundsMin, boundsMax);
+    }
+    else if (instance.terrain)
+    {
+        instance.terrain->bounds(boundsMin, boundsMax);
+    }
+    else if (instance.skinned)
+    {
+        skinnedBounds(*instance.skinned, boundsMin, boundsMax);
+    }
+    else
+    {
+        meshBounds(*instance.model, boundsMin, boundsMax);
+    }
+}
 
-    bool i = true;
+void Renderer::worldBounds(const meshInstance &instance, vertex &boundsMin, vertex &boundsMax)
+{
+    vertex localMin, localMax;
+    localBounds(instance, localMin, localMax);
+    matrix4 worldMatrix = modelMatrix(instance);
+    for (int corner = 0; corner < 8; corner++)
+    {
+        vertex point = {
+            corner & 1 ? localMax.x : localMin.x,
+            corner & 2 ? localMax.y : localMin.y,
+            corner & 4 ? localMax.z : localMin.z
+        };
+        vertex world;
+        multiplyVM(point, world, worldMatrix);
+        if (corner == 0)
+        {
+            boundsMin = world;
+            boundsMax = world;
+        }
+        boundsMin = { std::min(boundsMin.x, world.x), std::min(boundsMin.y, world.y), std::min(boundsMin.z, world.z) };
+        boundsMax = { std::max(boundsMax.x, world.x), std::max(boundsMax.y, world.y), std::max(boundsMax.z, world.z) };
+    }
+}
 
-    for (const auto &model : models) {
-        i = !i;
-    for (auto &tri : model.triangles)
+void Renderer::sceneBounds(vertex &boundsMin, vertex &boundsMax)
+{
+    // World space box around every instance as currently placed
+    boundsMin = { 0.0f, 0.0f, 0.0f };
+    boundsMax = { 0.0f, 0.0f, 0.0f };
+    for (size_t index = 0; index < instances.size(); index++)
     {
-        vertex rotatedVertex1;
-        vertex rotatedVertex2;
-        vertex rotatedVertex3;
+        vertex instanceMin, instanceMax;
+        worldBounds(instances[index], instanceMin, instanceMax);
+        if (index == 0)
+        {
+            boundsMin = instanceMin;
+            boundsMax = instanceMax;
+        }
+        boundsMin = { std::min(boundsMin.x, instanceMin.x), std::min(boundsMin.y, instanceMin.y), std::min(boundsMin.z, instanceMin.z) };
+        boundsMax = { std::max(boundsMax.x, instanceMax.x), std::max(boundsMax.y, instanceMax.y), std::max(boundsMax.z, instanceMax.z) };
+    }
+}
 
-        // Rotation
-        rotatedVertex1 = applyRotation(tri.v[0]);
-        rotatedVertex2 = applyRotation(tri.v[1]);
-        rotatedVertex3 = applyRotation(tri.v[2]);
+bool Renderer::separateBspInstances()
+{
+    if (instances.empty())
+        return false;
+    for (const auto &instance : instances)
+    {
+        if (!instance.bsp)
+            return false;
+    }
 
-        // Offset into z axis
-        rotatedVertex1.z = rotatedVertex1.z + 20.0f;
-        rotatedVertex2.z = rotatedVertex2.z + 20.0f;
-        rotatedVertex3.z = rotatedVertex3.z + 20.0f;
+    // Boxes that touch could interleave, and then no order of whole instances is right
+    std::vector<std::pair<vertex, vertex>> boxes(instances.size());
+    for (size_t index = 0; index < instances.size(); index++)
+        worldBounds(instances[index], boxes[index].first, boxes[index].second);
+    for (size_t a = 0; a < boxes.size(); a++)
+    {
+        for (size_t b = a + 1; b < boxes.size(); b++)
+        {
+            if (boxes[a].first.x <= boxes[b].second.x && boxes[b].first.x <= boxes[a].second.x &&
+                boxes[a].first.y <= boxes[b].second.y && boxes[b].first.y <= boxes[a].second.y &&
+                boxes[a].first.z <= boxes[b].second.z && boxes[b].first.z <= boxes[a].second.z)
+                return false;
+        }
+    }
+    return true;
+}
 
-        // Offset from other mesh
-        if (i) {
-            rotatedVertex1.z = rotatedVertex1.z + 2.0f;
-            rotatedVertex2.z = rotatedVertex2.z + 2.0f;
-            rotatedVertex3.z = rotatedVertex3.z + 2.0f;
-            rotatedVertex1.y = rotatedVertex1.y - 9.0f;
-            rotatedVertex2.y = rotatedVertex2.y - 9.0f;
-            rotatedVertex3.y = rotatedVertex3.y - 9.0f;
+void Renderer::prepareRays()
+{
+    rayToModel.resize(instances.size());
+    for (size_t i = 0; i < instances.size(); i++)
+    {
+        if (instances[i].bvh)
+            rayToModel[i] = inverseAffine(modelMatrix(instances[i]));
+    }
+}
+
+bool Renderer::traceRay(const vertex &origin, const vertex &direction, float maxDistance, rayHit &hit)
+{
+    hit = rayHit();
+    hit.distance = maxDistance;
+    int found = -1;
+    for (int i = 0; i < int(instances.size()); i++)
+    {
+        if (!instances[i].bvh)
+            continue;
+        // Into model space without renormalizing, so distances along the ray stay the same
+        vertex localOrigin, localEnd;
+        multiplyVM(origin, localOrigin, rayToModel[i]);
+        multiplyVM(addV(origin, direction), localEnd, rayToModel[i]);
+        if (intersectMeshBvh(*instances[i].bvh, localOrigin, subtractV(localEnd, localOrigin), hit))
+            found = i;
+    }
+    hit.instance = found;
+    if (found < 0)
+        return false;
+    hit.position = addV(origin, scaleV(direction, hit.distance));
+    return true;
+}
+
+bool Renderer::raycast(const vertex &origin, const vertex &direction, float maxDistance, rayHit &hit)
+{
+    prepareRays();
+    return traceRay(origin, direction, maxDistance, hit);
+}
+
+bool Renderer::segmentCast(const vertex &from, const vertex &to, rayHit &hit)
+{
+    // Distance comes out as the fraction of the way from from to to
+    return raycast(from, subtractV(to, from), 1.0f, hit);
+}
+
+void Renderer::raycastBatch(const std::vector<rayQuery> &rays, std::vector<rayHit> &hits)
+{
+    prepareRays();
+    hits.resize(rays.size());
+    if (!workers)
+        workers = std::make_unique<WorkerPool>();
+
+    // Blocks of rays per task, one ray is far too little work to hand out alone
+    const int blockSize = 64;
+    int blocks = int((rays.size() + blockSize - 1) / blockSize);
+    workers->parallelFor(blocks, [&](int block)
+    {
+        size_t end = std::min(rays.size(), size_t(block + 1) * blockSize);
+        for (size_t n = size_t(block) * blockSize; n < end; n++)
+            traceRay(rays[n].origin, rays[n].direction, rays[n].maxDistance, hits[n]);
+    });
+}
+
+bool Renderer::pick(int x, int y, rayHit &hit)
+{
+    // Back through the projection to a view space direction at depth 1
+    float ndcX = 2.0f * (x + 0.5f) / windowWidth - 1.0f;
+    float ndcY = 1.0f - 2.0f * (y + 0.5f) / windowHeight;
+    vertex viewDirection = { ndcX / projectionMatrix.m[0][0], ndcY / projectionMatrix.m[1][1], 1.0f };
+    vertex through;
+    multiplyVM(viewDirection, through, cameraMatrix());
+    return raycast(cam.position, subtractV(through, cam.position), farPlane, hit);
+}
+
+void Renderer::setMeshStorage(MeshStorage _meshStorage)
+{
+    // Only affects meshes loaded afterwards
+    meshStorage = _meshStorage;
+}
+
+void Renderer::setStreamingBudget(size_t bytes)
+{
+    assets.setStreamingBudget(bytes);
+}
+
+void Renderer::setFrameCapture(FrameCapture *_capture)
+{
+    capture = _capture;
+}
+
+void Renderer::setBackend(RenderBackend *_backend)
+{
+    backend = _backend ? _backend : sdlBackend.get();
+}
+
+void Renderer::addLight(const sceneLight &light)
+{
+    lights.push_back(light);
+}
+
+void Renderer::clearLights()
+{
+    lights.clear();
+}
+
+int Renderer::getLightCount()
+{
+    return int(lights.size());
+}
+
+long long Renderer::getLightTests()
+{
+    return lightTests;
+}
+
+void Renderer::setFrameBudget(float milliseconds)
+{
+    frameBudget = milliseconds / 1000.0f;
+    caches.clear();
+}
+
+int Renderer::getStaleInstances()
+{
+    return staleInstances;
+}
+
+void Renderer::setViews(const std::vector<renderView> &_views)
+{
+    views.clear();
+    views.resize(_views.size());
+    for (size_t i = 0; i < views.size(); i++)
+    {
+        views[i].view = _views[i];
+        views[i].surfaces = std::make_unique<litSurfaces>();
+        views[i].clusters = std::make_unique<LightClusters>();
+    }
+}
+
+void Renderer::setWorldCache(bool _cacheWorld)
+{
+    cacheWorld = _cacheWorld;
+}
+
+int Renderer::getWorldRebuilds()
+{
+    return worldRebuilds;
+}
+
+void Renderer::placeViews()
+{
+    bool placed = true;
+    for (const viewStorage &target : views)
+        placed = placed && target.placed;
+    if (placed)
+        return;
+
+    vertex boundsMin, boundsMax;
+    sceneBounds(boundsMin, boundsMax);
+    vertex center = scaleV(addV(boundsMin, boundsMax), 0.5f);
+    vertex extent = subtractV(boundsMax, boundsMin);
+    float radius = std::max(0.5f * sqrtf(dotProduct(extent, extent)), 1.0f);
+
+    for (viewStorage &target : views)
+    {
+        // Same field of view as the main camera, shaped to the rectangle
+        const SDL_Rect &rect = target.view.rect;
+        float focal = 1.0f / tanf(FOV * 0.5f / 180.0f * 3.14159f);
+        float scaleX = (float(rect.h) / float(rect.w)) * focal;
+        // Far enough back for the scene's bounding sphere to fit the narrower side
+        float distance = radius * sqrtf(1.0f + std::max(scaleX, focal) * std::max(scaleX, focal));
+        target.farPlane = target.view.kind == ViewKind::Main ? farPlane : std::max(farPlane, distance + radius);
+        target.projectionMatrix = matrix4();
+        target.projectionMatrix.m[0][0] = scaleX;
+        target.projectionMatrix.m[1][1] = focal;
+        target.projectionMatrix.m[2][2] = target.farPlane / (target.farPlane - nearPlane);
+        target.projectionMatrix.m[3][2] = (-target.farPlane * nearPlane) / (target.farPlane - nearPlane);
+        target.projectionMatrix.m[2][3] = 1.0f;
+
+        vertex up = { 0.0f, 1.0f, 0.0f };
+        if (target.view.kind == ViewKind::Top)
+        {
+            target.eye = addV(center, { 0.0f, distance, 0.0f });
+            up = { 0.0f, 0.0f, 1.0f };
         }
+        else if (target.view.kind == ViewKind::Side)
+            target.eye = addV(center, { distance, 0.0f, 0.0f });
+        else
+            target.eye = addV(center, { 0.0f, 0.0f, -distance });
+        matrix4 cameraToWorld = pointAtMatrix(target.eye, center, up);
+        target.viewMatrix = inverseMatrix4(cameraToWorld);
+        target.placed = true;
+    }
+}
 
-        // Calculate normal by cross product
-        vertex e1 = subtractV(rotatedVertex2, rotatedVertex1);
-        vertex e2 = subtractV(rotatedVertex3, rotatedVertex1);
-        vertex normal = crossProduct(e1, e2);
-        normal = normalize(normal);
+void Renderer::setFixedTimestep(float _timestep)
+{
+    // 0 goes back to timing each frame by the clock
+    fixedTimestep = _timestep;
+}
+
+int Renderer::instanceClipping(const worldGeometry &geometry, const viewPass &pass)
+{
+    if (geometry.triangles->empty())
+        return ClipOutside;
+    const vertex &boundsMin = geometry.boundsMin;
+    const vertex &boundsMax = geometry.boundsMax;
+
+    // Triangles lie inside the box, and the clip planes are convex, so the
+    // corners decide. All on screen means no triangle can be rejected or clipped
+    int insideCodes = 0;
+    int frustumCodes = ~0;
+    for (int corner = 0; corner < 8; corner++)
+    {
+        vertex p = { corner & 1 ? boundsMax.x : boundsMin.x, corner & 2 ? boundsMax.y : boundsMin.y, corner & 4 ? boundsMax.z : boundsMin.z };
+        vertex viewed;
+        clipVertex clipped;
+        multiplyVM(p, viewed, pass.viewMatrix);
+        projectVM(viewed, clipped, pass.projectionMatrix);
+        int codes = clipOutcode(clipped, 1.0f);
+        insideCodes |= codes;
+        frustumCodes &= codes;
+    }
+    if (frustumCodes)
+        return ClipOutside;
+    return insideCodes ? ClipNeeded : ClipInside;
+}
 
-        if (normal.x * (rotatedVertex1.x - cameraPos.x) +
-            normal.y * (rotatedVertex1.y - cameraPos.y) +
-            normal.z * (rotatedVertex1.z - cameraPos.z) < 0)
+template <bool Ordered, bool Textured, bool Clipped, bool Lit>
+void Renderer::projectTriangles(const meshInstance &instance, const worldGeometry &geometry, size_t triangleCount, const viewPass &pass)
+{
+    SDL_Texture *texture = Textured ? instance.texture.get() : NULL;
+    const frameVector<triangle> &source = *geometry.triangles;
+    const matrix4 &viewMatrix = pass.viewMatrix;
+    const matrix4 &projectionMatrix = pass.projectionMatrix;
+    for (size_t n = 0; n < triangleCount; n++)
+    {
+        size_t index = Ordered ? bspOrder[n] : n;
+        const triangle &tri = source[index];
+        vertex rotatedVertex1 = tri.v[0];
+        vertex rotatedVertex2 = tri.v[1];
+        vertex rotatedVertex3 = tri.v[2];
+        const vertex &normal = geometry.normals[index];
+
+        // Written so degenerate faces, whose normal is NaN, are culled too
+        float facing = normal.x * (rotatedVertex1.x - pass.eye.x) +
+                       normal.y * (rotatedVertex1.y - pass.eye.y) +
+                       normal.z * (rotatedVertex1.z - pass.eye.z);
+        if (!(facing < 0))
+            continue;
+
+        vertex viewedVertex1;
+        vertex viewedVertex2;
+        vertex viewedVertex3;
+
+        // View object through camera position and direction
+        multiplyVM(rotatedVertex1, viewedVertex1, viewMatrix);
+        multiplyVM(rotatedVertex2, viewedVertex2, viewMatrix);
+        multiplyVM(rotatedVertex3, viewedVertex3, viewMatrix);
+
+        // Project 3D -> 4D clip space, the divide by w comes after clipping
+        clipVertex poly[maxClipVertices];
+        projectVM(viewedVertex1, poly[0], projectionMatrix);
+        projectVM(viewedVertex2, poly[1], projectionMatrix);
+        projectVM(viewedVertex3, poly[2], projectionMatrix);
+        // Into atlas space when the texture was packed, otherwise unchanged
+        for (int i = 0; i < 3; i++)
         {
-            vertex viewedVertex1;
-            vertex viewedVertex2;
-            vertex viewedVertex3;
+            poly[i].t.u = Textured ? instance.uvOffset.u + tri.t[i].u * instance.uvScale.u : 0.0f;
+            poly[i].t.v = Textured ? instance.uvOffset.v + tri.t[i].v * instance.uvScale.v : 0.0f;
+        }
 
-            // View object through camera position and direction
-            multiplyVM(rotatedVertex1, viewedVertex1, viewMatrix);
-            multiplyVM(rotatedVertex2, viewedVertex2, viewMatrix);
-            multiplyVM(rotatedVertex3, viewedVertex3, viewMatrix);
+        int count = 3;
+        if (Clipped)
+        {
+            // Entirely outside one plane of the real frustum: nothing to draw
+            int frustumCodes[3];
+            for (int i = 0; i < 3; i++)
+                frustumCodes[i] = clipOutcode(poly[i], 1.0f);
+            if (frustumCodes[0] & frustumCodes[1] & frustumCodes[2])
+                continue;
+
+            // Only clip when a corner crosses the near or far plane or leaves the guard band
+            int guardCodes = clipOutcode(poly[0], guardBand) | clipOutcode(poly[1], guardBand) | clipOutcode(poly[2], guardBand);
+            if (guardCodes)
+                count = clipPolygon(poly, count, guardBand);
+
+            if (count < 3)
+                continue;
+        }
+
+        // Flat across the face so every piece shares it. The sun goes in now,
+        // point and spot lights once the frame's faces are all known
+        float sunFacing = std::max(dotProduct(normal, sunDirection), 0.0f);
+        vertex centroid = scaleV(addV(addV(rotatedVertex1, rotatedVertex2), rotatedVertex3), 1.0f / 3.0f);
+        int cluster = 0;
+        if (Lit)
+            cluster = pass.clusters->clusterOf(scaleV(addV(addV(viewedVertex1, viewedVertex2), viewedVertex3), 1.0f / 3.0f));
+        int surface = pass.surfaces->push(centroid, normal, cluster, addV(ambientColor, scaleV(sunColor, sunFacing)));
+
+        // Convert Normalized Coordinates (-1, 1) to SDL Window Coordinates
+        vertex projected[maxClipVertices];
+        for (int i = 0; i < count; i++)
+        {
+            projected[i] = { poly[i].x / poly[i].w, poly[i].y / poly[i].w, poly[i].z / poly[i].w };
+            convertToWindowCoordinates(projected[i], pass.width, pass.height);
+        }
 
-            triangle viewedTriangle = {
-                viewedVertex1,
-                viewedVertex2,
-                viewedVertex3
+        // Fan the clipped polygon back into triangles, just the one when unclipped
+        for (int piece = 1; piece + 1 < count; piece++)
+        {
+            triangle projectedTriangle = {
+                projected[0],
+                projected[piece],
+                projected[piece + 1]
             };
 
-            // Clip Triangles against near plane
-            triangle clipped[2];
-            int numClipped = clipTriangle({ 0.0f, 0.0f, 0.1f }, { 0.0f, 0.0f, 1.0f }, viewedTriangle, clipped[0], clipped[1]);
-            for (int n = 0; n < numClipped; n++)
+            projectedTriangle.t[0] = poly[0].t;
+            projectedTriangle.t[1] = poly[piece].t;
+            projectedTriangle.t[2] = poly[piece + 1].t;
+
+            // Add triangle to list
+            pass.triangles->push_back({projectedTriangle, texture, surface});
+        }
+    }
+}
+
+// Face normals and the bounds of the triangles the geometry points at
+static void faceNormalsAndBounds(worldGeometry &geometry)
+{
+    const frameVector<triangle> &source = *geometry.triangles;
+    geometry.normals.resize(source.size());
+    if (!source.empty())
+        geometry.boundsMin = geometry.boundsMax = source[0].v[0];
+    for (size_t n = 0; n < source.size(); n++)
+    {
+        const triangle &tri = source[n];
+        geometry.normals[n] = normalize(crossProduct(subtractV(tri.v[1], tri.v[0]), subtractV(tri.v[2], tri.v[0])));
+        for (const vertex &v : tri.v)
+        {
+            geometry.boundsMin = { std::min(geometry.boundsMin.x, v.x), std::min(geometry.boundsMin.y, v.y), std::min(geometry.boundsMin.z, v.z) };
+            geometry.boundsMax = { std::max(geometry.boundsMax.x, v.x), std::max(geometry.boundsMax.y, v.y), std::max(geometry.boundsMax.z, v.z) };
+        }
+    }
+}
+
+static bool sameMatrix(const matrix4 &a, const matrix4 &b)
+{
+    for (int row = 0; row < 4; row++)
+        for (int col = 0; col < 4; col++)
+            if (a.m[row][col] != b.m[row][col])
+                return false;
+    return true;
+}
+
+// The mesh a static instance is built from, held so it can't be freed and
+// another one take its address while the cache still refers to it
+static std::shared_ptr<const void> meshSource(const meshInstance &instance)
+{
+    if (instance.packed)
+        return instance.packed;
+    if (instance.indexed)
+        return instance.indexed;
+    if (instance.bsp)
+        return instance.bsp;
+    return instance.model;
+}
+
+void Renderer::updateWorldCache()
+{
+    worldCache.resize(instances.size());
+    std::vector<int> dirty;
+    for (int i = 0; i < int(instances.size()); i++)
+    {
+        const meshInstance &instance = instances[i];
+        if (!cacheWorld || instance.skinned || instance.streamed || instance.terrain)
+        {
+            worldCache[i].reset();
+            continue;
+        }
+        if (!worldCache[i])
+            worldCache[i] = std::make_unique<worldGeometry>();
+
+        // The matrix comes out bit for bit the same while nothing it is made
+        // of changes, so comparing it catches every kind of movement
+        worldGeometry &geometry = *worldCache[i];
+        matrix4 world = modelMatrix(instance);
+        std::shared_ptr<const void> source = meshSource(instance);
+        if (geometry.source != source || !sameMatrix(geometry.world, world))
+        {
+            geometry.world = world;
+            geometry.source = source;
+            dirty.push_back(i);
+        }
+    }
+    worldRebuilds = int(dirty.size());
+    if (dirty.empty())
+        return;
+
+    // The first frame and model rotation redo every instance, so they are split up
+    if (dirty.size() > 1 && !workers)
+        workers = std::make_unique<WorkerPool>();
+    auto rebuild = [&](int n)
+    {
+        // Indexed meshes need somewhere for their shared vertices, one per thread
+        static thread_local frameVector<vertex> vertices;
+        worldGeometry &geometry = *worldCache[dirty[n]];
+        transformInstance(instances[dirty[n]], geometry.world, vertices, geometry.cached);
+        geometry.triangles = &geometry.cached;
+        geometry.toModel = inverseAffine(geometry.world);
+        faceNormalsAndBounds(geometry);
+    };
+    if (workers)
+        workers->parallelFor(int(dirty.size()), rebuild);
+    else
+        rebuild(0);
+}
+
+const worldGeometry &Renderer::prepareInstance(size_t index, const viewPass &lodPass, bool culled)
+{
+    if (index < worldCache.size() && worldCache[index])
+        return *worldCache[index];
+
+    const meshInstance &instance = instances[index];
+    worldGeometry &geometry = instanceGeometry;
+
+    // Rotation and placement of this instance, all triangles at once.
+    // Animated instances were already skinned into world space
+    geometry.triangles = &worldTriangles;
+    if (instance.skinned)
+        geometry.triangles = &skinning[index]->triangles;
+    else
+    {
+        matrix4 world = modelMatrix(instance);
+        if (instance.streamed)
+        {
+            // Chunks are picked in model space, like the BSP traversal
+            vertex eye;
+            multiplyVM(lodPass.eye, eye, inverseAffine(world));
+            instance.streamed->update(eye, multiplyM(multiplyM(world, lodPass.viewMatrix), lodPass.projectionMatrix));
+        }
+        if (instance.terrain)
+        {
+            vertex eye;
+            multiplyVM(lodPass.eye, eye, inverseAffine(world));
+            // Error over distance is the same in model and world space
+            instance.terrain->update(eye, multiplyM(multiplyM(world, lodPass.viewMatrix), lodPass.projectionMatrix),
+                                     lodPass.projectionMatrix.m[1][1] * lodPass.height * 0.5f);
+        }
+        transformInstance(instance, world, worldVertices, worldTriangles, culled);
+        if (instance.bsp)
+            geometry.toModel = inverseAffine(world);
+    }
+
+    // Normals and bounds don't depend on the camera, so every view shares them
+    faceNormalsAndBounds(geometry);
+    return geometry;
+}
+
+void Renderer::projectInstance(size_t index, const worldGeometry &geometry, const viewPass &pass, bool ordered)
+{
+    const meshInstance &instance = instances[index];
+
+    // One bounds test decides for the whole instance whether its triangles
+    // can need clipping at all, or can be skipped outright
+    int clipping = instanceClipping(geometry, pass);
+    if (clipping == ClipOutside)
+        return;
+
+    ordered = ordered && instance.bsp;
+    if (ordered)
+    {
+        // The tree lives in model space, so the camera is taken there
+        vertex eye;
+        multiplyVM(pass.eye, eye, geometry.toModel);
+        traverseBspTree(*instance.bsp, eye, bspOrder);
+    }
+    size_t triangleCount = ordered ? bspOrder.size() : geometry.triangles->size();
+
+    // Every combination is compiled ahead, so the choice is made here once
+    // per instance instead of being tested again for every triangle
+    static const projectFunction variants[16] = {
+        &Renderer::projectTriangles<false, false, false, false>, &Renderer::projectTriangles<false, false, false, true>,
+        &Renderer::projectTriangles<false, false, true, false>, &Renderer::projectTriangles<false, false, true, true>,
+        &Renderer::projectTriangles<false, true, false, false>, &Renderer::projectTriangles<false, true, false, true>,
+        &Renderer::projectTriangles<false, true, true, false>, &Renderer::projectTriangles<false, true, true, true>,
+        &Renderer::projectTriangles<true, false, false, false>, &Renderer::projectTriangles<true, false, false, true>,
+        &Renderer::projectTriangles<true, false, true, false>, &Renderer::projectTriangles<true, false, true, true>,
+        &Renderer::projectTriangles<true, true, false, false>, &Renderer::projectTriangles<true, true, false, true>,
+        &Renderer::projectTriangles<true, true, true, false>, &Renderer::projectTriangles<true, true, true, true>
+    };
+    int variant = (ordered ? 8 : 0) | (instance.texture ? 4 : 0) | (clipping == ClipNeeded ? 2 : 0) | (lights.empty() ? 0 : 1);
+    (this->*variants[variant])(instance, geometry, triangleCount, pass);
+}
+
+void Renderer::processInstance(size_t index, const viewPass &pass)
+{
+    projectInstance(index, prepareInstance(index, pass, true), pass, true);
+}
+
+void Renderer::budgetedGeometry(const viewPass &pass, float geometryBudget)
+{
+    auto start = std::chrono::high_resolution_clock::now();
+    if (caches.size() != instances.size())
+    {
+        caches.clear();
+        caches.resize(instances.size());
+    }
+
+    // Nearest and largest on screen first. The longer an instance has been
+    // left with old results the further up it moves, so all of them refine
+    budgetQueue.clear();
+    for (size_t index = 0; index < instances.size(); index++)
+    {
+        instanceCache &cache = caches[index];
+        cache.fresh = false;
+        if (!cache.hasBounds)
+        {
+            localBounds(instances[index], cache.boundsMin, cache.boundsMax);
+            cache.hasBounds = true;
+        }
+        vertex center;
+        multiplyVM(scaleV(addV(cache.boundsMin, cache.boundsMax), 0.5f), center, modelMatrix(instances[index]));
+        vertex extent = subtractV(cache.boundsMax, cache.boundsMin);
+        float radius = 0.5f * sqrtf(dotProduct(extent, extent)) * instances[index].scale;
+        vertex offset = subtractV(center, cam.position);
+        float distance = sqrtf(dotProduct(offset, offset));
+        float size = radius / std::max(distance - radius, nearPlane);
+        budgetQueue.push_back({ size * (cache.age + 1), int(index) });
+    }
+    std::sort(budgetQueue.begin(), budgetQueue.end(), [](const std::pair<float, int> &a, const std::pair<float, int> &b)
+    {
+        return a.first > b.first;
+    });
+
+    // At least one instance a frame, or a budget too small would never draw anything new
+    staleInstances = 0;
+    int processed = 0;
+    for (const auto &entry : budgetQueue)
+    {
+        instanceCache &cache = caches[entry.second];
+        float elapsed = std::chrono::duration<float>(std::chrono::high_resolution_clock::now() - start).count();
+        if (processed > 0 && elapsed >= geometryBudget)
+        {
+            cache.age++;
+            if (cache.valid)
+                staleInstances++;
+            continue;
+        }
+        size_t first = visibleTriangles.size();
+        processInstance(entry.second, pass);
+        cache.triangles.assign(visibleTriangles.begin() + first, visibleTriangles.end());
+        visibleTriangles.resize(first);
+        cache.valid = true;
+        cache.fresh = true;
+        cache.age = 0;
+        processed++;
+    }
+
+    // Back into drawing order. Stale instances are drawn where they were and
+    // lit as they were: a face with no normal picks up no lights, only its old colour
+    for (const auto &entry : instanceOrder)
+    {
+        instanceCache &cache = caches[entry.second];
+        if (!cache.valid)
+            continue;
+        if (cache.fresh)
+            visibleTriangles.insert(visibleTriangles.end(), cache.triangles.begin(), cache.triangles.end());
+        else
+        {
+            for (size_t n = 0; n < cache.triangles.size(); n++)
             {
-                vertex projectedVertex1;
-                vertex projectedVertex2;
-                vertex projectedVertex3;
-
-                // Project 3D -> 3D
-                multiplyVM(clipped[n].v[0], projectedVertex1, projectionMatrix);
-                multiplyVM(clipped[n].v[1], projectedVertex2, projectionMatrix);
-                multiplyVM(clipped[n].v[2], projectedVertex3, projectionMatrix);
-
-                // Convert Normalized Coordinates (-1, 1) to SDL Window Coordinates
-                convertToWindowCoordinates(projectedVertex1);
-                convertToWindowCoordinates(projectedVertex2);
-                convertToWindowCoordinates(projectedVertex3);
-
-                triangle projectedTriangle = {
-                    projectedVertex1,
-                    projectedVertex2,
-                    projectedVertex3
-                };
-
-                // Copy over texture U V coordinates
-                projectedTriangle.t[0] = tri.t[0];
-                projectedTriangle.t[1] = tri.t[1];
-                projectedTriangle.t[2] = tri.t[2];
-
-                // Calculate light level from dot product
-                vertex light = { 0.0f, 1.0f, -1.0f };
-                projectedTriangle.lightIntensity = dotProduct(normal, light);
-
-                // Add triangle to list
-                visibleTriangles.push_back(projectedTriangle);
+                visibleTriangle visible = cache.triangles[n];
+                visible.surface = surfaces->push({ 0.0f, 0.0f, 0.0f }, { 0.0f, 0.0f, 0.0f }, 0, cache.colors[n]);
+                visibleTriangles.push_back(visible);
             }
         }
     }
+}
+
+void Renderer::storeBudgetColors()
+{
+    // Kept for the frames that reuse these results instead of lighting them again
+    for (instanceCache &cache : caches)
+    {
+        if (!cache.fresh)
+            continue;
+        cache.colors.resize(cache.triangles.size());
+        for (size_t n = 0; n < cache.triangles.size(); n++)
+        {
+            int surface = cache.triangles[n].surface;
+            cache.colors[n] = { surfaces->r[surface], surfaces->g[surface], surfaces->b[surface] };
+        }
     }
+}
 
-    // Sort Triangles by depth from back to front
-    sort(visibleTriangles.begin(), visibleTriangles.end(), [](triangle &t1, triangle &t2)
+void Renderer::frameRender()
+{
+    auto startTime = std::chrono::high_resolution_clock::now();
+    //cam.rotation += time; // Comment this line out to turn off rotating
+
+    //SDL_SetRenderTarget(render, lowResTexture); // Comment this line out to turn off lowRes
+    commands.reset();
+    commands.clear({ 0, 0, 0, SDL_ALPHA_OPAQUE });
+
+    // Camera Calculations
+    matrix4 cameraToWorld = cameraMatrix();
+    matrix4 viewMatrix = inverseMatrix4(cameraToWorld);
+
+    // The main view over the whole window, or each view in its own rectangle
+    passes.clear();
+    if (views.empty())
+        passes.push_back({ cam.position, viewMatrix, projectionMatrix, farPlane, windowWidth, windowHeight,
+                           &visibleTriangles, surfaces.get(), lightClusters.get() });
+    placeViews();
+    for (viewStorage &target : views)
     {
-        float z1 = (t1.v[0].z + t1.v[1].z + t1.v[2].z) / 3.0f;
-		float z2 = (t2.v[0].z + t2.v[1].z + t2.v[2].z) / 3.0f;
-		return z1 > z2;
-    });
+        bool main = target.view.kind == ViewKind::Main;
+        passes.push_back({ main ? cam.position : target.eye, main ? viewMatrix : target.viewMatrix, target.projectionMatrix,
+                           target.farPlane, target.view.rect.w, target.view.rect.h,
+                           &target.triangles, target.surfaces.get(), target.clusters.get() });
+    }
+    for (viewPass &pass : passes)
+    {
+        pass.triangles->clear();
+        pass.surfaces->clear();
+        pass.clusters->build(lights, pass.viewMatrix, pass.projectionMatrix, nearPlane, pass.farPlane, pass.width, pass.height);
+    }
 
-    // Rasterize Triangles (now sorted from back to front)
-    for (auto &tri : visibleTriangles)
+    animateInstances();
+    updateWorldCache();
+    if (particles->emitterCount() > 0)
     {
-        //tri.lightIntensity = 1.0f; // This line disables lighting
-        SDL_Color brightness = {
-            static_cast<Uint8>(255 * tri.lightIntensity),
-            static_cast<Uint8>(255 * tri.lightIntensity),
-            static_cast<Uint8>(255 * tri.lightIntensity),
-            0xFF};
-        fillTriangle(render, {tri.v[0].x, tri.v[0].y}, {tri.v[1].x, tri.v[1].y}, {tri.v[2].x, tri.v[2].y}, tri.t[0], tri.t[1], tri.t[2], brightness);
-        //SDL_RenderDrawLine(render, tri.v[0].x, tri.v[0].y, tri.v[1].x, tri.v[1].y);
-        //SDL_RenderDrawLine(render, tri.v[1].x, tri.v[1].y, tri.v[2].x, tri.v[2].y);
-        //SDL_RenderDrawLine(render, tri.v[2].x, tri.v[2].y, tri.v[0].x, tri.v[0].y);
+        if (!workers)
+            workers = std::make_unique<WorkerPool>();
+        particles->update(time, workers.get());
     }
 
+    // BSP instances come out in exact order on their own, so when every instance
+    // is one and no two overlap, drawing them far to near needs no sort over the
+    // whole frame. Anything else could interleave with them, particles are merged
+    // in by depth, and with several views the order would differ between them,
+    // so then each view sorts everything
+    bool bspOrdering = views.empty() && particles->emitterCount() == 0 && separateBspInstances();
+    instanceOrder.clear();
+    for (size_t index = 0; index < instances.size(); index++)
+    {
+        vertex offset = subtractV(instances[index].position, cam.position);
+        instanceOrder.push_back({ dotProduct(offset, offset), int(index) });
+    }
+    if (bspOrdering)
+    {
+        std::sort(instanceOrder.begin(), instanceOrder.end(), [](const std::pair<float, int> &a, const std::pair<float, int> &b)
+        {
+            return a.first > b.first;
+        });
+    }
+
+    if (!views.empty())
+    {
+        // Each instance goes to world space once and then into every view, while
+        // its triangles are still in cache. Streamed meshes and terrain pick
+        // their chunks for the first view and keep the ones it can't see, the
+        // other views may
+        staleInstances = 0;
+        for (size_t index = 0; index < instances.size(); index++)
+        {
+            const worldGeometry &geometry = prepareInstance(index, passes[0], false);
+            for (const viewPass &pass : passes)
+                projectInstance(index, geometry, pass, false);
+        }
+    }
+    else if (frameBudget > 0.0f)
+    {
+        // Whatever part of the budget the fixed costs of the frame leave
+        float spent = std::chrono::duration<float>(std::chrono::high_resolution_clock::now() - startTime).count();
+        budgetedGeometry(passes[0], frameBudget - spent - tailTime);
+    }
+    else
+    {
+        staleInstances = 0;
+        for (const auto &entry : instanceOrder)
+            processInstance(entry.second, passes[0]);
+    }
+    auto geometryEnd = std::chrono::high_resolution_clock::now();
+
+    // Sort Triangles by depth from back to front
+    if (!bspOrdering)
+    {
+        for (viewPass &pass : passes)
+            sortByDepth(*pass.triangles);
+    }
+    auto sortEnd = std::chrono::high_resolution_clock::now();
+
+    lightTests = 0;
+    for (viewPass &pass : passes)
+        lightTests += lights.empty() ? 0 : pass.clusters->shade(*pass.surfaces);
+    if (frameBudget > 0.0f && views.empty())
+        storeBudgetColors();
+    auto shadeEnd = std::chrono::high_resolution_clock::now();
+
+    // Rasterize Triangles (now sorted from back to front), one batch per run of the same texture.
+    // Particles are sorted the same way and go in between, wherever their depth falls
+    for (size_t view = 0; view < passes.size(); view++)
+    {
+        const viewPass &pass = passes[view];
+        if (!views.empty())
+            commands.setViewport(&views[view].view.rect);
+        particles->prepareBillboards(pass.viewMatrix, pass.projectionMatrix, nearPlane, pass.width, pass.height);
+        size_t billboards = particles->billboardCount();
+        size_t nextBillboard = 0;
+        for (auto &visible : *pass.triangles)
+        {
+            triangle &tri = visible.tri;
+            if (nextBillboard < billboards)
+                nextBillboard = particles->recordBillboards(commands, nextBillboard, (tri.v[0].z + tri.v[1].z + tri.v[2].z) / 3.0f);
+            // Lights add up past 1, so clamp rather than let the bytes wrap
+            SDL_Color brightness = {
+                static_cast<Uint8>(255 * std::min(pass.surfaces->r[visible.surface], 1.0f)),
+                static_cast<Uint8>(255 * std::min(pass.surfaces->g[visible.surface], 1.0f)),
+                static_cast<Uint8>(255 * std::min(pass.surfaces->b[visible.surface], 1.0f)),
+                0xFF};
+            SDL_Vertex corners[3];
+            for (int i = 0; i < 3; i++)
+                corners[i] = { { tri.v[i].x, tri.v[i].y }, brightness, { tri.t[i].u, 1.0f - tri.t[i].v } };
+            commands.drawTriangle(visible.texture, corners);
+        }
+        particles->recordBillboards(commands, nextBillboard, -1e30f);
+    }
+    if (!views.empty())
+        commands.setViewport(NULL);
+    drawBatches = commands.batchCount();
+
     // Render text to the screen
-    fontRenderer->renderTextCentered(render, "Benjamin Ryan!", windowWidth / 2, 5, 1.0f);
-    fontRenderer->renderText(render, std::to_string(fps) + " FPS", 0, 5, 1.0f, 255, 0, 0);
+    if (showHud)
+    {
+        commands.drawText("Benjamin Ryan!", windowWidth / 2, 5, 1.0f, { 255, 255, 255, 255 }, true);
+        commands.drawText(std::to_string(fps) + " FPS", 0, 5, 1.0f, { 255, 0, 0, 255 }, false);
+    }
+    if (showMemory)
+    {
+        // The font has no punctuation beyond '!' and '.', so keep to words
+        int y = 25;
+        for (const auto &stats : memoryReport())
+        {
+            char line[128];
+            snprintf(line, sizeof(line), "%s %.2f MB peak %.2f MB %lld allocs", stats.name,
+                     stats.liveBytes / (1024.0 * 1024.0), stats.peakBytes / (1024.0 * 1024.0), stats.frameAllocations);
+            commands.drawText(line, 0, y, 0.75f, { 255, 255, 0, 255 }, false);
+            y += 15;
+        }
+    }
 
-    SDL_RenderPresent(render);
+    auto submitStart = std::chrono::high_resolution_clock::now();
+    backend->submit(commands);
+
+    // Read back before presenting, the back buffer is undefined afterwards
+    if (capture)
+        capture->captureFrame(render);
+
+    backend->present();
 
     /* // Comment this out to turn off lowRes
     SDL_SetRenderTarget(render, NULL);
@@ -788,14 +1913,22 @@ void Renderer::frameRender()
 
     auto endTime = std::chrono::high_resolution_clock::now();
     std::chrono::duration<double> duration = endTime - startTime;
-    time = duration.count();
+    recordTime = std::chrono::duration<float>(submitStart - startTime).count();
+    tailTime = std::chrono::duration<float>(endTime - geometryEnd).count();
+    submitTime = std::chrono::duration<float>(endTime - submitStart).count();
+    stageTimes.geometry = std::chrono::duration<float>(geometryEnd - startTime).count();
+    stageTimes.sort = std::chrono::duration<float>(sortEnd - geometryEnd).count();
+    stageTimes.shading = std::chrono::duration<float>(shadeEnd - sortEnd).count();
+    stageTimes.record = std::chrono::duration<float>(submitStart - shadeEnd).count();
+    stageTimes.submit = submitTime;
+    time = fixedTimestep > 0.0f ? fixedTimestep : duration.count();
 }
 
-void Renderer::convertToWindowCoordinates(vertex &v)
+void Renderer::convertToWindowCoordinates(vertex &v, int width, int height)
 {
     /* SDL Window has a coordinate system with (0, 0) in top left corner */
-    v.x = (v.x + 1.0f) * (0.5f * windowWidth);
-    v.y = (1.0f - v.y) * (0.5f * windowHeight);
+    v.x = (v.x + 1.0f) * (0.5f * width);
+    v.y = (1.0f - v.y) * (0.5f * height);
     //v.x = (v.x + 1.0f) * (0.5f * lowResWidth);
     //v.y = (1.0f - v.y) * (0.5f * lowResHeight);
 }
\ No newline at end of file
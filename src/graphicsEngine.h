@@ -1,10 +1,18 @@
 #include <vector>
 #include <string>
 #include <fstream>
+#include <memory>
 #include "fontRenderer.h"
+#include "assetCache.h"
+#include "memoryTracker.h"
+#include "commandBuffer.h"
 
 #ifndef GRAPHICSENGINE_H
-#define GRAPHICESENGINE_H
+#define GRAPHICSENGINE_H
+
+class FrameCapture;
+class RenderBackend;
+class SDLBackend;
 
 struct vertex
 {
@@ -28,71 +36,465 @@ struct triangle
 
 struct mesh
 {
-    std::vector<triangle> triangles;
+    meshVector<triangle> triangles;
+
+    // Copies are legal but almost never wanted, meshes are shared through
+    // the asset cache. Each one is counted and reported by the tracker
+    mesh() = default;
+    mesh(const mesh &other) : triangles(other.triangles) { trackDeepCopy(MemoryTag::Meshes, triangles.size() * sizeof(triangle), "mesh"); }
+    mesh(mesh &&other) = default;
+    mesh &operator=(const mesh &other)
+    {
+        triangles = other.triangles;
+        trackDeepCopy(MemoryTag::Meshes, triangles.size() * sizeof(triangle), "mesh");
+        return *this;
+    }
+    mesh &operator=(mesh &&other) = default;
+};
+
+struct quantizedMesh;
+struct indexedMesh;
+struct bspTree;
+struct meshBvh;
+struct rayHit;
+struct rayQuery;
+struct skinnedMesh;
+struct skinningState;
+class WorkerPool;
+class LightClusters;
+struct litSurfaces;
+class MeshStreamer;
+class Terrain;
+struct stressSettings;
+class ParticleSystem;
+
+// One placement of a shared mesh in the scene.
+// One of model, packed, indexed, bsp, streamed, terrain or skinned is set: plain,
+// compressed, cache optimized, BSP ordered, paged from disk, heightmap or animated
+struct meshInstance
+{
+    std::shared_ptr<const mesh> model;
+    std::shared_ptr<const quantizedMesh> packed;
+    std::shared_ptr<const indexedMesh> indexed;
+    std::shared_ptr<const bspTree> bsp;
+    std::shared_ptr<const skinnedMesh> skinned;
+    // Not shared between instances, what it keeps loaded depends on the placement
+    std::shared_ptr<MeshStreamer> streamed;
+    std::shared_ptr<Terrain> terrain;
+    // For ray queries, set for every static mesh that isn't streamed
+    std::shared_ptr<const meshBvh> bvh;
+    int clip = 0;
+    float clipTime = 0.0f;
+    std::shared_ptr<SDL_Texture> texture;
+    // Where the texture sits when it was packed into an atlas page
+    coord uvOffset = { 0.0f, 0.0f };
+    coord uvScale = { 1.0f, 1.0f };
+    vertex position = { 0.0f, 0.0f, 0.0f };
+    float yaw = 0.0f;
+    float pitch = 0.0f;
+    float scale = 1.0f;
+};
+
+// A projected triangle waiting to be sorted and drawn
+struct visibleTriangle
+{
+    triangle tri;
+    SDL_Texture *texture;
+    int surface = 0;    // face it was clipped from, for the lighting results
 };
 
+// What an instance projected to when it was last processed, reused in
+// frame budget mode on frames that have no time left for it
+struct instanceCache
+{
+    frameVector<visibleTriangle> triangles;
+    frameVector<vertex> colors;         // the light each triangle ended up with
+    vertex boundsMin = { 0.0f, 0.0f, 0.0f };    // model space
+    vertex boundsMax = { 0.0f, 0.0f, 0.0f };
+    bool hasBounds = false;
+    bool valid = false;
+    bool fresh = false;                 // processed this frame
+    int age = 0;                        // frames since it was last processed
+};
+
+// A vertex after projection, before the divide by w
+struct clipVertex
+{
+    float x;
+    float y;
+    float z;
+    float w;
+    coord t;
+};
+
+// A triangle clipped against six planes gains at most one vertex per plane
+const int maxClipVertices = 9;
+
 struct matrix4
 {
     float m[4][4] = { 0.0f };
 };
 
+// Where the frame is looked at from, and how the models are turned
+struct cameraState
+{
+    vertex position = { 0.0f, 2.0f, 0.0f };
+    vertex direction = { 0.0f, 0.0f, 1.0f };
+
+    // These are used to rotate the 'camera'
+    float yaw = 0.0f;
+    float pitch = 0.0f;
+
+    // These are used to rotate an object
+    float rYaw = 0.0f;
+    float rPitch = 0.0f;
+    float rotation = 0.0f;
+};
+
+// An instance's world space triangles with their face normals and bounds,
+// worked out once a frame whichever views the instance ends up in
+struct worldGeometry
+{
+    const frameVector<triangle> *triangles = nullptr;
+    frameVector<vertex> normals;
+    vertex boundsMin = { 0.0f, 0.0f, 0.0f };
+    vertex boundsMax = { 0.0f, 0.0f, 0.0f };
+    matrix4 toModel;                    // set for BSP instances, whose order is found in model space
+    // Kept from frame to frame for instances whose triangles only depend on
+    // their mesh and transform, along with what they were built from
+    frameVector<triangle> cached;
+    matrix4 world;
+    std::shared_ptr<const void> source;
+};
+
+// Where a view looks from. Main follows the camera, the others frame the
+// whole scene from above, from the side (+x) and from the front (-z)
+enum class ViewKind
+{
+    Main,
+    Top,
+    Side,
+    Front
+};
+
+// One of several views drawn in the same frame, each into its own part of the window
+struct renderView
+{
+    ViewKind kind = ViewKind::Main;
+    SDL_Rect rect = { 0, 0, 0, 0 };
+};
+
+// What each of several views keeps between frames, so its lists don't allocate
+struct viewStorage
+{
+    renderView view;
+    // Camera of the views that don't follow the main one, placed around the scene bounds
+    bool placed = false;
+    vertex eye = { 0.0f, 0.0f, 0.0f };
+    matrix4 viewMatrix;
+    matrix4 projectionMatrix;       // every view's, for the shape of its rectangle
+    float farPlane = 0.0f;
+    frameVector<visibleTriangle> triangles;
+    std::unique_ptr<litSurfaces> surfaces;
+    std::unique_ptr<LightClusters> clusters;
+};
+
+// One camera's share of a frame: where it looks from and the lists it fills.
+// The lists are owned elsewhere, by the renderer for the main view or by
+// each view when there are several
+struct viewPass
+{
+    vertex eye;
+    matrix4 viewMatrix;
+    matrix4 projectionMatrix;
+    float farPlane;
+    int width;
+    int height;
+    frameVector<visibleTriangle> *triangles;
+    litSurfaces *surfaces;
+    LightClusters *clusters;
+};
+
+// A point light, or a spot light when coneAngle is below 180 degrees.
+// Nothing is lit beyond radius, colour channels may go above 1
+struct sceneLight
+{
+    vertex position = { 0.0f, 0.0f, 0.0f };
+    vertex color = { 1.0f, 1.0f, 1.0f };
+    float radius = 10.0f;
+    vertex direction = { 0.0f, -1.0f, 0.0f };
+    float coneAngle = 180.0f;       // full angle in degrees
+    float softness = 0.2f;          // fraction of the cone that fades out
+};
+
+// Spawns particles at a steady rate. Each starts at position with velocity
+// plus up to spread in every axis, falls with gravity (negative rises), slows
+// with drag, and fades out over lifetime seconds
+struct particleEmitter
+{
+    vertex position = { 0.0f, 0.0f, 0.0f };
+    vertex velocity = { 0.0f, 0.0f, 0.0f };
+    float spread = 1.0f;
+    float rate = 100.0f;            // particles per second
+    float lifetime = 2.0f;
+    float size = 0.1f;              // half the width of the quad, world units
+    float gravity = 9.8f;
+    float drag = 0.0f;              // fraction of the velocity lost per second
+    SDL_Color color = { 255, 255, 255, 255 };
+    // NULL for a soft round spot
+    std::shared_ptr<SDL_Texture> texture;
+};
+
+// Seconds the last frame spent in each stage, in the order they run
+struct frameStages
+{
+    float geometry = 0.0f;  // animation, transform, projection and clipping
+    float sort = 0.0f;
+    float shading = 0.0f;   // clustered lights
+    float record = 0.0f;    // filling the command buffer
+    float submit = 0.0f;    // the backend and present
+};
+
+// Vector and matrix helpers
+vertex crossProduct(const vertex& a, const vertex& b);
+float dotProduct(const vertex& a, const vertex& b);
+vertex scaleV(const vertex& v, float s);
+vertex subtractV(const vertex& a, const vertex& b);
+vertex addV(const vertex& a, const vertex& b);
+vertex multiplyV(const vertex& a, const vertex& b);
+void multiplyVM(const vertex &v, vertex &product, const matrix4 &m);
+matrix4 multiplyM(const matrix4 &a, const matrix4 &b);
+vertex normalize(const vertex& v);
+matrix4 pointAtMatrix(vertex &pos, vertex &target, vertex &up);
+matrix4 matrixRotateX(float _pitch);
+matrix4 matrixRotateY(float _yaw);
+matrix4 matrixRotateZ(float _roll);
+matrix4 matrixTranslate(const vertex &offset);
+matrix4 matrixScale(float _scale);
+matrix4 inverseMatrix4(matrix4& m);
+// Full inverse of a rotation, scale and translation, unlike inverseMatrix4 which assumes no scale
+matrix4 inverseAffine(const matrix4 &m);
+vertex intersectPlane(vertex &plane, vertex &planeNormal, vertex &start, vertex &end);
+vertex intersectPlane(vertex &plane, vertex &planeNormal, vertex &start, vertex &end, float &t);
+int clipTriangle(vertex plane, vertex planeNormal, triangle &in, triangle &out1, triangle &out2);
+// Homogeneous clipping. The side planes sit at |x|, |y| <= w * band, so a
+// band above 1 is a guard band that leaves slightly off-screen triangles alone
+void projectVM(const vertex &v, clipVertex &out, const matrix4 &m);
+int clipOutcode(const clipVertex &v, float band);
+// Distance from a point to a box, 0 inside
+float boxDistance(const vertex &p, const vertex &boundsMin, const vertex &boundsMax);
+// A box is out of view when all eight corners are outside the same clip plane
+bool boxVisible(const vertex &boundsMin, const vertex &boundsMax, const matrix4 &modelToClip);
+// poly holds count vertices and room for maxClipVertices, returns the new count or 0
+int clipPolygon(clipVertex *poly, int count, float band);
+void meshBounds(const mesh &m, vertex &boundsMin, vertex &boundsMax);
+void transformTriangles(const mesh &m, const matrix4 &world, frameVector<triangle> &out);
+// Back to front by centroid depth, the painter's order frameRender draws in.
+// Only the triangles from first on are sorted
+void sortByDepth(frameVector<visibleTriangle> &triangles, size_t first = 0);
+
 class Renderer
 {
     public:
-        Renderer(SDL_Window *_window, SDL_Renderer *_render, const std::vector<mesh> &_models);
+        Renderer(SDL_Renderer *_render, int width, int height);
+        ~Renderer();
         void renderFrame();
         void frameRender();
         bool loadObjFile(const std::string& filename, int index);
         bool loadObjTextureFile(const std::string &filename, const std::string &texturename, int index);
+        bool loadScene(const std::string &filename);
+        // Replaces the scene with a generated one, see stressScene.h
+        bool loadStressScene(const stressSettings &settings);
         void setControlCamera(bool _controlCamera);
         void setFps(int _fps);
+        void setFrameCapture(FrameCapture *_capture);
+        // NULL goes back to drawing through SDL
+        void setBackend(RenderBackend *_backend);
+        void setFixedTimestep(float _timestep);
+        void setShowHud(bool _showHud);
+        void setMeshStorage(MeshStorage _meshStorage);
+        void setShowMemory(bool _showMemory);
+        void setTextureAtlas(bool _useAtlas, int _maxTextureSize = 0);
+        // Memory the streamed meshes may keep loaded between them
+        void setStreamingBudget(size_t bytes);
+        // Caps the time spent on geometry so the frame fits in this many ms, nearest
+        // and largest instances first. The rest reuse what they last projected to
+        // and catch up over the next frames. 0 processes everything every frame
+        void setFrameBudget(float milliseconds);
+        // Instances the last frame drew from earlier results
+        int getStaleInstances();
+        // Draws the scene once per view, each into its own part of the window.
+        // Transforms, normals and bounds are worked out once and shared, only
+        // culling, projection, sorting, lighting and recording are per view.
+        // Empty (the default) draws the main view over the whole window.
+        // Frame budget mode only applies without views
+        void setViews(const std::vector<renderView> &_views);
+        // Keeps each static instance's world space triangles, normals and bounds
+        // between frames and only rebuilds them when its transform or mesh
+        // changes, so camera movement alone skips that work. On by default
+        void setWorldCache(bool _cacheWorld);
+        // Instances whose world space geometry the last frame had to rebuild
+        int getWorldRebuilds();
+        // Lights from a scene file are added to these
+        void addLight(const sceneLight &light);
+        void clearLights();
+        int getLightCount();
+        // Particle emitters from a scene file are added to these
+        void addEmitter(const particleEmitter &emitter);
+        void clearEmitters();
+        size_t getParticleCount();
+        // Terrain chunks the last frame drew and chunks built, over every terrain in the scene
+        void getTerrainChunks(int &drawn, int &built, long long &triangles);
+        // Light and face pairs the last frame evaluated, against lights x faces without clustering
+        long long getLightTests();
+        int getDrawBatches();
+        // Seconds the last frame spent recording commands and in the backend
+        float getRecordTime();
+        float getSubmitTime();
+        const frameStages &getStageTimes();
+        cameraState &getCamera();
+        AssetCache &getAssets();
+        float getFrameTime();
+        void sceneBounds(vertex &boundsMin, vertex &boundsMax);
+        // Nearest static instance along origin + t * direction for t in (0, maxDistance),
+        // with the models placed as they were last drawn
+        bool raycast(const vertex &origin, const vertex &direction, float maxDistance, rayHit &hit);
+        bool segmentCast(const vertex &from, const vertex &to, rayHit &hit);
+        // One hit per ray, spread over the worker threads. A miss has instance -1
+        void raycastBatch(const std::vector<rayQuery> &rays, std::vector<rayHit> &hits);
+        // What is under a window pixel
+        bool pick(int x, int y, rayHit &hit);
     private:
         coord projection(vertex);
         vertex rotateX(vertex);
         vertex rotateY(vertex);
         vertex applyRotation(vertex);
-        void fillTriangle(SDL_Renderer *renderer, coord v1, coord v2, coord v3, coord t1, coord t2, coord t3, SDL_Color color);
-        void convertToWindowCoordinates(vertex&);
+        matrix4 modelMatrix(const meshInstance &instance);
+        matrix4 cameraMatrix();
+        // World to model matrices for the ray queries, then one ray against them
+        void prepareRays();
+        bool traceRay(const vertex &origin, const vertex &direction, float maxDistance, rayHit &hit);
+        // Streamed meshes and terrain leave out chunks outside the view they were
+        // last updated for, unless culled is false. Indexed meshes put their shared
+        // vertices in vertices on the way
+        void transformInstance(const meshInstance &instance, const matrix4 &world, frameVector<vertex> &vertices, frameVector<triangle> &out, bool culled = true);
+        // Whether an instance's world space triangles can reach the clip planes
+        enum InstanceClipping { ClipInside, ClipNeeded, ClipOutside };
+        int instanceClipping(const worldGeometry &geometry, const viewPass &pass);
+        // Backface culls, projects and clips one instance into the pass's triangles.
+        // Specialized on what the instance needs, frameRender picks one per instance:
+        // Ordered walks bspOrder, Textured keeps UVs, Clipped tests the clip planes,
+        // Lit finds each face's light cluster
+        template <bool Ordered, bool Textured, bool Clipped, bool Lit>
+        void projectTriangles(const meshInstance &instance, const worldGeometry &geometry, size_t triangleCount, const viewPass &pass);
+        typedef void (Renderer::*projectFunction)(const meshInstance &, const worldGeometry &, size_t, const viewPass &);
+        // Puts a freshly loaded instance in slot index, or after the others
+        void placeInstance(meshInstance &loaded, int index);
+        void animateInstances();
+        // Brings the cached world space geometry of static instances up to date,
+        // rebuilding the ones that moved or changed mesh on the workers
+        void updateWorldCache();
+        // World space triangles, normals and bounds of one instance, from the cache
+        // or worked out into instanceGeometry. Streamed meshes and terrain pick
+        // their chunks for lodPass
+        const worldGeometry &prepareInstance(size_t index, const viewPass &lodPass, bool culled);
+        // Culls, projects and clips the prepared instance for one view. Ordered
+        // draws BSP instances in the exact order their tree gives for that view
+        void projectInstance(size_t index, const worldGeometry &geometry, const viewPass &pass, bool ordered);
+        // Both of the above for a single view
+        void processInstance(size_t index, const viewPass &pass);
+        void budgetedGeometry(const viewPass &pass, float geometryBudget);
+        // Cameras of the views that don't follow the main one, from the scene bounds
+        void placeViews();
+        void storeBudgetColors();
+        void localBounds(const meshInstance &instance, vertex &boundsMin, vertex &boundsMax);
+        void worldBounds(const meshInstance &instance, vertex &boundsMin, vertex &boundsMax);
+        // Whether every instance has a BSP tree and no two of their world boxes touch
+        bool separateBspInstances();
+        void fillTriangle(SDL_Renderer *renderer, SDL_Texture *texture, coord v1, coord v2, coord v3, coord t1, coord t2, coord t3, SDL_Color color);
+        void convertToWindowCoordinates(vertex &v, int width, int height);
 
         int fps;
 
         bool controlCamera;
+        bool showHud;
+        MeshStorage meshStorage;
+        bool showMemory;
+        bool useAtlas;
+        int maxTextureSize;
 
-        void userInput();
-
-        SDL_Window* window;
         SDL_Renderer* render;
         int windowWidth;
         int windowHeight;
 
-        SDL_Texture* texture;
-
-        vertex cameraPos;
-        vertex cameraDir;
+        cameraState cam;
         float nearPlane;
         float farPlane;
-
-        // These are used to rotate an object
-        float rYaw;
-        float rPitch;
-
-        // These are used to rotate the 'camera'
-        float yaw;
-        float pitch;
+        float guardBand;
 
         float FOV;
-        float rotation;
         float time;
+        float fixedTimestep;
 
         matrix4 projectionMatrix;
 
-        std::vector<mesh> models;
+        AssetCache assets;
+        std::vector<meshInstance> instances;
+        // World space copy of the instance being drawn, reused between instances
+        frameVector<triangle> worldTriangles;
+        frameVector<vertex> worldVertices;
+        worldGeometry instanceGeometry;
+        // Cached world space geometry, one per instance slot, empty for skinned,
+        // streamed and terrain instances which change from frame to frame
+        std::vector<std::unique_ptr<worldGeometry>> worldCache;
+        bool cacheWorld;
+        int worldRebuilds;
+        // Triangle order from the BSP tree of the instance being drawn
+        frameVector<int> bspOrder;
+        // Instances far to near, when separate BSP instances make a global sort unnecessary
+        frameVector<std::pair<float, int>> instanceOrder;
+        // Projected triangles of the current frame, kept so the storage is reused
+        frameVector<visibleTriangle> visibleTriangles;
+        // What the frame draws, consecutive triangles with the same texture in one batch
+        CommandBuffer commands;
+        int drawBatches;
+        float recordTime;
+        float submitTime;
+        frameStages stageTimes;
+        // Skinned output for animated instances, one per instance slot
+        std::vector<std::unique_ptr<skinningState>> skinning;
+        std::unique_ptr<WorkerPool> workers;
+        std::vector<matrix4> rayToModel;
+        // Point and spot lights, assigned to view space clusters each frame
+        std::vector<sceneLight> lights;
+        std::unique_ptr<LightClusters> lightClusters;
+        std::unique_ptr<litSurfaces> surfaces;
+        // Lights everything evenly, on top of the clustered lights
+        vertex sunDirection;
+        vertex sunColor;
+        vertex ambientColor;
+        long long lightTests;
+        std::unique_ptr<ParticleSystem> particles;
+        // Seconds per frame in frame budget mode, 0 when off
+        float frameBudget;
+        // What the last frame spent after geometry, which the budget has to leave room for
+        float tailTime;
+        int staleInstances;
+        std::vector<instanceCache> caches;
+        frameVector<std::pair<float, int>> budgetQueue;
+        // Views drawn side by side, none for the main view alone, and what each frame draws
+        std::vector<viewStorage> views;
+        std::vector<viewPass> passes;
 
         int lowResWidth;
         int lowResHeight;
         SDL_Texture* lowResTexture;
 
-        FontRenderer* fontRenderer;
+        std::unique_ptr<FontRenderer> fontRenderer;
+
+        FrameCapture* capture;
+        std::unique_ptr<SDLBackend> sdlBackend;
+        RenderBackend* backend;
 };
 
 #endif
\ No newline at end of file
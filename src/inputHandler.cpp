@@ -0,0 +1,98 @@
+#include <SDL2/SDL.h>
+#include "inputHandler.h"
+
+InputHandler::InputHandler(SDL_Window *_window)
+{
+    window = _window;
+    SDL_GetWindowSize(_window, &windowWidth, &windowHeight);
+}
+
+bool InputHandler::update(cameraState &cam, float time, bool controlCamera)
+{
+    return apply(poll(controlCamera), cam, time);
+}
+
+inputFrame InputHandler::poll(bool controlCamera)
+{
+    const Uint8 *state = SDL_GetKeyboardState(NULL);
+    const std::pair<SDL_Scancode, InputKey> bindings[] = {
+        { SDL_SCANCODE_W, KeyForward },
+        { SDL_SCANCODE_S, KeyBack },
+        { SDL_SCANCODE_A, KeyLeft },
+        { SDL_SCANCODE_D, KeyRight },
+        { SDL_SCANCODE_Q, KeyDown },
+        { SDL_SCANCODE_E, KeyUp },
+        { SDL_SCANCODE_LEFT, KeyYawLeft },
+        { SDL_SCANCODE_RIGHT, KeyYawRight },
+        { SDL_SCANCODE_UP, KeyPitchUp },
+        { SDL_SCANCODE_DOWN, KeyPitchDown },
+        { SDL_SCANCODE_ESCAPE, KeyQuit }
+    };
+
+    inputFrame input;
+    for (const auto &binding : bindings)
+    {
+        if (state[binding.first])
+            input.keys |= binding.second;
+    }
+
+    int mouseX;
+    int mouseY;
+    SDL_GetMouseState(&mouseX, &mouseY);
+
+    int centerX = windowWidth / 2;
+    int centerY = windowHeight / 2;
+    input.mouseX = mouseX - centerX;
+    input.mouseY = mouseY - centerY;
+
+    if (controlCamera)
+        SDL_WarpMouseInWindow(window, centerX, centerY);
+
+    return input;
+}
+
+bool InputHandler::apply(const inputFrame &input, cameraState &cam, float time)
+{
+    float cameraSpeed = 0.001f;
+    float cameraSensitivity = 0.01f;
+
+    float dX = input.mouseX * cameraSensitivity;
+    float dY = input.mouseY * cameraSensitivity;
+
+    cam.rYaw += dX;
+    cam.rPitch -= dY;
+
+    //cam.yaw += dX;
+    //cam.pitch += dY;
+
+    if (cam.rPitch > 89.0f) cam.rPitch = 89.0f;
+    if (cam.rPitch < -89.0f) cam.rPitch = -89.0f;
+
+    vertex forward = scaleV(cam.direction, time * 8.0f);
+    vertex right = crossProduct({0.0f, 8.0f, 0.0f}, cam.direction);
+
+    if (input.keys & KeyForward)
+        cam.position = addV(cam.position, forward);
+    if (input.keys & KeyBack)
+        cam.position = subtractV(cam.position, forward);
+    if (input.keys & KeyLeft)
+        cam.position = subtractV(cam.position, scaleV(right, time)); //cam.position.x -= cameraSpeed;
+    if (input.keys & KeyRight)
+        cam.position = addV(cam.position, scaleV(right, time)); //cam.position.x += cameraSpeed;
+    if (input.keys & KeyDown)
+        cam.position.y -= cameraSpeed * 8.0f;
+    if (input.keys & KeyUp)
+        cam.position.y += cameraSpeed * 8.0f;
+    if (input.keys & KeyYawLeft)
+        cam.yaw += 0.01f;
+    if (input.keys & KeyYawRight)
+        cam.yaw -= 0.01f;
+    if (input.keys & KeyPitchUp)
+        cam.pitch += 0.01f;
+    if (input.keys & KeyPitchDown)
+        cam.pitch -= 0.01f;
+    if (input.keys & KeyQuit)
+        return false;
+
+    return true;
+}
@@ -0,0 +1,51 @@
+#include <SDL2/SDL.h>
+#include "graphicsEngine.h"
+
+#ifndef INPUTHANDLER_H
+#define INPUTHANDLER_H
+
+// Keys the camera responds to, as bits of inputFrame::keys
+enum InputKey : Uint32
+{
+    KeyForward = 1 << 0,
+    KeyBack = 1 << 1,
+    KeyLeft = 1 << 2,
+    KeyRight = 1 << 3,
+    KeyDown = 1 << 4,
+    KeyUp = 1 << 5,
+    KeyYawLeft = 1 << 6,
+    KeyYawRight = 1 << 7,
+    KeyPitchUp = 1 << 8,
+    KeyPitchDown = 1 << 9,
+    KeyQuit = 1 << 10
+};
+
+// What the devices said in one frame, enough to move the camera again
+// without them
+struct inputFrame
+{
+    Uint32 keys = 0;
+    // Mouse position relative to the window centre
+    Sint32 mouseX = 0;
+    Sint32 mouseY = 0;
+};
+
+// Keyboard and mouse control for a renderer shown in a window
+class InputHandler
+{
+    public:
+        InputHandler(SDL_Window *_window);
+        // Moves the camera for this frame, returns false once escape is pressed
+        bool update(cameraState &cam, float time, bool controlCamera);
+        // The two halves of update: reading the devices (and recentring the
+        // mouse), then moving the camera by what was read
+        inputFrame poll(bool controlCamera);
+        static bool apply(const inputFrame &input, cameraState &cam, float time);
+
+    private:
+        SDL_Window* window;
+        int windowWidth;
+        int windowHeight;
+};
+
+#endif
@@ -0,0 +1,264 @@
+#include <SDL2/SDL.h>
+#include "lightClusters.h"
+#include <cmath>
+#include <algorithm>
+
+// Each cluster's faces are padded to a multiple of this, so the vectorized
+// shading loop never ends on a partial vector
+static const int shadeLanes = 8;
+
+void litSurfaces::clear()
+{
+    x.clear();
+    y.clear();
+    z.clear();
+    nx.clear();
+    ny.clear();
+    nz.clear();
+    cluster.clear();
+    r.clear();
+    g.clear();
+    b.clear();
+}
+
+int litSurfaces::push(const vertex &centroid, const vertex &normal, int _cluster, const vertex &base)
+{
+    x.push_back(centroid.x);
+    y.push_back(centroid.y);
+    z.push_back(centroid.z);
+    nx.push_back(normal.x);
+    ny.push_back(normal.y);
+    nz.push_back(normal.z);
+    cluster.push_back(_cluster);
+    r.push_back(base.x);
+    g.push_back(base.y);
+    b.push_back(base.z);
+    return int(x.size()) - 1;
+}
+
+// One light against a run of faces, positions and normals in p and q.
+// No calls or branches in here: clamps are written as selects and the square
+// root only stays inline without errno (see the Makefile), so the compiler
+// vectorizes it
+static void shadeRun(const float *__restrict px, const float *__restrict py, const float *__restrict pz,
+                     const float *__restrict qx, const float *__restrict qy, const float *__restrict qz,
+                     float *__restrict sumR, float *__restrict sumG, float *__restrict sumB, size_t count,
+                     float lx, float ly, float lz, float lr, float lg, float lb, float invRadius2,
+                     float sx, float sy, float sz, float scale, float offset)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        float dx = lx - px[i];
+        float dy = ly - py[i];
+        float dz = lz - pz[i];
+        float distance2 = dx * dx + dy * dy + dz * dz + 1e-8f;
+        float inverseDistance = 1.0f / sqrtf(distance2);
+        // Lambert, a smooth falloff that reaches zero at the radius, then the cone
+        float facing = (qx[i] * dx + qy[i] * dy + qz[i] * dz) * inverseDistance;
+        facing = facing > 0.0f ? facing : 0.0f;
+        float falloff = 1.0f - distance2 * invRadius2;
+        falloff = falloff > 0.0f ? falloff : 0.0f;
+        float spot = -(sx * dx + sy * dy + sz * dz) * inverseDistance * scale + offset;
+        spot = spot > 0.0f ? (spot < 1.0f ? spot : 1.0f) : 0.0f;
+        float weight = facing * falloff * falloff * spot;
+        sumR[i] += weight * lr;
+        sumG[i] += weight * lg;
+        sumB[i] += weight * lb;
+    }
+}
+
+LightClusters::LightClusters(int _tileSize, int _depthSlices)
+{
+    tileSize = _tileSize;
+    depthSlices = _depthSlices;
+}
+
+int LightClusters::sliceOf(float z) const
+{
+    // Exponential slices keep clusters roughly cube shaped at every depth
+    int slice = int(logf(z / nearPlane) * sliceScale);
+    return std::max(0, std::min(depthSlices - 1, slice));
+}
+
+void LightClusters::clusterRange(float lowX, float highX, float lowY, float highY, float nearZ, float farZ,
+                                 int &tileX0, int &tileX1, int &tileY0, int &tileY1, int &slice0, int &slice1) const
+{
+    // x / z is monotonic in both, so the corners of the view space box bound its projection
+    float ndcLowX = std::min(lowX / nearZ, lowX / farZ) * projectX;
+    float ndcHighX = std::max(highX / nearZ, highX / farZ) * projectX;
+    float ndcLowY = std::min(lowY / nearZ, lowY / farZ) * projectY;
+    float ndcHighY = std::max(highY / nearZ, highY / farZ) * projectY;
+
+    // Window y grows downwards, so the top of the box is the lowest tile row
+    tileX0 = std::max(0, std::min(tilesX - 1, int(floorf((ndcLowX + 1.0f) * 0.5f * width / tileSize))));
+    tileX1 = std::max(0, std::min(tilesX - 1, int(floorf((ndcHighX + 1.0f) * 0.5f * width / tileSize))));
+    tileY0 = std::max(0, std::min(tilesY - 1, int(floorf((1.0f - ndcHighY) * 0.5f * height / tileSize))));
+    tileY1 = std::max(0, std::min(tilesY - 1, int(floorf((1.0f - ndcLowY) * 0.5f * height / tileSize))));
+    slice0 = sliceOf(nearZ);
+    slice1 = sliceOf(farZ);
+}
+
+int LightClusters::clusterOf(const vertex &viewPosition) const
+{
+    // Depth is clamped the same way light bounds are, so positions before
+    // the near plane still land in a cluster that lists the lights around them
+    float z = std::max(nearPlane, std::min(farPlane, viewPosition.z));
+    int tileX0, tileX1, tileY0, tileY1, slice0, slice1;
+    clusterRange(viewPosition.x, viewPosition.x, viewPosition.y, viewPosition.y, z, z,
+                 tileX0, tileX1, tileY0, tileY1, slice0, slice1);
+    return (slice0 * tilesY + tileY0) * tilesX + tileX0;
+}
+
+void LightClusters::build(const std::vector<sceneLight> &lights, const matrix4 &viewMatrix, const matrix4 &projectionMatrix,
+                          float _nearPlane, float _farPlane, int _width, int _height)
+{
+    width = _width;
+    height = _height;
+    tilesX = (width + tileSize - 1) / tileSize;
+    tilesY = (height + tileSize - 1) / tileSize;
+    projectX = projectionMatrix.m[0][0];
+    projectY = projectionMatrix.m[1][1];
+    nearPlane = _nearPlane;
+    farPlane = _farPlane;
+    sliceScale = depthSlices / logf(farPlane / nearPlane);
+
+    // Cluster ranges of every light, then a count and a fill pass over them
+    int clusters = clusterCount();
+    std::vector<int> ranges(lights.size() * 6);
+    lightOffsets.assign(clusters + 1, 0);
+    for (size_t l = 0; l < lights.size(); l++)
+    {
+        const sceneLight &light = lights[l];
+        vertex center;
+        multiplyVM(light.position, center, viewMatrix);
+        float radius = light.radius;
+        // Spheres are clamped into the depth range rather than dropped, matching clusterOf
+        float nearZ = std::max(nearPlane, std::min(farPlane, center.z - radius));
+        float farZ = std::max(nearPlane, std::min(farPlane, center.z + radius));
+        int *range = &ranges[l * 6];
+        clusterRange(center.x - radius, center.x + radius, center.y - radius, center.y + radius, nearZ, farZ,
+                     range[0], range[1], range[2], range[3], range[4], range[5]);
+        for (int slice = range[4]; slice <= range[5]; slice++)
+            for (int tileY = range[2]; tileY <= range[3]; tileY++)
+                for (int tileX = range[0]; tileX <= range[1]; tileX++)
+                    lightOffsets[(slice * tilesY + tileY) * tilesX + tileX + 1]++;
+    }
+    for (int c = 0; c < clusters; c++)
+        lightOffsets[c + 1] += lightOffsets[c];
+
+    size_t total = lightOffsets[clusters];
+    for (frameVector<float> *channel : { &lightX, &lightY, &lightZ, &lightR, &lightG, &lightB, &inverseRadiusSquared,
+                                         &spotX, &spotY, &spotZ, &spotScale, &spotOffset })
+        channel->resize(total);
+
+    frameVector<Uint32> cursor(lightOffsets.begin(), lightOffsets.end() - 1);
+    for (size_t l = 0; l < lights.size(); l++)
+    {
+        const sceneLight &light = lights[l];
+        vertex direction = normalize(light.direction);
+        // Full brightness inside the inner cone, fading to nothing at the outer one.
+        // Point lights get a scale of 0 and an offset of 1, which is always fully lit
+        float scale = 0.0f;
+        float offset = 1.0f;
+        if (light.coneAngle < 180.0f)
+        {
+            float halfAngle = light.coneAngle * 0.5f / 180.0f * 3.14159f;
+            float outer = cosf(halfAngle);
+            float inner = cosf(halfAngle * (1.0f - light.softness));
+            scale = 1.0f / std::max(inner - outer, 1e-4f);
+            offset = -outer * scale;
+        }
+
+        const int *range = &ranges[l * 6];
+        for (int slice = range[4]; slice <= range[5]; slice++)
+            for (int tileY = range[2]; tileY <= range[3]; tileY++)
+                for (int tileX = range[0]; tileX <= range[1]; tileX++)
+                {
+                    Uint32 at = cursor[(slice * tilesY + tileY) * tilesX + tileX]++;
+                    lightX[at] = light.position.x;
+                    lightY[at] = light.position.y;
+                    lightZ[at] = light.position.z;
+                    lightR[at] = light.color.x;
+                    lightG[at] = light.color.y;
+                    lightB[at] = light.color.z;
+                    inverseRadiusSquared[at] = 1.0f / (light.radius * light.radius);
+                    spotX[at] = direction.x;
+                    spotY[at] = direction.y;
+                    spotZ[at] = direction.z;
+                    spotScale[at] = scale;
+                    spotOffset[at] = offset;
+                }
+    }
+}
+
+long long LightClusters::shade(litSurfaces &surfaces)
+{
+    int clusters = clusterCount();
+    size_t count = surfaces.size();
+    if (count == 0 || lightOffsets.size() != size_t(clusters + 1))
+        return 0;
+
+    // Counting sort of the faces by cluster
+    surfaceOffsets.assign(clusters + 1, 0);
+    for (size_t i = 0; i < count; i++)
+        surfaceOffsets[surfaces.cluster[i] + 1]++;
+    for (int c = 0; c < clusters; c++)
+        surfaceOffsets[c + 1] += surfaceOffsets[c];
+    order.resize(count);
+    for (size_t i = 0; i < count; i++)
+        order[surfaceOffsets[surfaces.cluster[i]]++] = int(i);
+    for (int c = clusters; c > 0; c--)
+        surfaceOffsets[c] = surfaceOffsets[c - 1];
+    surfaceOffsets[0] = 0;
+
+    long long tests = 0;
+    for (int c = 0; c < clusters; c++)
+    {
+        Uint32 lightBegin = lightOffsets[c];
+        Uint32 lightEnd = lightOffsets[c + 1];
+        Uint32 begin = surfaceOffsets[c];
+        Uint32 end = surfaceOffsets[c + 1];
+        if (lightBegin == lightEnd || begin == end)
+            continue;
+
+        // The cluster's faces side by side, padded to whole blocks with faces
+        // that have no normal and so pick up nothing
+        size_t n = end - begin;
+        size_t padded = (n + shadeLanes - 1) / shadeLanes * shadeLanes;
+        gathered.assign(padded * 9, 0.0f);
+        float *px = gathered.data();
+        float *py = px + padded;
+        float *pz = py + padded;
+        float *qx = pz + padded;
+        float *qy = qx + padded;
+        float *qz = qy + padded;
+        float *sumR = qz + padded;
+        float *sumG = sumR + padded;
+        float *sumB = sumG + padded;
+        for (size_t k = 0; k < n; k++)
+        {
+            int face = order[begin + k];
+            px[k] = surfaces.x[face];
+            py[k] = surfaces.y[face];
+            pz[k] = surfaces.z[face];
+            qx[k] = surfaces.nx[face];
+            qy[k] = surfaces.ny[face];
+            qz[k] = surfaces.nz[face];
+        }
+
+        for (Uint32 l = lightBegin; l < lightEnd; l++)
+            shadeRun(px, py, pz, qx, qy, qz, sumR, sumG, sumB, padded, lightX[l], lightY[l], lightZ[l],
+                     lightR[l], lightG[l], lightB[l], inverseRadiusSquared[l], spotX[l], spotY[l], spotZ[l],
+                     spotScale[l], spotOffset[l]);
+        tests += (long long)(lightEnd - lightBegin) * n;
+
+        for (size_t k = 0; k < n; k++)
+        {
+            int face = order[begin + k];
+            surfaces.r[face] += sumR[k];
+            surfaces.g[face] += sumG[k];
+            surfaces.b[face] += sumB[k];
+        }
+    }
+    return tests;
+}
@@ -0,0 +1,73 @@
+#include <SDL2/SDL.h>
+#include <vector>
+#include "graphicsEngine.h"
+
+#ifndef LIGHTCLUSTERS_H
+#define LIGHTCLUSTERS_H
+
+// Faces waiting to be lit, one entry per face. Separate arrays so the
+// lighting loop runs over plain floats
+struct litSurfaces
+{
+    frameVector<float> x, y, z;         // world space centroid
+    frameVector<float> nx, ny, nz;      // unit face normal
+    frameVector<int> cluster;
+    frameVector<float> r, g, b;         // light reaching the face, start value on the way in
+
+    void clear();
+    // Returns the index of the new face
+    int push(const vertex &centroid, const vertex &normal, int cluster, const vertex &base);
+    size_t size() const { return x.size(); }
+};
+
+// Screen tiles by exponential depth slices in view space. Each light is
+// listed in every cluster its sphere of influence touches, and a face is
+// only tested against the lights of the cluster its centroid falls in, so
+// the cost follows how many lights overlap locally rather than lights x faces
+class LightClusters
+{
+    public:
+        LightClusters(int _tileSize = 64, int _depthSlices = 16);
+        void build(const std::vector<sceneLight> &lights, const matrix4 &viewMatrix, const matrix4 &projectionMatrix,
+                   float nearPlane, float farPlane, int width, int height);
+        // Cluster of a view space position, clamped into the grid
+        int clusterOf(const vertex &viewPosition) const;
+        // Adds every light's contribution to the faces, returns the light and face pairs evaluated
+        long long shade(litSurfaces &surfaces);
+
+        int clusterCount() const { return tilesX * tilesY * depthSlices; }
+        // Lights listed across all clusters
+        size_t assignments() const { return lightX.size(); }
+
+    private:
+        void clusterRange(float lowX, float highX, float lowY, float highY, float nearZ, float farZ,
+                          int &tileX0, int &tileX1, int &tileY0, int &tileY1, int &slice0, int &slice1) const;
+        int sliceOf(float z) const;
+
+        int tileSize;
+        int depthSlices;
+        int tilesX = 0;
+        int tilesY = 0;
+        int width = 0;
+        int height = 0;
+        float projectX = 1.0f;
+        float projectY = 1.0f;
+        float nearPlane = 0.1f;
+        float farPlane = 1000.0f;
+        float sliceScale = 1.0f;
+
+        // Lights copied out in cluster order, so each cluster reads one contiguous run
+        frameVector<Uint32> lightOffsets;
+        frameVector<float> lightX, lightY, lightZ;
+        frameVector<float> lightR, lightG, lightB;
+        frameVector<float> inverseRadiusSquared;
+        frameVector<float> spotX, spotY, spotZ;
+        frameVector<float> spotScale, spotOffset;
+
+        // Faces gathered by cluster while shading
+        frameVector<Uint32> surfaceOffsets;
+        frameVector<int> order;
+        frameVector<float> gathered;
+};
+
+#endif
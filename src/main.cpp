@@ -1,10 +1,23 @@
 #include <SDL2/SDL.h>
 #include "graphicsEngine.h"
+#include "frameCapture.h"
+#include "inputHandler.h"
+#include "batchRenderer.h"
+#include "renderBackend.h"
+#include "meshStreaming.h"
+#include "meshBvh.h"
+#include "cameraPath.h"
+#include "stressScene.h"
 #include <iostream>
+#include <chrono>
+#include <memory>
+#include <fstream>
+#include <algorithm>
+#include <cmath>
 
-// g++ -o main main.cpp graphicsEngine.cpp fontRenderer.cpp -std=c++17 `sdl2-config --cflags --libs`
+// g++ -o main main.cpp graphicsEngine.cpp fontRenderer.cpp assetCache.cpp scene.cpp frameCapture.cpp inputHandler.cpp batchRenderer.cpp quantizedMesh.cpp animation.cpp workerPool.cpp memoryTracker.cpp textureAtlas.cpp meshOptimizer.cpp bspTree.cpp commandBuffer.cpp renderBackend.cpp meshStreaming.cpp textureLoader.cpp meshBvh.cpp lightClusters.cpp cameraPath.cpp stressScene.cpp particleSystem.cpp terrain.cpp -std=c++17 `sdl2-config --cflags --libs`
 
-int main()
+int main(int argc, char *argv[])
 {
     mesh cube;
     cube.triangles = {
@@ -47,18 +60,343 @@ int main()
 
     std::cout << "Hello, World!" << std::endl;
 
+    // main [scene] [--capture path] [--format raw|ppm|y4m] [--frames n] [--fps n]
+    //      --batch jobs [--output prefix] [--threads n]
+    //      --compress  keep meshes as 16 bit quantized positions and UVs
+    //      --optimize  keep meshes indexed, reordered for the vertex cache
+    //      --bsp       split static meshes into BSP trees, drawn in exact order without sorting
+    //      --memory    per subsystem memory on the HUD, and a summary on exit
+    //      --atlas [max]  pack the scene's textures into shared pages, halving any above max texels
+    //      --backend sdl|null  where frame commands go, null measures the pipeline alone
+    //      --record file  save each frame's commands while running
+    //      --replay file  draw recorded frames through the backend and time them
+    //      --chunk model.obj out.chunks [triangles]  split a model for streaming, then exit
+    //      --stream-budget mb  memory the streamed (.chunks) meshes in the scene may keep loaded between them
+    //      --texture-cache dir  keep textures converted to the renderer's format on disk
+    //      --pick      print what is under the mouse on each left click
+    //      --record-path file  save the camera and input of every frame
+    //      --replay-path file  fly a recorded path at a fixed timestep with input off, then exit
+    //      --frame-times file.csv  per frame timings, to compare builds on the same path
+    //      --frame-budget ms  keep geometry within a frame time, distant instances catch up over later frames
+    //      --views n   split the window between the camera and top, side and front views of the whole scene
+    //      --no-world-cache  redo every instance's world space triangles each frame, even when it hasn't moved
+    //      --stress settings  draw a generated scene instead, e.g. triangles=4e6,instances=256,depth=8 (see stressScene.h)
+    //      --stress-sweep file.csv [max triangles]  time each frame stage while moving one stress setting at a time, then exit
+    std::string sceneFile = "Scenes/default.scene";
+    std::string batchFile;
+    std::string batchOutput = "";
+    int batchThreads = 0;
+    MeshStorage meshStorage = MeshStorage::Float;
+    bool showMemory = false;
+    bool useAtlas = false;
+    int atlasMaxTexture = 0;
+    bool nullBackend = false;
+    bool timeBackend = false;
+    std::string recordFile;
+    std::string replayFile;
+    std::string chunkSource;
+    std::string chunkOutput;
+    int chunkTriangles = 4096;
+    size_t streamingBudget = 0;
+    std::string textureCache;
+    bool pickOnClick = false;
+    std::string recordPathFile;
+    std::string replayPathFile;
+    std::string frameTimesFile;
+    float frameBudget = 0.0f;
+    int viewCount = 1;
+    bool worldCache = true;
+    std::string stressSpec;
+    std::string stressSweepFile;
+    long long stressMaxTriangles = 4 * 1024 * 1024;
+    std::string capturePath;
+    CaptureFormat captureFormat = CaptureFormat::Y4M;
+    int captureFrames = 0;
+    int captureFps = 30;
+    for (int arg = 1; arg < argc; arg++)
+    {
+        std::string option = argv[arg];
+        bool hasValue = arg + 1 < argc;
+        if (option == "--capture" && hasValue)
+            capturePath = argv[++arg];
+        else if (option == "--format" && hasValue)
+        {
+            std::string name = argv[++arg];
+            if (name == "raw")
+                captureFormat = CaptureFormat::RawRGBA;
+            else if (name == "ppm")
+                captureFormat = CaptureFormat::PPM;
+            else
+                captureFormat = CaptureFormat::Y4M;
+        }
+        else if (option == "--frames" && hasValue)
+            captureFrames = std::stoi(argv[++arg]);
+        else if (option == "--fps" && hasValue)
+            captureFps = std::stoi(argv[++arg]);
+        else if (option == "--batch" && hasValue)
+            batchFile = argv[++arg];
+        else if (option == "--output" && hasValue)
+            batchOutput = argv[++arg];
+        else if (option == "--threads" && hasValue)
+            batchThreads = std::stoi(argv[++arg]);
+        else if (option == "--compress")
+            meshStorage = MeshStorage::Quantized;
+        else if (option == "--optimize")
+            meshStorage = MeshStorage::Indexed;
+        else if (option == "--bsp")
+            meshStorage = MeshStorage::Bsp;
+        else if (option == "--memory")
+            showMemory = true;
+        else if (option == "--atlas")
+        {
+            useAtlas = true;
+            if (hasValue && isdigit(argv[arg + 1][0]))
+                atlasMaxTexture = std::stoi(argv[++arg]);
+        }
+        else if (option == "--backend" && hasValue)
+        {
+            nullBackend = std::string(argv[++arg]) == "null";
+            timeBackend = true;
+        }
+        else if (option == "--record" && hasValue)
+            recordFile = argv[++arg];
+        else if (option == "--replay" && hasValue)
+            replayFile = argv[++arg];
+        else if (option == "--chunk" && arg + 2 < argc)
+        {
+            chunkSource = argv[++arg];
+            chunkOutput = argv[++arg];
+            if (arg + 1 < argc && isdigit(argv[arg + 1][0]))
+                chunkTriangles = std::stoi(argv[++arg]);
+        }
+        else if (option == "--stream-budget" && hasValue)
+            streamingBudget = size_t(std::stoi(argv[++arg])) * 1024 * 1024;
+        else if (option == "--texture-cache" && hasValue)
+            textureCache = argv[++arg];
+        else if (option == "--pick")
+            pickOnClick = true;
+        else if (option == "--record-path" && hasValue)
+            recordPathFile = argv[++arg];
+        else if (option == "--replay-path" && hasValue)
+            replayPathFile = argv[++arg];
+        else if (option == "--frame-times" && hasValue)
+            frameTimesFile = argv[++arg];
+        else if (option == "--frame-budget" && hasValue)
+            frameBudget = std::stof(argv[++arg]);
+        else if (option == "--views" && hasValue)
+            viewCount = std::max(1, std::atoi(argv[++arg]));
+        else if (option == "--no-world-cache")
+            worldCache = false;
+        else if (option == "--stress" && hasValue)
+            stressSpec = argv[++arg];
+        else if (option == "--stress-sweep" && hasValue)
+        {
+            stressSweepFile = argv[++arg];
+            if (arg + 1 < argc && isdigit(argv[arg + 1][0]))
+                stressMaxTriangles = (long long)std::atof(argv[++arg]);
+        }
+        else
+            sceneFile = option;
+    }
+
+    if (!chunkSource.empty())
+    {
+        return convertObjToChunks(chunkSource, chunkOutput, chunkTriangles) ? 0 : 1;
+    }
+
+    // Batch mode renders offscreen only, no window is opened
+    if (!batchFile.empty())
+    {
+        std::vector<batchJob> jobs;
+        if (!loadBatchFile(batchFile, jobs))
+        {
+            return 1;
+        }
+        BatchRenderer batch(jobs, batchOutput, batchThreads);
+        return batch.run() ? 0 : 1;
+    }
+
     SDL_Window *window;
     SDL_Renderer *renderer;
     window = SDL_CreateWindow("3D Graphics Engine", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, 960, 540, 0);
     renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_TARGETTEXTURE);
 
-    std::vector<mesh> models(2);
+    int windowWidth, windowHeight;
+    SDL_GetWindowSize(window, &windowWidth, &windowHeight);
 
-    Renderer frameRenderer(window, renderer, models);
-    frameRenderer.loadObjFile("Models/cube.obj", 0);
-    frameRenderer.loadObjTextureFile("Models/skeleton.obj", "Textures/skeleton.bmp", 1);
+    // Replay draws recorded commands only, no scene is loaded
+    if (!replayFile.empty())
+    {
+        bool replayed = false;
+        {
+        AssetCache replayAssets(renderer);
+        FontRenderer font(renderer, "Textures/font.bmp");
+        SDLBackend sdlBackend(renderer, &font);
+        NullBackend discard;
+        RenderBackend *backend = nullBackend ? static_cast<RenderBackend*>(&discard) : &sdlBackend;
+        CommandReplay replay(replayFile, replayAssets);
+        if (replay.isOpen())
+        {
+            CommandBuffer commands;
+            int replayFrames = 0;
+            double submitSeconds = 0.0;
+            while (!SDL_QuitRequested() && replay.readFrame(commands))
+            {
+                auto submitStart = std::chrono::high_resolution_clock::now();
+                backend->submit(commands);
+                backend->present();
+                submitSeconds += std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - submitStart).count();
+                replayFrames++;
+            }
+            std::cout << "Replayed " << replayFrames << " frames, " << (replayFrames ? submitSeconds * 1000.0 / replayFrames : 0.0)
+                      << " ms per frame in the backend" << std::endl;
+            replayed = true;
+        }
+        }
+        SDL_DestroyRenderer(renderer);
+        SDL_DestroyWindow(window);
+        SDL_Quit();
+        return replayed ? 0 : 1;
+    }
+
+    // Scoped so the renderer releases its textures before the SDL renderer is destroyed.
+    // Failures break out of it to the teardown below
+    int exitCode = 0;
+    do
+    {
+    Renderer frameRenderer(renderer, windowWidth, windowHeight);
+    InputHandler input(window);
+    bool controlCamera = false;
+    frameRenderer.setMeshStorage(meshStorage);
+    frameRenderer.setShowMemory(showMemory);
+    frameRenderer.setTextureAtlas(useAtlas, atlasMaxTexture);
+    frameRenderer.setFrameBudget(frameBudget);
+    frameRenderer.setWorldCache(worldCache);
+    if (streamingBudget > 0)
+        frameRenderer.setStreamingBudget(streamingBudget);
+    if (!textureCache.empty())
+        frameRenderer.getAssets().setTextureCacheDirectory(textureCache);
+    stressSettings stress;
+    if (!stressSpec.empty() && !parseStressSettings(stressSpec, stress))
+    {
+        exitCode = 1;
+        break;
+    }
+    bool generated = !stressSpec.empty() || !stressSweepFile.empty();
+    if (generated ? !frameRenderer.loadStressScene(stress) : !frameRenderer.loadScene(sceneFile))
+    {
+        exitCode = 1;
+        break;
+    }
     //frameRenderer.loadObjTextureFile("./Models/snorkelWithTextures.obj", "./Textures/snorkel.bmp", 0);
-    frameRenderer.setControlCamera(false);
+    frameRenderer.setControlCamera(controlCamera);
+    if (viewCount > 1)
+    {
+        // As square a grid as fits them, the kinds taking turns from the camera on
+        int columns = int(ceil(sqrt(double(viewCount))));
+        int rows = (viewCount + columns - 1) / columns;
+        std::vector<renderView> layout(viewCount);
+        for (int i = 0; i < viewCount; i++)
+        {
+            int column = i % columns;
+            int row = i / columns;
+            layout[i].kind = ViewKind(i % 4);
+            layout[i].rect = { column * windowWidth / columns, row * windowHeight / rows,
+                               (column + 1) * windowWidth / columns - column * windowWidth / columns,
+                               (row + 1) * windowHeight / rows - row * windowHeight / rows };
+        }
+        frameRenderer.setViews(layout);
+        if (frameBudget > 0.0f)
+            std::cout << "Frame budget is ignored with more than one view" << std::endl;
+    }
+
+    // Offline capture steps time by a fixed amount per frame instead of the wall clock,
+    // so the output is the same no matter how fast frames are produced
+    std::unique_ptr<FrameCapture> capture;
+    if (!capturePath.empty())
+    {
+        capture = std::make_unique<FrameCapture>(capturePath, captureFormat, windowWidth, windowHeight, captureFps);
+        if (!capture->isOpen())
+        {
+            exitCode = 1;
+            break;
+        }
+        frameRenderer.setFrameCapture(capture.get());
+        frameRenderer.setFixedTimestep(1.0f / captureFps);
+    }
+    auto captureStart = std::chrono::high_resolution_clock::now();
+
+    // A replayed path sees the same frames every run: the camera comes from the
+    // file and time steps by a fixed amount, the capture rate if capturing
+    std::unique_ptr<CameraPathPlayer> pathPlayer;
+    std::unique_ptr<CameraPathRecorder> pathRecorder;
+    if (!replayPathFile.empty())
+    {
+        pathPlayer = std::make_unique<CameraPathPlayer>(replayPathFile);
+        if (!pathPlayer->isOpen())
+        {
+            exitCode = 1;
+            break;
+        }
+        if (!capture)
+            frameRenderer.setFixedTimestep(1.0f / 60.0f);
+    }
+    else if (!recordPathFile.empty())
+    {
+        pathRecorder = std::make_unique<CameraPathRecorder>(recordPathFile);
+        if (!pathRecorder->isOpen())
+        {
+            exitCode = 1;
+            break;
+        }
+    }
+    std::ofstream frameTimes;
+    if (!frameTimesFile.empty())
+    {
+        frameTimes.open(frameTimesFile, std::ios::trunc);
+        if (!frameTimes.is_open())
+        {
+            std::cout << "Failed to open frame times: " << frameTimesFile << std::endl;
+            exitCode = 1;
+            break;
+        }
+        frameTimes << "frame,record_ms,submit_ms,frame_ms" << std::endl;
+    }
+    double frameSeconds = 0.0;
+    double slowestFrame = 0.0;
+
+    NullBackend discard;
+    RenderBackend *backend = NULL;
+    if (nullBackend)
+        backend = &discard;
+    std::unique_ptr<FileBackend> recorder;
+    if (!recordFile.empty())
+    {
+        // Passes frames on, to SDL unless the null backend was asked for
+        recorder = std::make_unique<FileBackend>(recordFile, frameRenderer.getAssets(), backend);
+        if (!recorder->isOpen())
+        {
+            exitCode = 1;
+            break;
+        }
+        backend = recorder.get();
+        timeBackend = true;
+    }
+    frameRenderer.setBackend(backend);
+    if (!stressSweepFile.empty())
+    {
+        bool swept = runStressSweep(frameRenderer, stress, stressMaxTriangles, stressSweepFile);
+        frameRenderer.setBackend(NULL);
+        exitCode = swept ? 0 : 1;
+        break;
+    }
+    double recordSeconds = 0.0;
+    double submitSeconds = 0.0;
+    int timedFrames = 0;
+    long long lightTests = 0;
+    long long staleInstances = 0;
+    long long worldRebuilds = 0;
+    bool mouseWasDown = false;
 
     bool running = true;
     auto lastTime = std::chrono::high_resolution_clock::now();
@@ -82,13 +420,116 @@ int main()
             lastTime = currentTime;
         }
 
+        cameraPathFrame pathFrame;
+        if (pathPlayer)
+        {
+            if (!pathPlayer->next(pathFrame))
+            {
+                running = false;
+                break;
+            }
+            frameRenderer.getCamera() = pathFrame.cam;
+        }
+        else
+        {
+            pathFrame.input = input.poll(controlCamera);
+            pathFrame.time = frameRenderer.getFrameTime();
+            if (!InputHandler::apply(pathFrame.input, frameRenderer.getCamera(), pathFrame.time))
+            {
+                running = false;
+                break;
+            }
+            pathFrame.cam = frameRenderer.getCamera();
+            if (pathRecorder)
+                pathRecorder->record(pathFrame);
+        }
+
         //frameRenderer.renderFrame();
+        auto frameStart = std::chrono::high_resolution_clock::now();
+        memoryBeginFrame();
         frameRenderer.frameRender();
+        double frameTime = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - frameStart).count();
+        frameSeconds += frameTime;
+        slowestFrame = std::max(slowestFrame, frameTime);
+        if (frameTimes.is_open())
+            frameTimes << timedFrames << "," << frameRenderer.getRecordTime() * 1000.0f << "," << frameRenderer.getSubmitTime() * 1000.0f
+                       << "," << frameTime * 1000.0 << "\n";
+        recordSeconds += frameRenderer.getRecordTime();
+        submitSeconds += frameRenderer.getSubmitTime();
+        lightTests += frameRenderer.getLightTests();
+        staleInstances += frameRenderer.getStaleInstances();
+        worldRebuilds += frameRenderer.getWorldRebuilds();
+        timedFrames++;
+
+        if (pickOnClick)
+        {
+            int mouseX, mouseY;
+            bool mouseDown = (SDL_GetMouseState(&mouseX, &mouseY) & SDL_BUTTON(SDL_BUTTON_LEFT)) != 0;
+            if (mouseDown && !mouseWasDown)
+            {
+                rayHit hit;
+                auto pickStart = std::chrono::high_resolution_clock::now();
+                bool picked = frameRenderer.pick(mouseX, mouseY, hit);
+                std::chrono::duration<double, std::micro> pickTime = std::chrono::high_resolution_clock::now() - pickStart;
+                if (picked)
+                    std::cout << "Picked instance " << hit.instance << " triangle " << hit.triangle << " at distance " << hit.distance
+                              << ", uv " << hit.uv.u << " " << hit.uv.v << " (" << pickTime.count() << " us)" << std::endl;
+                else
+                    std::cout << "Nothing under the mouse (" << pickTime.count() << " us)" << std::endl;
+            }
+            mouseWasDown = mouseDown;
+        }
+
+        if (capture && captureFrames > 0 && capture->framesCaptured() >= captureFrames)
+        {
+            running = false;
+        }
     }
 
-    SDL_DestroyWindow(window);
+    if (capture)
+    {
+        capture->finish();
+        std::chrono::duration<double> captureTime = std::chrono::high_resolution_clock::now() - captureStart;
+        capture->printStats();
+        std::cout << "  " << capture->framesCaptured() / captureTime.count() << " frames/s end to end" << std::endl;
+        frameRenderer.setFrameCapture(NULL);
+    }
+    if (timeBackend && timedFrames > 0)
+    {
+        std::cout << timedFrames << " frames, " << recordSeconds * 1000.0 / timedFrames << " ms recording, "
+                  << submitSeconds * 1000.0 / timedFrames << " ms in the backend per frame" << std::endl;
+        if (recorder)
+            std::cout << "  " << recorder->framesWritten() << " frames saved to " << recordFile << std::endl;
+    }
+    if (pathPlayer && timedFrames > 0)
+        std::cout << "Replayed " << timedFrames << " of " << pathPlayer->frameCount() << " path frames, "
+                  << frameSeconds * 1000.0 / timedFrames << " ms per frame, slowest " << slowestFrame * 1000.0 << " ms" << std::endl;
+    if (pathRecorder)
+        std::cout << pathRecorder->framesWritten() << " frames of camera path saved to " << recordPathFile << std::endl;
+    if (frameRenderer.getLightCount() > 0 && timedFrames > 0)
+        std::cout << frameRenderer.getLightCount() << " lights, " << lightTests / timedFrames
+                  << " light and face pairs shaded per frame" << std::endl;
+    if (frameRenderer.getParticleCount() > 0)
+        std::cout << frameRenderer.getParticleCount() << " particles alive at exit" << std::endl;
+    int terrainDrawn, terrainBuilt;
+    long long terrainTriangles;
+    frameRenderer.getTerrainChunks(terrainDrawn, terrainBuilt, terrainTriangles);
+    if (terrainBuilt > 0)
+        std::cout << "Terrain: " << terrainDrawn << " chunks, at most " << terrainTriangles << " triangles in the last frame, "
+                  << terrainBuilt << " chunks built" << std::endl;
+    if (frameBudget > 0.0f && timedFrames > 0)
+        std::cout << "Frame budget " << frameBudget << " ms, " << double(staleInstances) / timedFrames
+                  << " instances per frame drawn from earlier frames" << std::endl;
+    if (worldCache && timedFrames > 0)
+        std::cout << double(worldRebuilds) / timedFrames << " instances per frame moved and had their world space geometry rebuilt" << std::endl;
+    frameRenderer.setBackend(NULL);
+    if (showMemory)
+        printMemoryReport();
+    } while (false);
+
     SDL_DestroyRenderer(renderer);
+    SDL_DestroyWindow(window);
     SDL_Quit();
 
-    return 0;
-}
\ No newline at end of file
+    return exitCode;
+}
@@ -0,0 +1,78 @@
+#include "memoryTracker.h"
+#include <atomic>
+#include <iostream>
+
+struct tagCounters
+{
+    std::atomic<long long> liveBytes{0};
+    std::atomic<long long> peakBytes{0};
+    std::atomic<long long> allocations{0};
+    std::atomic<long long> frameAllocations{0};
+    std::atomic<long long> lastFrameAllocations{0};
+    std::atomic<long long> deepCopies{0};
+    std::atomic<long long> deepCopyBytes{0};
+};
+
+static tagCounters counters[int(MemoryTag::Count)];
+static const char *tagNames[int(MemoryTag::Count)] = { "Meshes", "Textures", "Frame buffers", "Text", "Particles" };
+
+void trackAllocation(MemoryTag tag, size_t bytes)
+{
+    tagCounters &c = counters[int(tag)];
+    long long live = c.liveBytes += bytes;
+    c.allocations++;
+    c.frameAllocations++;
+
+    long long peak = c.peakBytes;
+    while (live > peak && !c.peakBytes.compare_exchange_weak(peak, live))
+    {
+    }
+}
+
+void trackFree(MemoryTag tag, size_t bytes)
+{
+    counters[int(tag)].liveBytes -= bytes;
+}
+
+void trackDeepCopy(MemoryTag tag, size_t bytes, const char *what)
+{
+    tagCounters &c = counters[int(tag)];
+    // Only the first few are printed, the counters keep the full picture
+    if (c.deepCopies++ < 5)
+    {
+        std::cout << "Deep copy of " << what << " (" << bytes / 1024 << " KB)" << std::endl;
+    }
+    c.deepCopyBytes += bytes;
+}
+
+void memoryBeginFrame()
+{
+    for (auto &c : counters)
+    {
+        c.lastFrameAllocations = c.frameAllocations.exchange(0);
+    }
+}
+
+std::vector<memoryTagStats> memoryReport()
+{
+    std::vector<memoryTagStats> report;
+    for (int i = 0; i < int(MemoryTag::Count); i++)
+    {
+        const tagCounters &c = counters[i];
+        report.push_back({ tagNames[i], c.liveBytes, c.peakBytes, c.allocations, c.lastFrameAllocations, c.deepCopies, c.deepCopyBytes });
+    }
+    return report;
+}
+
+void printMemoryReport()
+{
+    std::cout << "Memory:" << std::endl;
+    for (const auto &stats : memoryReport())
+    {
+        std::cout << "  " << stats.name << ": " << stats.liveBytes / 1024 << " KB live, " << stats.peakBytes / 1024 << " KB peak, "
+                  << stats.allocations << " allocations (" << stats.frameAllocations << " last frame)";
+        if (stats.deepCopies > 0)
+            std::cout << ", " << stats.deepCopies << " deep copies (" << stats.deepCopyBytes / 1024 << " KB)";
+        std::cout << std::endl;
+    }
+}
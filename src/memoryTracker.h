@@ -0,0 +1,84 @@
+#include <cstddef>
+#include <new>
+#include <string>
+#include <vector>
+
+#ifndef MEMORYTRACKER_H
+#define MEMORYTRACKER_H
+
+// What a tracked allocation is for
+enum class MemoryTag
+{
+    Meshes,
+    Textures,
+    FrameBuffers,
+    Text,
+    Particles,
+    Count
+};
+
+struct memoryTagStats
+{
+    const char *name;
+    long long liveBytes;
+    long long peakBytes;
+    long long allocations;          // since start
+    long long frameAllocations;     // during the last complete frame
+    long long deepCopies;
+    long long deepCopyBytes;
+};
+
+// Counters are global and atomic, so allocations from worker threads and from
+// several renderers all land in the same totals
+void trackAllocation(MemoryTag tag, size_t bytes);
+void trackFree(MemoryTag tag, size_t bytes);
+// Flags a copy that should have been a shared reference or a move
+void trackDeepCopy(MemoryTag tag, size_t bytes, const char *what);
+// Closes the per frame allocation count. The counters are shared by every
+// renderer, so only the loop presenting frames calls this, once before each one
+void memoryBeginFrame();
+std::vector<memoryTagStats> memoryReport();
+void printMemoryReport();
+
+// std allocator that reports to the counters above under a fixed tag
+template <class T, MemoryTag tag>
+struct TrackedAllocator
+{
+    typedef T value_type;
+
+    template <class U>
+    struct rebind
+    {
+        typedef TrackedAllocator<U, tag> other;
+    };
+
+    TrackedAllocator() = default;
+    template <class U>
+    TrackedAllocator(const TrackedAllocator<U, tag> &) {}
+
+    T *allocate(size_t n)
+    {
+        trackAllocation(tag, n * sizeof(T));
+        return static_cast<T*>(::operator new(n * sizeof(T)));
+    }
+
+    void deallocate(T *p, size_t n)
+    {
+        trackFree(tag, n * sizeof(T));
+        ::operator delete(p);
+    }
+};
+
+template <class T, class U, MemoryTag tag>
+bool operator==(const TrackedAllocator<T, tag> &, const TrackedAllocator<U, tag> &) { return true; }
+template <class T, class U, MemoryTag tag>
+bool operator!=(const TrackedAllocator<T, tag> &, const TrackedAllocator<U, tag> &) { return false; }
+
+template <class T>
+using meshVector = std::vector<T, TrackedAllocator<T, MemoryTag::Meshes>>;
+template <class T>
+using frameVector = std::vector<T, TrackedAllocator<T, MemoryTag::FrameBuffers>>;
+template <class T>
+using particleVector = std::vector<T, TrackedAllocator<T, MemoryTag::Particles>>;
+
+#endif
@@ -0,0 +1,338 @@
+#include <SDL2/SDL.h>
+#include "meshBvh.h"
+#include <cmath>
+#include <algorithm>
+
+// Binned SAH: candidates are bin boundaries rather than every triangle,
+// which keeps the build linear per level at little cost in tree quality
+static const int sahBins = 16;
+// Relative cost of visiting a node against testing one triangle
+static const float traversalCost = 1.0f;
+static const int maxLeafTriangles = 8;
+// Deeper than this nodes are split at the median instead, which at least
+// halves them, so no tree goes past 64 + 31 levels whatever the geometry
+static const int maxSahDepth = 64;
+// The traversal stack never holds more than one entry per level
+static const int maxTraversalDepth = 128;
+
+struct bvhBuildEntry
+{
+    int node;
+    int begin;
+    int end;
+    int depth;
+};
+
+static void growBounds(vertex &boundsMin, vertex &boundsMax, const vertex &p)
+{
+    boundsMin = { std::min(boundsMin.x, p.x), std::min(boundsMin.y, p.y), std::min(boundsMin.z, p.z) };
+    boundsMax = { std::max(boundsMax.x, p.x), std::max(boundsMax.y, p.y), std::max(boundsMax.z, p.z) };
+}
+
+static float surfaceArea(const vertex &boundsMin, const vertex &boundsMax)
+{
+    vertex e = subtractV(boundsMax, boundsMin);
+    if (e.x < 0.0f || e.y < 0.0f || e.z < 0.0f)
+        return 0.0f;
+    return 2.0f * (e.x * e.y + e.y * e.z + e.z * e.x);
+}
+
+static float axisOf(const vertex &v, int axis)
+{
+    return axis == 0 ? v.x : (axis == 1 ? v.y : v.z);
+}
+
+void buildMeshBvh(const mesh &m, meshBvh &bvh)
+{
+    buildMeshBvh(m.triangles.data(), int(m.triangles.size()), true, bvh);
+}
+
+void buildMeshBvh(const triangle *triangles, int count, bool keepUVs, meshBvh &bvh)
+{
+    bvh.nodes.clear();
+    bvh.triangles.clear();
+    bvh.uvs.clear();
+    bvh.sourceIndex.clear();
+    if (count == 0)
+        return;
+
+    std::vector<vertex> centroids(count);
+    std::vector<int> order(count);
+    for (int i = 0; i < count; i++)
+    {
+        const triangle &tri = triangles[i];
+        centroids[i] = scaleV(addV(addV(tri.v[0], tri.v[1]), tri.v[2]), 1.0f / 3.0f);
+        order[i] = i;
+    }
+
+    const float infinity = 1e30f;
+    bvh.nodes.push_back({});
+    std::vector<bvhBuildEntry> stack = { { 0, 0, count, 1 } };
+    while (!stack.empty())
+    {
+        bvhBuildEntry entry = stack.back();
+        stack.pop_back();
+        int n = entry.end - entry.begin;
+
+        vertex boundsMin = { infinity, infinity, infinity };
+        vertex boundsMax = { -infinity, -infinity, -infinity };
+        vertex centroidMin = boundsMin;
+        vertex centroidMax = boundsMax;
+        for (int i = entry.begin; i < entry.end; i++)
+        {
+            const triangle &tri = triangles[order[i]];
+            for (const vertex &v : tri.v)
+                growBounds(boundsMin, boundsMax, v);
+            growBounds(centroidMin, centroidMax, centroids[order[i]]);
+        }
+        bvh.nodes[entry.node].boundsMin = boundsMin;
+        bvh.nodes[entry.node].boundsMax = boundsMax;
+
+        // Best bin boundary over all three axes
+        int bestAxis = -1;
+        int bestSplit = 0;
+        float bestCost = infinity;
+        bool median = entry.depth > maxSahDepth;
+        if (n > 2 && !median)
+        {
+            for (int axis = 0; axis < 3; axis++)
+            {
+                float low = axisOf(centroidMin, axis);
+                float extent = axisOf(centroidMax, axis) - low;
+                if (extent <= 0.0f)
+                    continue;
+                float scale = sahBins / extent;
+
+                int binCount[sahBins] = { 0 };
+                vertex binMin[sahBins];
+                vertex binMax[sahBins];
+                for (int b = 0; b < sahBins; b++)
+                {
+                    binMin[b] = { infinity, infinity, infinity };
+                    binMax[b] = { -infinity, -infinity, -infinity };
+                }
+                for (int i = entry.begin; i < entry.end; i++)
+                {
+                    int b = std::min(sahBins - 1, int((axisOf(centroids[order[i]], axis) - low) * scale));
+                    binCount[b]++;
+                    for (const vertex &v : triangles[order[i]].v)
+                        growBounds(binMin[b], binMax[b], v);
+                }
+
+                // Sweep from the right to get each suffix's area, then from the left
+                float rightArea[sahBins];
+                int rightCount[sahBins];
+                vertex sweepMin = { infinity, infinity, infinity };
+                vertex sweepMax = { -infinity, -infinity, -infinity };
+                int sweepCount = 0;
+                for (int b = sahBins - 1; b > 0; b--)
+                {
+                    // Empty bins still hold inverted bounds that would blow the sweep up
+                    if (binCount[b])
+                    {
+                        growBounds(sweepMin, sweepMax, binMin[b]);
+                        growBounds(sweepMin, sweepMax, binMax[b]);
+                    }
+                    sweepCount += binCount[b];
+                    rightArea[b] = sweepCount ? surfaceArea(sweepMin, sweepMax) : 0.0f;
+                    rightCount[b] = sweepCount;
+                }
+                sweepMin = { infinity, infinity, infinity };
+                sweepMax = { -infinity, -infinity, -infinity };
+                sweepCount = 0;
+                for (int b = 0; b < sahBins - 1; b++)
+                {
+                    if (binCount[b])
+                    {
+                        growBounds(sweepMin, sweepMax, binMin[b]);
+                        growBounds(sweepMin, sweepMax, binMax[b]);
+                    }
+                    sweepCount += binCount[b];
+                    if (sweepCount == 0 || rightCount[b + 1] == 0)
+                        continue;
+                    float cost = surfaceArea(sweepMin, sweepMax) * sweepCount + rightArea[b + 1] * rightCount[b + 1];
+                    if (cost < bestCost)
+                    {
+                        bestCost = cost;
+                        bestAxis = axis;
+                        bestSplit = b + 1;
+                    }
+                }
+            }
+        }
+
+        // Split only when it is expected to beat testing every triangle here.
+        // Large nodes always split, unless every centroid sits in one spot
+        float nodeArea = surfaceArea(boundsMin, boundsMax);
+        bool split = bestAxis >= 0 && (n > maxLeafTriangles || traversalCost + bestCost / std::max(nodeArea, 1e-20f) < float(n));
+        split = split || (median && n > maxLeafTriangles);
+
+        if (!split)
+        {
+            bvh.nodes[entry.node].first = int(bvh.triangles.size());
+            bvh.nodes[entry.node].count = n;
+            for (int i = entry.begin; i < entry.end; i++)
+            {
+                const triangle &tri = triangles[order[i]];
+                bvh.triangles.push_back({ tri.v[0], subtractV(tri.v[1], tri.v[0]), subtractV(tri.v[2], tri.v[0]) });
+                if (keepUVs)
+                    bvh.uvs.insert(bvh.uvs.end(), tri.t, tri.t + 3);
+                bvh.sourceIndex.push_back(order[i]);
+            }
+            continue;
+        }
+
+        int middle;
+        if (median)
+        {
+            // Along the longest centroid extent, even if they all sit in one spot
+            vertex extent = subtractV(centroidMax, centroidMin);
+            int axis = extent.x >= extent.y && extent.x >= extent.z ? 0 : (extent.y >= extent.z ? 1 : 2);
+            middle = entry.begin + n / 2;
+            std::nth_element(order.begin() + entry.begin, order.begin() + middle, order.begin() + entry.end, [&](int a, int b)
+            {
+                return axisOf(centroids[a], axis) < axisOf(centroids[b], axis);
+            });
+        }
+        else
+        {
+            float low = axisOf(centroidMin, bestAxis);
+            float scale = sahBins / (axisOf(centroidMax, bestAxis) - low);
+            middle = int(std::partition(order.begin() + entry.begin, order.begin() + entry.end, [&](int index)
+            {
+                return std::min(sahBins - 1, int((axisOf(centroids[index], bestAxis) - low) * scale)) < bestSplit;
+            }) - order.begin());
+        }
+
+        int left = int(bvh.nodes.size());
+        bvh.nodes[entry.node].first = left;
+        bvh.nodes[entry.node].count = 0;
+        bvh.nodes.push_back({});
+        bvh.nodes.push_back({});
+        stack.push_back({ left + 1, middle, entry.end, entry.depth + 1 });
+        stack.push_back({ left, entry.begin, middle, entry.depth + 1 });
+    }
+}
+
+// Entry distance of the ray into a box, or infinity when it misses within limit
+static float rayBox(const bvhNode &node, const vertex &origin, const vertex &inverse, float limit)
+{
+    float tx1 = (node.boundsMin.x - origin.x) * inverse.x;
+    float tx2 = (node.boundsMax.x - origin.x) * inverse.x;
+    float tmin = std::min(tx1, tx2);
+    float tmax = std::max(tx1, tx2);
+    float ty1 = (node.boundsMin.y - origin.y) * inverse.y;
+    float ty2 = (node.boundsMax.y - origin.y) * inverse.y;
+    tmin = std::max(tmin, std::min(ty1, ty2));
+    tmax = std::min(tmax, std::max(ty1, ty2));
+    float tz1 = (node.boundsMin.z - origin.z) * inverse.z;
+    float tz2 = (node.boundsMax.z - origin.z) * inverse.z;
+    tmin = std::max(tmin, std::min(tz1, tz2));
+    tmax = std::min(tmax, std::max(tz1, tz2));
+    if (tmax >= std::max(tmin, 0.0f) && tmin < limit)
+        return tmin;
+    return 1e30f;
+}
+
+bool intersectMeshBvh(const meshBvh &bvh, const vertex &origin, const vertex &direction, rayHit &hit)
+{
+    if (bvh.nodes.empty())
+        return false;
+
+    vertex inverse = { 1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z };
+    int found = -1;
+    float closest = hit.distance;
+    float hitU = 0.0f;
+    float hitV = 0.0f;
+
+    int stack[maxTraversalDepth];
+    int depth = 0;
+    if (rayBox(bvh.nodes[0], origin, inverse, closest) >= 1e30f)
+        return false;
+    stack[depth++] = 0;
+    while (depth > 0)
+    {
+        const bvhNode &node = bvh.nodes[stack[--depth]];
+        if (node.count > 0)
+        {
+            // Möller-Trumbore, both faces count
+            for (int i = node.first; i < node.first + node.count; i++)
+            {
+                const bvhTriangle &tri = bvh.triangles[i];
+                vertex p = crossProduct(direction, tri.edge2);
+                float det = dotProduct(tri.edge1, p);
+                if (fabsf(det) < 1e-12f)
+                    continue;
+                float invDet = 1.0f / det;
+                vertex s = subtractV(origin, tri.v0);
+                float u = dotProduct(s, p) * invDet;
+                if (u < 0.0f || u > 1.0f)
+                    continue;
+                vertex q = crossProduct(s, tri.edge1);
+                float v = dotProduct(direction, q) * invDet;
+                if (v < 0.0f || u + v > 1.0f)
+                    continue;
+                float t = dotProduct(tri.edge2, q) * invDet;
+                if (t > 0.0f && t < closest)
+                {
+                    closest = t;
+                    found = i;
+                    hitU = u;
+                    hitV = v;
+                }
+            }
+            continue;
+        }
+
+        // Nearer child on top so its hits shrink the range before the other is tried
+        float nearT = rayBox(bvh.nodes[node.first], origin, inverse, closest);
+        float farT = rayBox(bvh.nodes[node.first + 1], origin, inverse, closest);
+        int nearChild = node.first;
+        int farChild = node.first + 1;
+        if (farT < nearT)
+        {
+            std::swap(nearT, farT);
+            std::swap(nearChild, farChild);
+        }
+        if (farT < 1e30f)
+            stack[depth++] = farChild;
+        if (nearT < 1e30f)
+            stack[depth++] = nearChild;
+    }
+
+    if (found < 0)
+        return false;
+    hit.triangle = bvh.sourceIndex[found];
+    hit.distance = closest;
+    hit.u = hitU;
+    hit.v = hitV;
+    hit.uv = { 0.0f, 0.0f };
+    if (!bvh.uvs.empty())
+    {
+        const coord *uv = &bvh.uvs[size_t(found) * 3];
+        float w = 1.0f - hitU - hitV;
+        hit.uv = { uv[0].u * w + uv[1].u * hitU + uv[2].u * hitV, uv[0].v * w + uv[1].v * hitU + uv[2].v * hitV };
+    }
+    return true;
+}
+
+int meshBvhDepth(const meshBvh &bvh)
+{
+    if (bvh.nodes.empty())
+        return 0;
+    int deepest = 0;
+    std::vector<std::pair<int, int>> stack = { { 0, 1 } };
+    while (!stack.empty())
+    {
+        auto entry = stack.back();
+        stack.pop_back();
+        deepest = std::max(deepest, entry.second);
+        const bvhNode &node = bvh.nodes[entry.first];
+        if (node.count == 0)
+        {
+            stack.push_back({ node.first, entry.second + 1 });
+            stack.push_back({ node.first + 1, entry.second + 1 });
+        }
+    }
+    return deepest;
+}
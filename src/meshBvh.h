@@ -0,0 +1,64 @@
+#include <SDL2/SDL.h>
+#include <vector>
+#include "graphicsEngine.h"
+
+#ifndef MESHBVH_H
+#define MESHBVH_H
+
+// Interior nodes have count 0 and their children at first and first + 1,
+// leaves hold count triangles from first on
+struct bvhNode
+{
+    vertex boundsMin;
+    vertex boundsMax;
+    int first;
+    int count;
+};
+
+// Triangle as the ray test wants it: a corner and the two edges from it
+struct bvhTriangle
+{
+    vertex v0;
+    vertex edge1;
+    vertex edge2;
+};
+
+// Bounding volume hierarchy over one mesh in model space, built with the
+// surface area heuristic. Triangles are copied in leaf order so a leaf
+// reads one contiguous run, which also makes it independent of how the
+// instance stores the mesh for drawing
+struct meshBvh
+{
+    meshVector<bvhNode> nodes;
+    meshVector<bvhTriangle> triangles;
+    meshVector<coord> uvs;              // three per triangle, same order, empty for untextured meshes
+    meshVector<int> sourceIndex;        // triangle index in the mesh it was built from
+};
+
+struct rayHit
+{
+    int instance = -1;
+    int triangle = -1;      // index into the triangles as the instance stores them
+    float distance = 0.0f;  // in units of the ray direction, world space
+    float u = 0.0f;         // barycentric weights of the second and third corner
+    float v = 0.0f;
+    coord uv = { 0.0f, 0.0f };
+    vertex position = { 0.0f, 0.0f, 0.0f };
+};
+
+struct rayQuery
+{
+    vertex origin;
+    vertex direction;
+    float maxDistance;
+};
+
+void buildMeshBvh(const mesh &m, meshBvh &bvh);
+// From triangles decoded out of some other storage, keepUVs false leaves uvs empty
+void buildMeshBvh(const triangle *triangles, int count, bool keepUVs, meshBvh &bvh);
+// Nearest hit with distance in (0, hit.distance), hit.distance is the limit
+// on the way in. Only the triangle fields and distance are filled
+bool intersectMeshBvh(const meshBvh &bvh, const vertex &origin, const vertex &direction, rayHit &hit);
+int meshBvhDepth(const meshBvh &bvh);
+
+#endif
@@ -0,0 +1,277 @@
+#include <SDL2/SDL.h>
+#include "meshOptimizer.h"
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include <unordered_map>
+
+// Hashes the raw bytes of a corner, exact matches only
+struct cornerKey
+{
+    vertex position;
+    coord uv;
+
+    bool operator==(const cornerKey &other) const
+    {
+        return memcmp(this, &other, sizeof(cornerKey)) == 0;
+    }
+};
+
+struct cornerHash
+{
+    size_t operator()(const cornerKey &key) const
+    {
+        Uint32 words[5];
+        memcpy(words, &key, sizeof(words));
+        size_t hash = 2166136261u;
+        for (Uint32 word : words)
+            hash = (hash ^ word) * 16777619u;
+        return hash;
+    }
+};
+
+void buildIndexedMesh(const mesh &m, indexedMesh &indexed)
+{
+    indexed.positions.clear();
+    indexed.uvs.clear();
+    indexed.indices.clear();
+    indexed.indices.reserve(m.triangles.size() * 3);
+
+    std::unordered_map<cornerKey, Uint32, cornerHash> welded;
+    welded.reserve(m.triangles.size() * 2);
+    for (const auto &tri : m.triangles)
+    {
+        for (int i = 0; i < 3; i++)
+        {
+            cornerKey key;
+            memset(&key, 0, sizeof(key));
+            key.position = tri.v[i];
+            key.uv = tri.t[i];
+
+            auto found = welded.find(key);
+            if (found == welded.end())
+            {
+                found = welded.emplace(key, Uint32(indexed.positions.size())).first;
+                indexed.positions.push_back(tri.v[i]);
+                indexed.uvs.push_back(tri.t[i]);
+            }
+            indexed.indices.push_back(found->second);
+        }
+    }
+}
+
+float computeACMR(const meshVector<Uint32> &indices, size_t vertexCount, int cacheSize)
+{
+    if (indices.size() < 3)
+        return 0.0f;
+
+    // Cache slots hold the time a vertex entered, FIFO eviction falls out of that
+    std::vector<long long> entered(vertexCount, -1);
+    long long clock = 0;
+    size_t misses = 0;
+    for (Uint32 index : indices)
+    {
+        if (entered[index] < 0 || clock - entered[index] >= cacheSize)
+        {
+            entered[index] = clock++;
+            misses++;
+        }
+    }
+    return float(misses) / float(indices.size() / 3);
+}
+
+// Tuning from Forsyth's paper
+static const int maxCacheSize = 32;
+static const float cacheDecayPower = 1.5f;
+static const float lastTriangleScore = 0.75f;
+static const float valenceBoostScale = 2.0f;
+static const float valenceBoostPower = 0.5f;
+
+static float vertexScore(int cachePosition, int remaining)
+{
+    if (remaining == 0)
+        return -1.0f;
+
+    float score = 0.0f;
+    if (cachePosition >= 0)
+    {
+        // The corners of the last triangle get a fixed score, so the next one
+        // doesn't just reuse the same edge every time
+        if (cachePosition < 3)
+            score = lastTriangleScore;
+        else
+            score = powf(1.0f - float(cachePosition - 3) / (maxCacheSize - 3), cacheDecayPower);
+    }
+    // Vertices with few triangles left get a boost so they are finished off
+    return score + valenceBoostScale * powf(float(remaining), -valenceBoostPower);
+}
+
+void optimizeVertexCache(indexedMesh &indexed)
+{
+    size_t triangleCount = indexed.indices.size() / 3;
+    size_t vertexCount = indexed.positions.size();
+    if (triangleCount == 0)
+        return;
+    const Uint32 *indices = indexed.indices.data();
+
+    // Triangles around each vertex, as one flat list with offsets
+    std::vector<int> remaining(vertexCount, 0);
+    for (size_t i = 0; i < triangleCount * 3; i++)
+        remaining[indices[i]]++;
+    std::vector<int> offsets(vertexCount + 1, 0);
+    for (size_t v = 0; v < vertexCount; v++)
+        offsets[v + 1] = offsets[v] + remaining[v];
+    std::vector<int> adjacency(offsets[vertexCount]);
+    std::vector<int> filled(offsets.begin(), offsets.end() - 1);
+    for (size_t t = 0; t < triangleCount; t++)
+        for (int i = 0; i < 3; i++)
+            adjacency[filled[indices[t * 3 + i]]++] = int(t);
+
+    std::vector<int> cachePosition(vertexCount, -1);
+    std::vector<float> score(vertexCount);
+    for (size_t v = 0; v < vertexCount; v++)
+        score[v] = vertexScore(-1, remaining[v]);
+
+    std::vector<float> triangleScore(triangleCount);
+    std::vector<bool> emitted(triangleCount, false);
+    for (size_t t = 0; t < triangleCount; t++)
+        triangleScore[t] = score[indices[t * 3]] + score[indices[t * 3 + 1]] + score[indices[t * 3 + 2]];
+
+    // Three extra slots hold vertices pushed out by the newest triangle until they are rescored
+    int cache[maxCacheSize + 3];
+    int cacheCount = 0;
+
+    meshVector<Uint32> order;
+    order.reserve(triangleCount * 3);
+
+    int best = int(std::max_element(triangleScore.begin(), triangleScore.end()) - triangleScore.begin());
+    size_t scanFrom = 0;
+    while (best >= 0)
+    {
+        emitted[best] = true;
+        int next[maxCacheSize + 3];
+        int nextCount = 0;
+        for (int i = 0; i < 3; i++)
+        {
+            int v = int(indices[best * 3 + i]);
+            order.push_back(Uint32(v));
+            next[nextCount++] = v;
+
+            // Drop the triangle from the vertex's remaining list
+            int *begin = &adjacency[offsets[v]];
+            int *end = begin + remaining[v];
+            *std::find(begin, end, best) = *(end - 1);
+            remaining[v]--;
+        }
+
+        // The new triangle's corners go to the front, the rest keep their order
+        for (int i = 0; i < cacheCount; i++)
+        {
+            int v = cache[i];
+            if (v != next[0] && v != next[1] && v != next[2])
+                next[nextCount++] = v;
+        }
+        cacheCount = std::min(nextCount, maxCacheSize);
+        for (int i = 0; i < nextCount; i++)
+            cachePosition[next[i]] = i < maxCacheSize ? i : -1;
+        for (int i = 0; i < cacheCount; i++)
+            cache[i] = next[i];
+
+        // Rescore everything touched and pick the best triangle still in the cache
+        for (int i = 0; i < nextCount; i++)
+        {
+            int v = next[i];
+            score[v] = vertexScore(cachePosition[v], remaining[v]);
+        }
+        best = -1;
+        float bestScore = -1.0f;
+        for (int i = 0; i < nextCount; i++)
+        {
+            int v = next[i];
+            for (int a = offsets[v]; a < offsets[v] + remaining[v]; a++)
+            {
+                int t = adjacency[a];
+                triangleScore[t] = score[indices[t * 3]] + score[indices[t * 3 + 1]] + score[indices[t * 3 + 2]];
+                if (triangleScore[t] > bestScore)
+                {
+                    bestScore = triangleScore[t];
+                    best = t;
+                }
+            }
+        }
+
+        // Nothing left around the cache, continue with the next unfinished triangle
+        if (best < 0)
+        {
+            while (scanFrom < triangleCount && emitted[scanFrom])
+                scanFrom++;
+            if (scanFrom < triangleCount)
+                best = int(scanFrom);
+        }
+    }
+
+    indexed.indices.swap(order);
+}
+
+void optimizeVertexFetch(indexedMesh &indexed)
+{
+    const Uint32 unused = 0xFFFFFFFF;
+    std::vector<Uint32> remap(indexed.positions.size(), unused);
+    meshVector<vertex> positions;
+    meshVector<coord> uvs;
+    positions.reserve(indexed.positions.size());
+    uvs.reserve(indexed.uvs.size());
+
+    for (Uint32 &index : indexed.indices)
+    {
+        if (remap[index] == unused)
+        {
+            remap[index] = Uint32(positions.size());
+            positions.push_back(indexed.positions[index]);
+            uvs.push_back(indexed.uvs[index]);
+        }
+        index = remap[index];
+    }
+
+    indexed.positions.swap(positions);
+    indexed.uvs.swap(uvs);
+}
+
+void transformIndexed(const indexedMesh &indexed, const matrix4 &world, frameVector<vertex> &transformed, frameVector<triangle> &out)
+{
+    // Affine like transformTriangles, but once per shared vertex
+    const float m00 = world.m[0][0], m01 = world.m[0][1], m02 = world.m[0][2];
+    const float m10 = world.m[1][0], m11 = world.m[1][1], m12 = world.m[1][2];
+    const float m20 = world.m[2][0], m21 = world.m[2][1], m22 = world.m[2][2];
+    const float m30 = world.m[3][0], m31 = world.m[3][1], m32 = world.m[3][2];
+
+    size_t vertexCount = indexed.positions.size();
+    transformed.resize(vertexCount);
+    const vertex *in = indexed.positions.data();
+    vertex *result = transformed.data();
+    for (size_t n = 0; n < vertexCount; n++)
+    {
+        float x = in[n].x;
+        float y = in[n].y;
+        float z = in[n].z;
+        result[n].x = x * m00 + y * m10 + z * m20 + m30;
+        result[n].y = x * m01 + y * m11 + z * m21 + m31;
+        result[n].z = x * m02 + y * m12 + z * m22 + m32;
+    }
+
+    // Cache ordered indices keep these gathers close together
+    size_t triangleCount = indexed.indices.size() / 3;
+    out.resize(triangleCount);
+    const Uint32 *indices = indexed.indices.data();
+    const coord *uvs = indexed.uvs.data();
+    triangle *tris = out.data();
+    for (size_t n = 0; n < triangleCount; n++)
+    {
+        for (int i = 0; i < 3; i++)
+        {
+            Uint32 index = indices[n * 3 + i];
+            tris[n].v[i] = result[index];
+            tris[n].t[i] = uvs[index];
+        }
+    }
+}
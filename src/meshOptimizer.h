@@ -0,0 +1,31 @@
+#include <SDL2/SDL.h>
+#include "graphicsEngine.h"
+
+#ifndef MESHOPTIMIZER_H
+#define MESHOPTIMIZER_H
+
+// Shared vertices plus three indices per triangle. Each unique corner is
+// transformed once per frame instead of once per triangle that uses it
+struct indexedMesh
+{
+    meshVector<vertex> positions;
+    meshVector<coord> uvs;
+    meshVector<Uint32> indices;
+};
+
+// Welds corners with the same position and UV
+void buildIndexedMesh(const mesh &m, indexedMesh &indexed);
+// Average cache misses per triangle for a FIFO post-transform cache,
+// 0.5 is the best a regular grid can do and 3 means no reuse at all
+float computeACMR(const meshVector<Uint32> &indices, size_t vertexCount, int cacheSize = 16);
+// Forsyth's linear-speed vertex cache optimization: greedily emits the triangle
+// whose corners score highest for recency in a simulated LRU cache and for
+// having few triangles left, so vertices are finished while still cached
+void optimizeVertexCache(indexedMesh &indexed);
+// Renumbers vertices in the order the triangles first use them, so index
+// lookups walk the vertex arrays mostly forwards
+void optimizeVertexFetch(indexedMesh &indexed);
+// Transforms the shared vertices, then gathers them into triangles
+void transformIndexed(const indexedMesh &indexed, const matrix4 &world, frameVector<vertex> &transformed, frameVector<triangle> &out);
+
+#endif
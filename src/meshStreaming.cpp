@@ -0,0 +1,683 @@
+#include <SDL2/SDL.h>
+#include "meshStreaming.h"
+#include "assetCache.h"
+#include <iostream>
+#include <fstream>
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include <unordered_map>
+
+// File layout: header, the chunk table with the coarse chunks first, then
+// each chunk's triangles as raw structs at the offset its entry gives
+struct chunkFileHeader
+{
+    char magic[4];
+    Uint32 version;
+    Uint32 groupCount;
+    Uint32 chunkCount;
+};
+
+static const char chunkMagic[4] = { 'C', 'H', 'N', 'K' };
+static const Uint32 chunkVersion = 1;
+
+// Cells per side of a group when it is clustered into its coarse chunk
+static const int clusterResolution = 24;
+// Frames of camera motion to look ahead when prefetching
+static const float prefetchFrames = 30.0f;
+// How much farther an out of view chunk counts as than one in view
+static const float hiddenPenalty = 4.0f;
+
+static vertex centroid(const triangle &tri)
+{
+    return scaleV(addV(addV(tri.v[0], tri.v[1]), tri.v[2]), 1.0f / 3.0f);
+}
+
+static float axisOf(const vertex &v, int axis)
+{
+    return axis == 0 ? v.x : (axis == 1 ? v.y : v.z);
+}
+
+// Median splits along the longest axis of the centroids until each range
+// holds at most limit triangles. Ranges come out in spatial order
+static void partitionTriangles(const mesh &m, std::vector<int> &indices, size_t begin, size_t end, size_t limit,
+                               std::vector<std::pair<size_t, size_t>> &ranges)
+{
+    std::vector<std::pair<size_t, size_t>> stack = { { begin, end } };
+    while (!stack.empty())
+    {
+        auto range = stack.back();
+        stack.pop_back();
+        size_t count = range.second - range.first;
+        if (count <= limit)
+        {
+            ranges.push_back(range);
+            continue;
+        }
+
+        vertex low = centroid(m.triangles[indices[range.first]]);
+        vertex high = low;
+        for (size_t i = range.first; i < range.second; i++)
+        {
+            vertex c = centroid(m.triangles[indices[i]]);
+            low = { std::min(low.x, c.x), std::min(low.y, c.y), std::min(low.z, c.z) };
+            high = { std::max(high.x, c.x), std::max(high.y, c.y), std::max(high.z, c.z) };
+        }
+        vertex extent = subtractV(high, low);
+        int axis = extent.x >= extent.y && extent.x >= extent.z ? 0 : (extent.y >= extent.z ? 1 : 2);
+
+        size_t middle = range.first + count / 2;
+        std::nth_element(indices.begin() + range.first, indices.begin() + middle, indices.begin() + range.second, [&](int a, int b)
+        {
+            return axisOf(centroid(m.triangles[a]), axis) < axisOf(centroid(m.triangles[b]), axis);
+        });
+        // Pushed in reverse so the lower half comes out first
+        stack.push_back({ middle, range.second });
+        stack.push_back({ range.first, middle });
+    }
+}
+
+static void rangeBounds(const mesh &m, const std::vector<int> &indices, size_t begin, size_t end, meshChunk &chunk)
+{
+    chunk.boundsMin = m.triangles[indices[begin]].v[0];
+    chunk.boundsMax = chunk.boundsMin;
+    for (size_t i = begin; i < end; i++)
+    {
+        for (const vertex &v : m.triangles[indices[i]].v)
+        {
+            chunk.boundsMin = { std::min(chunk.boundsMin.x, v.x), std::min(chunk.boundsMin.y, v.y), std::min(chunk.boundsMin.z, v.z) };
+            chunk.boundsMax = { std::max(chunk.boundsMax.x, v.x), std::max(chunk.boundsMax.y, v.y), std::max(chunk.boundsMax.z, v.z) };
+        }
+    }
+}
+
+// Snaps corners to a grid over the group and averages each cell, dropping
+// triangles that collapse. Crude next to edge collapse, but one pass and
+// plenty for something only seen while the real chunks load
+static void clusterTriangles(const mesh &m, const std::vector<int> &indices, size_t begin, size_t end,
+                             const meshChunk &bounds, std::vector<triangle> &out)
+{
+    vertex extent = subtractV(bounds.boundsMax, bounds.boundsMin);
+    float cellSize = std::max(std::max(extent.x, extent.y), std::max(extent.z, 1e-6f)) / clusterResolution;
+
+    struct cell
+    {
+        vertex position;
+        coord uv;
+        float weight;
+    };
+    std::unordered_map<Uint32, cell> cells;
+    auto cellKey = [&](const vertex &v)
+    {
+        Uint32 x = Uint32(std::min(clusterResolution, int((v.x - bounds.boundsMin.x) / cellSize)));
+        Uint32 y = Uint32(std::min(clusterResolution, int((v.y - bounds.boundsMin.y) / cellSize)));
+        Uint32 z = Uint32(std::min(clusterResolution, int((v.z - bounds.boundsMin.z) / cellSize)));
+        return (x * (clusterResolution + 1) + y) * (clusterResolution + 1) + z;
+    };
+
+    for (size_t i = begin; i < end; i++)
+    {
+        const triangle &tri = m.triangles[indices[i]];
+        for (int c = 0; c < 3; c++)
+        {
+            cell &target = cells[cellKey(tri.v[c])];
+            target.position = addV(target.position, tri.v[c]);
+            target.uv = { target.uv.u + tri.t[c].u, target.uv.v + tri.t[c].v };
+            target.weight += 1.0f;
+        }
+    }
+
+    for (size_t i = begin; i < end; i++)
+    {
+        const triangle &tri = m.triangles[indices[i]];
+        Uint32 keys[3] = { cellKey(tri.v[0]), cellKey(tri.v[1]), cellKey(tri.v[2]) };
+        if (keys[0] == keys[1] || keys[1] == keys[2] || keys[0] == keys[2])
+            continue;
+        triangle simplified = tri;
+        for (int c = 0; c < 3; c++)
+        {
+            const cell &source = cells[keys[c]];
+            simplified.v[c] = scaleV(source.position, 1.0f / source.weight);
+            simplified.t[c] = { source.uv.u / source.weight, source.uv.v / source.weight };
+        }
+        out.push_back(simplified);
+    }
+}
+
+bool writeChunkedMesh(const mesh &m, const std::string &filename, int trianglesPerChunk, int chunksPerGroup)
+{
+    if (m.triangles.empty() || trianglesPerChunk <= 0 || chunksPerGroup <= 0)
+    {
+        std::cout << "Failed to write chunked mesh: " << filename << " has nothing to split" << std::endl;
+        return false;
+    }
+
+    std::vector<int> indices(m.triangles.size());
+    for (size_t i = 0; i < indices.size(); i++)
+        indices[i] = int(i);
+
+    // Groups first, then each group on its own, so a group's chunks sit together
+    std::vector<std::pair<size_t, size_t>> groupRanges;
+    partitionTriangles(m, indices, 0, indices.size(), size_t(trianglesPerChunk) * chunksPerGroup, groupRanges);
+
+    std::vector<meshChunk> groupTable;
+    std::vector<std::vector<triangle>> coarseTriangles;
+    std::vector<meshChunk> chunkTable;
+    std::vector<std::pair<size_t, size_t>> chunkRanges;
+    for (const auto &group : groupRanges)
+    {
+        meshChunk entry = {};
+        rangeBounds(m, indices, group.first, group.second, entry);
+        entry.group = -1;
+        coarseTriangles.emplace_back();
+        clusterTriangles(m, indices, group.first, group.second, entry, coarseTriangles.back());
+        entry.triangleCount = Uint32(coarseTriangles.back().size());
+        groupTable.push_back(entry);
+
+        std::vector<std::pair<size_t, size_t>> ranges;
+        partitionTriangles(m, indices, group.first, group.second, size_t(trianglesPerChunk), ranges);
+        for (const auto &range : ranges)
+        {
+            meshChunk chunk = {};
+            rangeBounds(m, indices, range.first, range.second, chunk);
+            chunk.triangleCount = Uint32(range.second - range.first);
+            chunk.group = Sint32(groupTable.size() - 1);
+            chunkTable.push_back(chunk);
+            chunkRanges.push_back(range);
+        }
+    }
+
+    // Offsets follow the table, coarse data first
+    Uint64 offset = sizeof(chunkFileHeader) + sizeof(meshChunk) * (groupTable.size() + chunkTable.size());
+    for (auto &entry : groupTable)
+    {
+        entry.offset = offset;
+        offset += Uint64(entry.triangleCount) * sizeof(triangle);
+    }
+    for (auto &chunk : chunkTable)
+    {
+        chunk.offset = offset;
+        offset += Uint64(chunk.triangleCount) * sizeof(triangle);
+    }
+
+    std::ofstream file(filename, std::ios::binary | std::ios::trunc);
+    if (!file.is_open())
+    {
+        std::cout << "Failed to open chunked mesh for writing: " << filename << std::endl;
+        return false;
+    }
+    chunkFileHeader header;
+    memcpy(header.magic, chunkMagic, sizeof(chunkMagic));
+    header.version = chunkVersion;
+    header.groupCount = Uint32(groupTable.size());
+    header.chunkCount = Uint32(chunkTable.size());
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(groupTable.data()), std::streamsize(sizeof(meshChunk) * groupTable.size()));
+    file.write(reinterpret_cast<const char*>(chunkTable.data()), std::streamsize(sizeof(meshChunk) * chunkTable.size()));
+    for (const auto &triangles : coarseTriangles)
+        file.write(reinterpret_cast<const char*>(triangles.data()), std::streamsize(sizeof(triangle) * triangles.size()));
+    for (const auto &range : chunkRanges)
+    {
+        for (size_t i = range.first; i < range.second; i++)
+            file.write(reinterpret_cast<const char*>(&m.triangles[indices[i]]), sizeof(triangle));
+    }
+    if (!file)
+    {
+        std::cout << "Failed to write chunked mesh: " << filename << std::endl;
+        return false;
+    }
+
+    size_t coarseCount = 0;
+    for (const auto &entry : groupTable)
+        coarseCount += entry.triangleCount;
+    std::cout << "Chunked " << filename << ": " << m.triangles.size() << " triangles in " << chunkTable.size()
+              << " chunks, " << groupTable.size() << " coarse groups of " << coarseCount << " triangles" << std::endl;
+    return true;
+}
+
+bool convertObjToChunks(const std::string &objFile, const std::string &chunkFile, int trianglesPerChunk)
+{
+    std::ifstream file(objFile);
+    if (!file.is_open())
+    {
+        std::cout << "Failed to open model: " << objFile << std::endl;
+        return false;
+    }
+    bool textured = false;
+    std::string line;
+    while (!textured && std::getline(file, line))
+        textured = line.compare(0, 3, "vt ") == 0;
+    file.close();
+
+    mesh m;
+    if (!(textured ? parseObjTextureFile(objFile, m) : parseObjFile(objFile, m)))
+        return false;
+    return writeChunkedMesh(m, chunkFile, trianglesPerChunk);
+}
+
+static bool readChunk(std::ifstream &file, const meshChunk &chunk, mesh &out)
+{
+    out.triangles.resize(chunk.triangleCount);
+    file.seekg(std::streamoff(chunk.offset));
+    file.read(reinterpret_cast<char*>(out.triangles.data()), std::streamsize(sizeof(triangle)) * chunk.triangleCount);
+    return bool(file);
+}
+
+StreamingPool::StreamingPool(size_t _budgetBytes, int ioThreads)
+{
+    budgetBytes = _budgetBytes;
+    committed = 0;
+    resident = 0;
+    tick = 0;
+    stopping = false;
+    for (int i = 0; i < std::max(1, ioThreads); i++)
+        workers.emplace_back(&StreamingPool::ioLoop, this);
+}
+
+StreamingPool::~StreamingPool()
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+    requestReady.notify_all();
+    for (auto &worker : workers)
+        worker.join();
+}
+
+void StreamingPool::setBudget(size_t bytes)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    budgetBytes = bytes;
+}
+
+size_t StreamingPool::residentBytes()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    return resident;
+}
+
+bool StreamingPool::dropOldest()
+{
+    // Least recently wanted, then farthest from its mesh's camera. Groups
+    // being read into can't go, what is read will land
+    MeshStreamer *victim = nullptr;
+    int victimGroup = -1;
+    for (MeshStreamer *streamer : streamers)
+    {
+        for (size_t g = 0; g < streamer->groupSlots.size(); g++)
+        {
+            const MeshStreamer::groupSlot &slot = streamer->groupSlots[g];
+            if (!slot.held || slot.wanted || streamer->groupLoading(int(g)))
+                continue;
+            if (victim)
+            {
+                const MeshStreamer::groupSlot &oldest = victim->groupSlots[victimGroup];
+                if (slot.lastWanted > oldest.lastWanted ||
+                    (slot.lastWanted == oldest.lastWanted && streamer->groupPriority[g] <= victim->groupPriority[victimGroup]))
+                    continue;
+            }
+            victim = streamer;
+            victimGroup = int(g);
+        }
+    }
+    if (!victim)
+        return false;
+    victim->releaseGroup(victimGroup);
+    return true;
+}
+
+bool StreamingPool::makeRoom(size_t bytes)
+{
+    // Nothing is dropped unless enough can be
+    size_t freeable = 0;
+    for (MeshStreamer *streamer : streamers)
+    {
+        for (size_t g = 0; g < streamer->groupSlots.size(); g++)
+        {
+            const MeshStreamer::groupSlot &slot = streamer->groupSlots[g];
+            if (slot.held && !slot.wanted && !streamer->groupLoading(int(g)))
+                freeable += slot.bytes;
+        }
+    }
+    if (committed + bytes > budgetBytes + freeable)
+        return false;
+    while (committed + bytes > budgetBytes)
+        dropOldest();
+    return true;
+}
+
+void StreamingPool::trimToBudget()
+{
+    while (committed > budgetBytes)
+    {
+        if (!dropOldest())
+            return;
+    }
+}
+
+void StreamingPool::ioLoop()
+{
+    // Each thread reads through its own handles so seeks don't interfere
+    std::unordered_map<std::string, std::ifstream> files;
+    while (true)
+    {
+        readRequest request;
+        meshChunk info;
+        std::string filename;
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            requestReady.wait(guard, [this] { return stopping || !requests.empty(); });
+            if (stopping)
+                return;
+            request = requests.front();
+            requests.pop_front();
+            // Left behind by a group that was dropped since
+            MeshStreamer::chunkSlot &slot = request.owner->fine[request.chunk];
+            if (slot.state != MeshStreamer::ChunkState::Queued)
+                continue;
+            slot.state = MeshStreamer::ChunkState::Loading;
+            request.owner->reading++;
+            info = slot.info;
+            filename = request.owner->filename;
+        }
+
+        std::ifstream &file = files[filename];
+        if (!file.is_open())
+            file.open(filename, std::ios::binary);
+        std::shared_ptr<mesh> loaded = std::make_shared<mesh>();
+        if (!readChunk(file, info, *loaded))
+        {
+            std::cout << "Failed to read chunk " << request.chunk << " of " << filename << std::endl;
+            file.clear();
+            loaded = nullptr;
+        }
+
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            MeshStreamer::chunkSlot &slot = request.owner->fine[request.chunk];
+            if (loaded)
+            {
+                slot.data = loaded;
+                slot.state = MeshStreamer::ChunkState::Resident;
+                request.owner->resident += request.owner->chunkBytes(slot);
+                resident += request.owner->chunkBytes(slot);
+            }
+            else
+                slot.state = MeshStreamer::ChunkState::Unloaded;
+            request.owner->reading--;
+        }
+        readDone.notify_all();
+    }
+}
+
+MeshStreamer::MeshStreamer(const std::string &_filename, std::shared_ptr<StreamingPool> _pool)
+{
+    filename = _filename;
+    pool = _pool;
+    open = false;
+    hasLastEye = false;
+    lastEye = { 0.0f, 0.0f, 0.0f };
+    resident = 0;
+    coarseBytes = 0;
+    reading = 0;
+
+    std::ifstream file(filename, std::ios::binary);
+    chunkFileHeader header;
+    if (!file.is_open() || !file.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+        memcmp(header.magic, chunkMagic, sizeof(chunkMagic)) != 0 || header.version != chunkVersion)
+    {
+        std::cout << "Failed to open chunked mesh: " << filename << std::endl;
+        return;
+    }
+
+    groups.resize(header.groupCount);
+    std::vector<meshChunk> table(header.chunkCount);
+    file.read(reinterpret_cast<char*>(groups.data()), std::streamsize(sizeof(meshChunk) * groups.size()));
+    file.read(reinterpret_cast<char*>(table.data()), std::streamsize(sizeof(meshChunk) * table.size()));
+    if (!file)
+    {
+        std::cout << "Failed to read chunked mesh: " << filename << std::endl;
+        return;
+    }
+
+    // Coarse chunks are small and always drawn as a fallback, so they load up front
+    groupChunks.resize(groups.size());
+    groupSlots.resize(groups.size());
+    groupVisible.assign(groups.size(), true);
+    groupPriority.assign(groups.size(), 0.0f);
+    for (const auto &group : groups)
+    {
+        std::shared_ptr<mesh> loaded = std::make_shared<mesh>();
+        if (!readChunk(file, group, *loaded))
+        {
+            std::cout << "Failed to read chunked mesh: " << filename << std::endl;
+            return;
+        }
+        coarse.push_back(loaded);
+        coarseBytes += size_t(group.triangleCount) * sizeof(triangle);
+    }
+    fine.resize(table.size());
+    for (size_t i = 0; i < table.size(); i++)
+    {
+        if (table[i].group < 0 || table[i].group >= Sint32(groups.size()))
+        {
+            std::cout << "Failed to read chunked mesh: " << filename << " has a chunk outside any group" << std::endl;
+            return;
+        }
+        fine[i].info = table[i];
+        groupChunks[table[i].group].push_back(int(i));
+        groupSlots[table[i].group].bytes += chunkBytes(fine[i]);
+    }
+
+    // The coarse chunks take their room whatever the budget, nothing draws without them
+    std::lock_guard<std::mutex> guard(pool->lock);
+    pool->streamers.push_back(this);
+    pool->committed += coarseBytes;
+    pool->resident += coarseBytes;
+    open = true;
+}
+
+MeshStreamer::~MeshStreamer()
+{
+    if (!open)
+        return;
+
+    std::unique_lock<std::mutex> guard(pool->lock);
+    auto &requests = pool->requests;
+    requests.erase(std::remove_if(requests.begin(), requests.end(), [this](const StreamingPool::readRequest &request)
+    {
+        return request.owner == this;
+    }), requests.end());
+    // Reads already started finish into this mesh, so they are waited for
+    pool->readDone.wait(guard, [this] { return reading == 0; });
+    for (size_t g = 0; g < groups.size(); g++)
+    {
+        if (groupSlots[g].held)
+            releaseGroup(int(g));
+    }
+    pool->committed -= coarseBytes;
+    pool->resident -= coarseBytes;
+    pool->streamers.erase(std::find(pool->streamers.begin(), pool->streamers.end(), this));
+}
+
+bool MeshStreamer::isOpen()
+{
+    return open;
+}
+
+size_t MeshStreamer::chunkBytes(const chunkSlot &slot)
+{
+    return size_t(slot.info.triangleCount) * sizeof(triangle);
+}
+
+bool MeshStreamer::groupLoading(int group)
+{
+    for (int index : groupChunks[group])
+    {
+        if (fine[index].state == ChunkState::Loading)
+            return true;
+    }
+    return false;
+}
+
+void MeshStreamer::queueGroup(int group)
+{
+    for (int index : groupChunks[group])
+    {
+        chunkSlot &slot = fine[index];
+        if (slot.state == ChunkState::Unloaded || slot.state == ChunkState::Queued)
+        {
+            slot.state = ChunkState::Queued;
+            pool->requests.push_back({ this, index });
+        }
+    }
+}
+
+void MeshStreamer::releaseGroup(int group)
+{
+    for (int index : groupChunks[group])
+    {
+        chunkSlot &slot = fine[index];
+        if (slot.state == ChunkState::Resident)
+        {
+            resident -= chunkBytes(slot);
+            pool->resident -= chunkBytes(slot);
+        }
+        slot.data = nullptr;
+        slot.state = ChunkState::Unloaded;
+    }
+    // Any of its chunks still queued are skipped when their turn comes
+    groupSlot &slot = groupSlots[group];
+    pool->committed -= slot.bytes;
+    slot.held = false;
+    slot.wanted = false;
+}
+
+void MeshStreamer::update(const vertex &eye, const matrix4 &modelToClip)
+{
+    if (!open)
+        return;
+
+    vertex motion = hasLastEye ? subtractV(eye, lastEye) : vertex{ 0.0f, 0.0f, 0.0f };
+    vertex ahead = addV(eye, scaleV(motion, prefetchFrames));
+    lastEye = eye;
+    hasLastEye = true;
+
+    // Nearest first, from where the camera is or is heading. Out of view
+    // groups still count, farther off, so turning around finds them loaded.
+    // Whole groups are paged, since a group draws fine only once all of it is in
+    order.clear();
+    for (size_t g = 0; g < groups.size(); g++)
+    {
+        groupVisible[g] = boxVisible(groups[g].boundsMin, groups[g].boundsMax, modelToClip);
+        float distance = std::min(boxDistance(eye, groups[g].boundsMin, groups[g].boundsMax),
+                                  boxDistance(ahead, groups[g].boundsMin, groups[g].boundsMax));
+        groupPriority[g] = groupVisible[g] ? distance : distance * hiddenPenalty + 1.0f;
+        order.push_back(int(g));
+    }
+    std::sort(order.begin(), order.end(), [this](int a, int b) { return groupPriority[a] < groupPriority[b]; });
+
+    std::lock_guard<std::mutex> guard(pool->lock);
+    int tick = ++pool->tick;
+
+    // What this mesh queued before is picked again from scratch. The groups it
+    // holds stay loaded unless something wanted more needs their room
+    auto &requests = pool->requests;
+    requests.erase(std::remove_if(requests.begin(), requests.end(), [this](const StreamingPool::readRequest &request)
+    {
+        return request.owner == this;
+    }), requests.end());
+    for (auto &slot : fine)
+    {
+        if (slot.state == ChunkState::Queued)
+            slot.state = ChunkState::Unloaded;
+    }
+    for (auto &slot : groupSlots)
+        slot.wanted = false;
+    // Only drops anything when the budget was lowered
+    pool->trimToBudget();
+
+    size_t queued = requests.size();
+    for (int g : order)
+    {
+        groupSlot &slot = groupSlots[g];
+        if (!slot.held)
+        {
+            if (!pool->makeRoom(slot.bytes))
+                continue;
+            slot.held = true;
+            pool->committed += slot.bytes;
+        }
+        slot.wanted = true;
+        slot.lastWanted = tick;
+        queueGroup(g);
+    }
+    if (requests.size() > queued)
+        pool->requestReady.notify_all();
+}
+
+void MeshStreamer::gather(const matrix4 &world, frameVector<triangle> &out, bool culled)
+{
+    out.clear();
+    if (!open)
+        return;
+
+    std::lock_guard<std::mutex> guard(pool->lock);
+    for (size_t g = 0; g < groups.size(); g++)
+    {
+        if (culled && !groupVisible[g])
+            continue;
+
+        // Fine chunks only once the whole group is in, coarse and fine would overlap
+        bool complete = true;
+        for (int index : groupChunks[g])
+            complete = complete && fine[index].state == ChunkState::Resident;
+
+        if (!complete)
+        {
+            transformTriangles(*coarse[g], world, chunkTriangles);
+            out.insert(out.end(), chunkTriangles.begin(), chunkTriangles.end());
+            continue;
+        }
+        for (int index : groupChunks[g])
+        {
+            transformTriangles(*fine[index].data, world, chunkTriangles);
+            out.insert(out.end(), chunkTriangles.begin(), chunkTriangles.end());
+        }
+    }
+}
+
+void MeshStreamer::bounds(vertex &boundsMin, vertex &boundsMax)
+{
+    boundsMin = boundsMax = { 0.0f, 0.0f, 0.0f };
+    for (size_t g = 0; g < groups.size(); g++)
+    {
+        const meshChunk &group = groups[g];
+        boundsMin = g == 0 ? group.boundsMin : vertex{ std::min(boundsMin.x, group.boundsMin.x), std::min(boundsMin.y, group.boundsMin.y), std::min(boundsMin.z, group.boundsMin.z) };
+        boundsMax = g == 0 ? group.boundsMax : vertex{ std::max(boundsMax.x, group.boundsMax.x), std::max(boundsMax.y, group.boundsMax.y), std::max(boundsMax.z, group.boundsMax.z) };
+    }
+}
+
+size_t MeshStreamer::residentBytes()
+{
+    std::lock_guard<std::mutex> guard(pool->lock);
+    return resident;
+}
+
+int MeshStreamer::residentChunks()
+{
+    std::lock_guard<std::mutex> guard(pool->lock);
+    int count = 0;
+    for (const auto &slot : fine)
+    {
+        if (slot.state == ChunkState::Resident)
+            count++;
+    }
+    return count;
+}
+
+int MeshStreamer::chunkCount()
+{
+    return int(fine.size());
+}
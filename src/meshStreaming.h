@@ -0,0 +1,152 @@
+#include <SDL2/SDL.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "graphicsEngine.h"
+
+#ifndef MESHSTREAMING_H
+#define MESHSTREAMING_H
+
+// One spatially compact piece of a chunked mesh, as stored in the file's table
+struct meshChunk
+{
+    vertex boundsMin;
+    vertex boundsMax;
+    Uint64 offset;          // byte offset of the triangles in the file
+    Uint32 triangleCount;
+    Sint32 group;           // coarse chunk a fine chunk belongs to, -1 for coarse chunks
+};
+
+// Splits a mesh into fine chunks of about trianglesPerChunk, and groups of
+// about chunksPerGroup of them that each get a coarse, vertex clustered stand in.
+// The whole mesh has to fit in memory here, this is an offline step
+bool writeChunkedMesh(const mesh &m, const std::string &filename, int trianglesPerChunk = 4096, int chunksPerGroup = 8);
+// Same from an OBJ file, UVs are kept when it has any
+bool convertObjToChunks(const std::string &objFile, const std::string &chunkFile, int trianglesPerChunk = 4096);
+
+class MeshStreamer;
+
+// What every streamed mesh loaded through the same AssetCache shares: one
+// memory budget that coarse and fine chunks both count against, the I/O
+// threads and their queue. When a mesh wants a group that doesn't fit,
+// groups that no mesh picked on its last update are dropped to make room,
+// least recently wanted first. Groups still wanted are never taken from
+// another mesh, what doesn't fit keeps drawing its coarse chunk
+class StreamingPool
+{
+    public:
+        StreamingPool(size_t _budgetBytes, int ioThreads = 2);
+        ~StreamingPool();
+        // Meshes drop what no longer fits on their next update
+        void setBudget(size_t bytes);
+        // Coarse and fine chunks of every mesh
+        size_t residentBytes();
+
+    private:
+        friend class MeshStreamer;
+
+        struct readRequest
+        {
+            MeshStreamer *owner;
+            int chunk;
+        };
+
+        void ioLoop();
+        // Drops the least recently wanted group no mesh wants now, if there is one
+        bool dropOldest();
+        // Drops unwanted groups until bytes more fit, or nothing if they can't
+        bool makeRoom(size_t bytes);
+        // Drops unwanted groups while over budget, after it was lowered
+        void trimToBudget();
+
+        size_t budgetBytes;
+        size_t committed;       // coarse chunks, and the fine chunks of every group given room
+        size_t resident;
+        int tick;               // counts updates, for least recently wanted
+        std::vector<MeshStreamer*> streamers;
+
+        std::vector<std::thread> workers;
+        // Also guards the chunk and group state of every mesh in the pool
+        std::mutex lock;
+        std::condition_variable requestReady;
+        std::condition_variable readDone;
+        std::deque<readRequest> requests;
+        bool stopping;
+};
+
+// Pages the fine chunks of a chunked mesh in and out through a StreamingPool.
+// The coarse chunks stay resident and are drawn wherever a group's fine
+// chunks aren't all loaded yet, so nothing pops out while the camera moves.
+// Each instance has its own, since what is wanted depends on where it sits
+class MeshStreamer
+{
+    public:
+        MeshStreamer(const std::string &_filename, std::shared_ptr<StreamingPool> _pool);
+        ~MeshStreamer();
+        bool isOpen();
+        // Picks the chunks wanted from the eye and model to clip matrix, both in
+        // the mesh's model space, queues loads and lets go of what it no longer wants
+        void update(const vertex &eye, const matrix4 &modelToClip);
+        // World space triangles of what is loaded, and in view unless culled is false
+        void gather(const matrix4 &world, frameVector<triangle> &out, bool culled = true);
+        void bounds(vertex &boundsMin, vertex &boundsMax);
+        // Fine chunks only, the coarse ones are always in
+        size_t residentBytes();
+        int residentChunks();
+        int chunkCount();
+
+    private:
+        friend class StreamingPool;
+
+        enum class ChunkState { Unloaded, Queued, Loading, Resident };
+
+        struct chunkSlot
+        {
+            meshChunk info;
+            ChunkState state = ChunkState::Unloaded;
+            std::shared_ptr<const mesh> data;
+        };
+
+        // The pool's view of a group
+        struct groupSlot
+        {
+            size_t bytes = 0;       // of its fine chunks
+            bool held = false;      // counted against the budget, loaded or on the way
+            bool wanted = false;    // picked by the last update, so no other mesh takes it
+            int lastWanted = -1;    // pool tick it was last picked on
+        };
+
+        size_t chunkBytes(const chunkSlot &slot);
+        bool groupLoading(int group);
+        // Both with the pool locked
+        void queueGroup(int group);
+        void releaseGroup(int group);
+
+        std::string filename;
+        std::shared_ptr<StreamingPool> pool;
+        bool open;
+
+        std::vector<chunkSlot> fine;
+        std::vector<std::shared_ptr<const mesh>> coarse;
+        size_t coarseBytes;
+        std::vector<meshChunk> groups;
+        std::vector<groupSlot> groupSlots;
+        std::vector<bool> groupVisible;
+        std::vector<float> groupPriority;
+        // Fine chunks of each group, by index into fine
+        std::vector<std::vector<int>> groupChunks;
+
+        // Camera position last update, motion since is used to prefetch ahead
+        vertex lastEye;
+        bool hasLastEye;
+        size_t resident;
+        int reading;            // chunks the pool's threads are reading for this mesh
+        std::vector<int> order;
+        frameVector<triangle> chunkTriangles;
+};
+
+#endif
@@ -0,0 +1,317 @@
+#include <SDL2/SDL.h>
+#include "particleSystem.h"
+#include "workerPool.h"
+#include <iostream>
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+// Particles per task when the update is split over workers
+static const int integrateBlock = 16384;
+// Lifetimes vary by this much either way, the pool leaves room for the longest
+static const float lifetimeJitter = 0.25f;
+static const int spotSize = 32;
+// Sort digits, three passes cover a 32 bit key
+static const int radixBits = 11;
+
+// One run of particles through a step of dt. No calls or branches, so the
+// compiler vectorizes it (see the Makefile). Free slots have no velocity or
+// gravity and just stand still
+static void integrateRun(float *__restrict px, float *__restrict py, float *__restrict pz,
+                         float *__restrict vx, float *__restrict vy, float *__restrict vz,
+                         float *__restrict age, const float *__restrict gravity, const float *__restrict drag,
+                         size_t count, float dt)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        float keep = 1.0f - drag[i] * dt;
+        keep = keep > 0.0f ? keep : 0.0f;
+        vx[i] = vx[i] * keep;
+        vy[i] = (vy[i] - gravity[i] * dt) * keep;
+        vz[i] = vz[i] * keep;
+        px[i] += vx[i] * dt;
+        py[i] += vy[i] * dt;
+        pz[i] += vz[i] * dt;
+        age[i] += dt;
+    }
+}
+
+ParticleSystem::ParticleSystem(SDL_Renderer *_render)
+{
+    render = _render;
+    seed = 2024;
+}
+
+float ParticleSystem::random()
+{
+    seed = seed * 1664525u + 1013904223u;
+    return float(seed >> 8) / float(1 << 24);
+}
+
+void ParticleSystem::reserve(size_t slots)
+{
+    if (slots <= x.size())
+        return;
+    for (particleVector<float> *field : { &x, &y, &z, &vx, &vy, &vz, &age, &lifetime, &gravity, &drag, &size,
+                                          &screenX, &screenY, &halfWidth, &halfHeight, &depth })
+        field->resize(slots, 0.0f);
+    emitter.resize(slots, -1);
+    slot.resize(slots);
+    keys.resize(slots);
+    keysSwap.resize(slots);
+    order.resize(slots);
+    orderSwap.resize(slots);
+    freeSlots.reserve(slots);
+}
+
+void ParticleSystem::addEmitter(const particleEmitter &added)
+{
+    if (!added.texture && !spot)
+    {
+        // White with a soft round edge in alpha, so the emitter's colour shows through
+        std::vector<Uint32> pixels(spotSize * spotSize);
+        for (int py = 0; py < spotSize; py++)
+        {
+            for (int px = 0; px < spotSize; px++)
+            {
+                float dx = (px + 0.5f) / spotSize * 2.0f - 1.0f;
+                float dy = (py + 0.5f) / spotSize * 2.0f - 1.0f;
+                float falloff = std::max(0.0f, 1.0f - (dx * dx + dy * dy));
+                Uint32 alpha = Uint32(255.0f * falloff * falloff);
+                // RGBA32 is the bytes in that order, whatever the endianness
+                Uint8 bytes[4] = { 255, 255, 255, Uint8(alpha) };
+                memcpy(&pixels[py * spotSize + px], bytes, 4);
+            }
+        }
+        SDL_Texture *created = SDL_CreateTexture(render, SDL_PIXELFORMAT_RGBA32, SDL_TEXTUREACCESS_STATIC, spotSize, spotSize);
+        if (!created)
+        {
+            std::cout << "Failed to create particle texture: " << SDL_GetError() << std::endl;
+        }
+        else
+        {
+            SDL_UpdateTexture(created, NULL, pixels.data(), spotSize * 4);
+            SDL_SetTextureBlendMode(created, SDL_BLENDMODE_BLEND);
+            spot = trackedTexture(created, pixels.size() * 4);
+        }
+    }
+
+    emitters.push_back(added);
+    owed.push_back(0.0f);
+
+    // Room for every emitter at its steady state, so update never has to grow the pool
+    size_t slots = 0;
+    for (const particleEmitter &e : emitters)
+        slots += size_t(ceilf(e.rate * e.lifetime * (1.0f + lifetimeJitter))) + 1;
+    reserve(slots);
+}
+
+void ParticleSystem::clearEmitters()
+{
+    emitters.clear();
+    owed.clear();
+    std::fill(emitter.begin(), emitter.end(), -1);
+    freeSlots.clear();
+    used = 0;
+    live = 0;
+    billboards = 0;
+}
+
+void ParticleSystem::spawn(int index, Uint32 count)
+{
+    const particleEmitter &source = emitters[index];
+    for (Uint32 n = 0; n < count; n++)
+    {
+        size_t i;
+        if (!freeSlots.empty())
+        {
+            i = freeSlots.back();
+            freeSlots.pop_back();
+        }
+        else if (used < x.size())
+        {
+            i = used++;
+        }
+        else
+        {
+            return;
+        }
+        x[i] = source.position.x;
+        y[i] = source.position.y;
+        z[i] = source.position.z;
+        vx[i] = source.velocity.x + source.spread * (random() * 2.0f - 1.0f);
+        vy[i] = source.velocity.y + source.spread * (random() * 2.0f - 1.0f);
+        vz[i] = source.velocity.z + source.spread * (random() * 2.0f - 1.0f);
+        age[i] = 0.0f;
+        lifetime[i] = source.lifetime * (1.0f + lifetimeJitter * (random() * 2.0f - 1.0f));
+        gravity[i] = source.gravity;
+        drag[i] = source.drag;
+        size[i] = source.size;
+        emitter[i] = index;
+        live++;
+    }
+}
+
+void ParticleSystem::update(float dt, WorkerPool *workers)
+{
+    if (emitters.empty())
+        return;
+
+    int blocks = int((used + integrateBlock - 1) / integrateBlock);
+    auto integrate = [&](int block)
+    {
+        size_t first = size_t(block) * integrateBlock;
+        size_t count = std::min<size_t>(integrateBlock, used - first);
+        integrateRun(&x[first], &y[first], &z[first], &vx[first], &vy[first], &vz[first], &age[first],
+                     &gravity[first], &drag[first], count, dt);
+    };
+    if (workers && blocks > 1)
+        workers->parallelFor(blocks, integrate);
+    else
+        for (int block = 0; block < blocks; block++)
+            integrate(block);
+
+    // Expired particles go back on the free list before the emitters take new ones
+    for (size_t i = 0; i < used; i++)
+    {
+        if (emitter[i] >= 0 && age[i] >= lifetime[i])
+        {
+            emitter[i] = -1;
+            vx[i] = vy[i] = vz[i] = 0.0f;
+            gravity[i] = 0.0f;
+            freeSlots.push_back(int(i));
+            live--;
+        }
+    }
+
+    for (size_t e = 0; e < emitters.size(); e++)
+    {
+        owed[e] += emitters[e].rate * dt;
+        Uint32 count = Uint32(owed[e]);
+        owed[e] -= float(count);
+        spawn(int(e), count);
+    }
+}
+
+void ParticleSystem::prepareBillboards(const matrix4 &viewMatrix, const matrix4 &projectionMatrix, float nearPlane, int width, int height)
+{
+    // View space by the affine part of the view matrix, then straight to the
+    // window. Every particle is written out and only the ones kept advance the
+    // count, so the loop has no branches to mispredict
+    const matrix4 &m = viewMatrix;
+    float projectX = projectionMatrix.m[0][0];
+    float projectY = projectionMatrix.m[1][1];
+    float halfW = 0.5f * width;
+    float halfH = 0.5f * height;
+    size_t n = 0;
+    for (size_t i = 0; i < used; i++)
+    {
+        float cx = x[i] * m.m[0][0] + y[i] * m.m[1][0] + z[i] * m.m[2][0] + m.m[3][0];
+        float cy = x[i] * m.m[0][1] + y[i] * m.m[1][1] + z[i] * m.m[2][1] + m.m[3][1];
+        float cz = x[i] * m.m[0][2] + y[i] * m.m[1][2] + z[i] * m.m[2][2] + m.m[3][2];
+
+        // Facing the camera, so the quad stays a square on screen at the centre's depth
+        float inverseZ = 1.0f / cz;
+        float sx = (cx * projectX * inverseZ + 1.0f) * halfW;
+        float sy = (1.0f - cy * projectY * inverseZ) * halfH;
+        float hw = size[i] * projectX * inverseZ * halfW;
+        float hh = size[i] * projectY * inverseZ * halfH;
+        // The same depth a projected triangle's corners carry, past the near plane it is above 0
+        float ndcDepth = projectionMatrix.m[2][2] + projectionMatrix.m[3][2] * inverseZ;
+
+        screenX[n] = sx;
+        screenY[n] = sy;
+        halfWidth[n] = hw;
+        halfHeight[n] = hh;
+        depth[n] = ndcDepth;
+        slot[n] = int(i);
+        memcpy(&keys[n], &ndcDepth, sizeof(float));
+        order[n] = int(n);
+        bool kept = (emitter[i] >= 0) & (cz > nearPlane) & (sx + hw >= 0.0f) & (sx - hw <= width) &
+                    (sy + hh >= 0.0f) & (sy - hh <= height);
+        n += kept;
+    }
+    billboards = n;
+
+    // Positive floats order the same as their bits, so an LSD radix sort on
+    // those puts them near to far without any comparisons
+    for (int shift = 0; shift < 32; shift += radixBits)
+    {
+        Uint32 counts[1 << radixBits] = { 0 };
+        Uint32 mask = (1u << radixBits) - 1;
+        for (size_t n = 0; n < billboards; n++)
+            counts[(keys[n] >> shift) & mask]++;
+        // Depths share their exponent, so the top digit often says nothing
+        if (billboards == 0 || counts[(keys[0] >> shift) & mask] == billboards)
+            continue;
+        Uint32 total = 0;
+        for (Uint32 &count : counts)
+        {
+            Uint32 here = count;
+            count = total;
+            total += here;
+        }
+        for (size_t n = 0; n < billboards; n++)
+        {
+            Uint32 to = counts[(keys[n] >> shift) & mask]++;
+            keysSwap[to] = keys[n];
+            orderSwap[to] = order[n];
+        }
+        keys.swap(keysSwap);
+        order.swap(orderSwap);
+    }
+}
+
+size_t ParticleSystem::recordBillboards(CommandBuffer &commands, size_t first, float behind)
+{
+    size_t next = first;
+    while (next < billboards)
+    {
+        // A run of particles with the same texture, all behind the depth given
+        SDL_Texture *texture = NULL;
+        size_t end = next;
+        while (end < billboards)
+        {
+            int n = order[billboards - 1 - end];
+            if (depth[n] <= behind)
+                break;
+            const particleEmitter &source = emitters[emitter[slot[n]]];
+            SDL_Texture *particleTexture = source.texture ? source.texture.get() : spot.get();
+            if (end > next && particleTexture != texture)
+                break;
+            texture = particleTexture;
+            end++;
+        }
+        if (end == next)
+            break;
+
+        SDL_Vertex *out = commands.appendGeometry(texture, Uint32((end - next) * 6));
+        for (; next < end; next++)
+        {
+            int n = order[billboards - 1 - next];
+            int i = slot[n];
+            const particleEmitter &source = emitters[emitter[i]];
+            float fade = std::max(0.0f, 1.0f - age[i] / lifetime[i]);
+            SDL_Color color = source.color;
+            color.a = Uint8(color.a * fade);
+            float left = screenX[n] - halfWidth[n];
+            float right = screenX[n] + halfWidth[n];
+            float top = screenY[n] - halfHeight[n];
+            float bottom = screenY[n] + halfHeight[n];
+            SDL_Vertex corners[4] = {
+                { { left, top }, color, { 0.0f, 0.0f } },
+                { { right, top }, color, { 1.0f, 0.0f } },
+                { { right, bottom }, color, { 1.0f, 1.0f } },
+                { { left, bottom }, color, { 0.0f, 1.0f } },
+            };
+            out[0] = corners[0];
+            out[1] = corners[1];
+            out[2] = corners[2];
+            out[3] = corners[0];
+            out[4] = corners[2];
+            out[5] = corners[3];
+            out += 6;
+        }
+    }
+    return next;
+}
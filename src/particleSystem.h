@@ -0,0 +1,61 @@
+#include <SDL2/SDL.h>
+#include <vector>
+#include "graphicsEngine.h"
+#include "commandBuffer.h"
+
+#ifndef PARTICLESYSTEM_H
+#define PARTICLESYSTEM_H
+
+// Particles from every emitter in one pool, a separate array per field so the
+// update runs over plain floats. Slots are sized when emitters are added and
+// recycled through a free list, so running frames never allocates
+class ParticleSystem
+{
+    public:
+        ParticleSystem(SDL_Renderer *_render);
+        void addEmitter(const particleEmitter &emitter);
+        void clearEmitters();
+        // Spawns what the emitters owe for dt seconds and moves every particle,
+        // split over the workers when there are enough of them
+        void update(float dt, WorkerPool *workers);
+        // Projects the live particles to screen squares and sorts them back to
+        // front by the same depth the triangles are sorted by
+        void prepareBillboards(const matrix4 &viewMatrix, const matrix4 &projectionMatrix, float nearPlane, int width, int height);
+        // Writes sorted billboards from the first'th on straight into the command
+        // buffer, for as long as their depth is beyond behind. Returns where it stopped
+        size_t recordBillboards(CommandBuffer &commands, size_t first, float behind);
+
+        size_t liveCount() const { return live; }
+        size_t billboardCount() const { return billboards; }
+        size_t emitterCount() const { return emitters.size(); }
+
+    private:
+        void reserve(size_t slots);
+        void spawn(int emitter, Uint32 count);
+        float random();
+
+        SDL_Renderer *render;
+        std::shared_ptr<SDL_Texture> spot;
+        std::vector<particleEmitter> emitters;
+        std::vector<float> owed;    // fractions of a particle carried to the next update
+        Uint32 seed;
+
+        // One entry per slot
+        particleVector<float> x, y, z;
+        particleVector<float> vx, vy, vz;
+        particleVector<float> age, lifetime;
+        particleVector<float> gravity, drag, size;
+        particleVector<int> emitter;    // -1 when the slot is free
+        particleVector<int> freeSlots;
+        size_t used = 0;            // slots ever handed out, the rest were never touched
+        size_t live = 0;
+
+        // Visible particles of the frame, in slot order, then their sorted order
+        particleVector<float> screenX, screenY, halfWidth, halfHeight, depth;
+        particleVector<int> slot;
+        particleVector<Uint32> keys, keysSwap;
+        particleVector<int> order, orderSwap;
+        size_t billboards = 0;
+};
+
+#endif
@@ -0,0 +1,124 @@
+#include <SDL2/SDL.h>
+#include "quantizedMesh.h"
+#include <cmath>
+#include <cfloat>
+#include <algorithm>
+
+static Uint16 quantize(float value, float origin, float step)
+{
+    if (step <= 0.0f)
+        return 0;
+    float q = (value - origin) / step + 0.5f;
+    return static_cast<Uint16>(std::min(std::max(q, 0.0f), 65535.0f));
+}
+
+void quantizeMesh(const mesh &m, quantizedMesh &packed)
+{
+    vertex boundsMin, boundsMax;
+    meshBounds(m, boundsMin, boundsMax);
+
+    coord uvMin = { 0.0f, 0.0f };
+    coord uvMax = { 0.0f, 0.0f };
+    if (!m.triangles.empty())
+    {
+        uvMin = m.triangles[0].t[0];
+        uvMax = m.triangles[0].t[0];
+    }
+    for (const auto &tri : m.triangles)
+    {
+        for (int i = 0; i < 3; i++)
+        {
+            uvMin.u = std::min(uvMin.u, tri.t[i].u);
+            uvMin.v = std::min(uvMin.v, tri.t[i].v);
+            uvMax.u = std::max(uvMax.u, tri.t[i].u);
+            uvMax.v = std::max(uvMax.v, tri.t[i].v);
+        }
+    }
+
+    packed.origin = boundsMin;
+    packed.step = scaleV(subtractV(boundsMax, boundsMin), 1.0f / 65535.0f);
+    packed.uvOrigin = uvMin;
+    packed.uvStep = { (uvMax.u - uvMin.u) / 65535.0f, (uvMax.v - uvMin.v) / 65535.0f };
+
+    packed.triangles.resize(m.triangles.size());
+    for (size_t n = 0; n < m.triangles.size(); n++)
+    {
+        const triangle &tri = m.triangles[n];
+        quantizedTriangle &q = packed.triangles[n];
+        for (int i = 0; i < 3; i++)
+        {
+            q.v[i][0] = quantize(tri.v[i].x, packed.origin.x, packed.step.x);
+            q.v[i][1] = quantize(tri.v[i].y, packed.origin.y, packed.step.y);
+            q.v[i][2] = quantize(tri.v[i].z, packed.origin.z, packed.step.z);
+            q.t[i][0] = quantize(tri.t[i].u, packed.uvOrigin.u, packed.uvStep.u);
+            q.t[i][1] = quantize(tri.t[i].v, packed.uvOrigin.v, packed.uvStep.v);
+        }
+    }
+}
+
+float quantizationError(const mesh &m, const quantizedMesh &packed)
+{
+    float worst = 0.0f;
+    for (size_t n = 0; n < m.triangles.size() && n < packed.triangles.size(); n++)
+    {
+        for (int i = 0; i < 3; i++)
+        {
+            const Uint16 *q = packed.triangles[n].v[i];
+            const vertex &original = m.triangles[n].v[i];
+            worst = std::max(worst, fabsf(packed.origin.x + q[0] * packed.step.x - original.x));
+            worst = std::max(worst, fabsf(packed.origin.y + q[1] * packed.step.y - original.y));
+            worst = std::max(worst, fabsf(packed.origin.z + q[2] * packed.step.z - original.z));
+        }
+    }
+    return worst;
+}
+
+float quantizationBound(const quantizedMesh &packed)
+{
+    float step = std::max(packed.step.x, std::max(packed.step.y, packed.step.z));
+    vertex far = addV(packed.origin, scaleV(packed.step, 65535.0f));
+    float magnitude = std::max(std::max(fabsf(packed.origin.x), fabsf(far.x)),
+                      std::max(std::max(fabsf(packed.origin.y), fabsf(far.y)), std::max(fabsf(packed.origin.z), fabsf(far.z))));
+    return 0.5f * step + 4.0f * FLT_EPSILON * magnitude;
+}
+
+void transformQuantized(const quantizedMesh &packed, const matrix4 &world, frameVector<triangle> &out)
+{
+    // decoded * world == q * (scale(step) * translate(origin) * world)
+    matrix4 decode;
+    decode.m[0][0] = packed.step.x;
+    decode.m[1][1] = packed.step.y;
+    decode.m[2][2] = packed.step.z;
+    decode.m[3][0] = packed.origin.x;
+    decode.m[3][1] = packed.origin.y;
+    decode.m[3][2] = packed.origin.z;
+    decode.m[3][3] = 1.0f;
+    matrix4 m = multiplyM(decode, world);
+
+    // Plain locals so the compiler can keep the matrix in registers and vectorize
+    const float m00 = m.m[0][0], m01 = m.m[0][1], m02 = m.m[0][2];
+    const float m10 = m.m[1][0], m11 = m.m[1][1], m12 = m.m[1][2];
+    const float m20 = m.m[2][0], m21 = m.m[2][1], m22 = m.m[2][2];
+    const float m30 = m.m[3][0], m31 = m.m[3][1], m32 = m.m[3][2];
+    const float u0 = packed.uvOrigin.u, uStep = packed.uvStep.u;
+    const float v0 = packed.uvOrigin.v, vStep = packed.uvStep.v;
+
+    size_t count = packed.triangles.size();
+    out.resize(count);
+    const quantizedTriangle *in = packed.triangles.data();
+    triangle *result = out.data();
+    for (size_t n = 0; n < count; n++)
+    {
+        for (int i = 0; i < 3; i++)
+        {
+            float x = in[n].v[i][0];
+            float y = in[n].v[i][1];
+            float z = in[n].v[i][2];
+            result[n].v[i].x = x * m00 + y * m10 + z * m20 + m30;
+            result[n].v[i].y = x * m01 + y * m11 + z * m21 + m31;
+            result[n].v[i].z = x * m02 + y * m12 + z * m22 + m32;
+            result[n].t[i].u = u0 + in[n].t[i][0] * uStep;
+            result[n].t[i].v = v0 + in[n].t[i][1] * vStep;
+        }
+    }
+}
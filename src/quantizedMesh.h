@@ -0,0 +1,33 @@
+#include <SDL2/SDL.h>
+#include "graphicsEngine.h"
+
+#ifndef QUANTIZEDMESH_H
+#define QUANTIZEDMESH_H
+
+// Positions as 16 bit steps across the mesh bounding box and UVs as 16 bit
+// steps across the UV range: 30 bytes a triangle instead of 64
+struct quantizedTriangle
+{
+    Uint16 v[3][3];
+    Uint16 t[3][2];
+};
+
+struct quantizedMesh
+{
+    vertex origin;          // bounding box minimum
+    vertex step;            // bounding box size / 65535
+    coord uvOrigin;
+    coord uvStep;
+    meshVector<quantizedTriangle> triangles;
+};
+
+void quantizeMesh(const mesh &m, quantizedMesh &packed);
+// Largest distance on any axis between a decoded position and the original
+float quantizationError(const mesh &m, const quantizedMesh &packed);
+// What quantizationError may not exceed: half a step plus float rounding
+float quantizationBound(const quantizedMesh &packed);
+// Decodes and applies the world matrix in one pass, the dequantize scale and
+// offset are folded into the matrix so decoding costs one int to float convert
+void transformQuantized(const quantizedMesh &packed, const matrix4 &world, frameVector<triangle> &out);
+
+#endif
@@ -0,0 +1,220 @@
+#include <SDL2/SDL.h>
+#include <iostream>
+#include "renderBackend.h"
+#include "fontRenderer.h"
+
+// File layout: header, then per frame the texture table, commands, vertices
+// and text as raw arrays, each led by its count
+static const char fileMagic[4] = { 'S', 'C', 'M', 'D' };
+static const Uint32 fileVersion = 1;
+static const Uint32 frameMagic = 0x454D5246; // "FRME"
+
+SDLBackend::SDLBackend(SDL_Renderer *_render, FontRenderer *_font)
+{
+    render = _render;
+    font = _font;
+}
+
+void SDLBackend::submit(const CommandBuffer &commands)
+{
+    for (const auto &command : commands.commands)
+    {
+        switch (command.type)
+        {
+            case DrawCommandType::Clear:
+                SDL_SetRenderDrawColor(render, command.color.r, command.color.g, command.color.b, command.color.a);
+                SDL_RenderClear(render);
+                SDL_SetRenderDrawColor(render, 255, 255, 255, SDL_ALPHA_OPAQUE);
+                break;
+            case DrawCommandType::Geometry:
+            {
+                SDL_Texture *texture = command.texture >= 0 ? commands.textures[command.texture] : NULL;
+                SDL_RenderGeometry(render, texture, commands.vertices.data() + command.first, int(command.count), NULL, 0);
+                break;
+            }
+            case DrawCommandType::Text:
+            {
+                if (!font)
+                    break;
+                std::string line = commands.text.substr(command.first, command.count);
+                if (command.centered)
+                    font->renderTextCentered(render, line, int(command.x), int(command.y), command.scale,
+                                             command.color.r, command.color.g, command.color.b);
+                else
+                    font->renderText(render, line, int(command.x), int(command.y), command.scale,
+                                     command.color.r, command.color.g, command.color.b);
+                break;
+            }
+            case DrawCommandType::Viewport:
+            {
+                SDL_Rect rect = { int(command.x), int(command.y), int(command.first), int(command.count) };
+                SDL_RenderSetViewport(render, command.first > 0 ? &rect : NULL);
+                break;
+            }
+        }
+    }
+}
+
+void SDLBackend::present()
+{
+    SDL_RenderPresent(render);
+}
+
+void NullBackend::submit(const CommandBuffer &_commands)
+{
+    commands += (long long)_commands.commands.size();
+}
+
+template <typename T>
+static void writeArray(std::ofstream &file, const T *data, Uint32 count)
+{
+    file.write(reinterpret_cast<const char*>(&count), sizeof(count));
+    if (count > 0)
+        file.write(reinterpret_cast<const char*>(data), std::streamsize(sizeof(T)) * count);
+}
+
+template <typename T>
+static bool readArray(std::ifstream &file, std::vector<T> &out)
+{
+    Uint32 count = 0;
+    if (!file.read(reinterpret_cast<char*>(&count), sizeof(count)))
+        return false;
+    out.resize(count);
+    return count == 0 || bool(file.read(reinterpret_cast<char*>(out.data()), std::streamsize(sizeof(T)) * count));
+}
+
+FileBackend::FileBackend(const std::string &filename, AssetCache &_assets, RenderBackend *_next) : assets(_assets)
+{
+    next = _next;
+    frames = 0;
+    file.open(filename, std::ios::binary | std::ios::trunc);
+    if (!file.is_open())
+    {
+        std::cout << "Failed to open command recording: " << filename << std::endl;
+        return;
+    }
+    file.write(fileMagic, sizeof(fileMagic));
+    file.write(reinterpret_cast<const char*>(&fileVersion), sizeof(fileVersion));
+}
+
+bool FileBackend::isOpen()
+{
+    return file.is_open() && file.good();
+}
+
+int FileBackend::framesWritten()
+{
+    return frames;
+}
+
+void FileBackend::submit(const CommandBuffer &commands)
+{
+    if (isOpen())
+    {
+        file.write(reinterpret_cast<const char*>(&frameMagic), sizeof(frameMagic));
+        Uint32 textureCount = Uint32(commands.textures.size());
+        file.write(reinterpret_cast<const char*>(&textureCount), sizeof(textureCount));
+        for (SDL_Texture *texture : commands.textures)
+        {
+            std::string name = assets.textureFile(texture);
+            writeArray(file, name.data(), Uint32(name.size()));
+        }
+        writeArray(file, commands.commands.data(), Uint32(commands.commands.size()));
+        writeArray(file, commands.vertices.data(), Uint32(commands.vertices.size()));
+        writeArray(file, commands.text.data(), Uint32(commands.text.size()));
+        frames++;
+    }
+    if (next)
+        next->submit(commands);
+}
+
+void FileBackend::present()
+{
+    if (next)
+        next->present();
+}
+
+CommandReplay::CommandReplay(const std::string &filename, AssetCache &_assets) : assets(_assets)
+{
+    file.open(filename, std::ios::binary);
+    if (!file.is_open())
+    {
+        std::cout << "Failed to open command recording: " << filename << std::endl;
+        return;
+    }
+    char magic[4];
+    Uint32 version = 0;
+    file.read(magic, sizeof(magic));
+    file.read(reinterpret_cast<char*>(&version), sizeof(version));
+    if (!file || std::string(magic, 4) != std::string(fileMagic, 4) || version != fileVersion)
+    {
+        std::cout << "Failed to read command recording: " << filename << std::endl;
+        file.close();
+    }
+}
+
+bool CommandReplay::isOpen()
+{
+    return file.is_open();
+}
+
+void CommandReplay::rewind()
+{
+    if (!file.is_open())
+        return;
+    file.clear();
+    file.seekg(sizeof(fileMagic) + sizeof(fileVersion));
+}
+
+SDL_Texture *CommandReplay::resolveTexture(const std::string &filename)
+{
+    if (filename.empty())
+        return NULL;
+    auto found = textures.find(filename);
+    if (found == textures.end())
+        found = textures.emplace(filename, assets.loadTexture(filename)).first;
+    return found->second.get();
+}
+
+bool CommandReplay::readFrame(CommandBuffer &commands)
+{
+    commands.reset();
+    if (!file.is_open())
+        return false;
+
+    Uint32 magic = 0;
+    Uint32 textureCount = 0;
+    if (!file.read(reinterpret_cast<char*>(&magic), sizeof(magic)) || magic != frameMagic)
+        return false;
+    if (!file.read(reinterpret_cast<char*>(&textureCount), sizeof(textureCount)))
+        return false;
+    std::vector<char> name;
+    for (Uint32 i = 0; i < textureCount; i++)
+    {
+        if (!readArray(file, name))
+            return false;
+        commands.textures.push_back(resolveTexture(std::string(name.begin(), name.end())));
+    }
+
+    std::vector<SDL_Vertex> vertices;
+    std::vector<char> text;
+    if (!readArray(file, commands.commands) || !readArray(file, vertices) || !readArray(file, text))
+        return false;
+    commands.vertices.assign(vertices.begin(), vertices.end());
+    commands.text.assign(text.begin(), text.end());
+
+    // Ranges are trusted by the backends, so check them once here
+    for (const auto &command : commands.commands)
+    {
+        if (command.type == DrawCommandType::Viewport)
+            continue;
+        size_t limit = command.type == DrawCommandType::Text ? commands.text.size() : commands.vertices.size();
+        if (size_t(command.first) + command.count > limit || command.texture >= Sint32(commands.textures.size()))
+        {
+            std::cout << "Failed to read command recording: frame is damaged" << std::endl;
+            commands.reset();
+            return false;
+        }
+    }
+    return true;
+}
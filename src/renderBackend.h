@@ -0,0 +1,85 @@
+#include <SDL2/SDL.h>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include "commandBuffer.h"
+#include "assetCache.h"
+
+#ifndef RENDERBACKEND_H
+#define RENDERBACKEND_H
+
+class FontRenderer;
+
+// Consumes the command buffer a frame recorded. Splitting recording from
+// submission lets the pipeline and the driver be timed on their own
+class RenderBackend
+{
+    public:
+        virtual ~RenderBackend() {}
+        virtual void submit(const CommandBuffer &commands) = 0;
+        virtual void present() = 0;
+};
+
+// Draws through the SDL renderer, what frameRender used to do inline
+class SDLBackend : public RenderBackend
+{
+    public:
+        SDLBackend(SDL_Renderer *_render, FontRenderer *_font);
+        void submit(const CommandBuffer &commands) override;
+        void present() override;
+    private:
+        SDL_Renderer *render;
+        FontRenderer *font;
+};
+
+// Drops everything, so a run measures the pipeline alone
+class NullBackend : public RenderBackend
+{
+    public:
+        void submit(const CommandBuffer &commands) override;
+        void present() override {}
+        long long commandsSubmitted() const { return commands; }
+    private:
+        long long commands = 0;
+};
+
+// Appends each frame to a file, optionally passing it on to another backend
+// so a session can be drawn and recorded at once.
+// Textures are written by the path they were loaded from; ones that didn't
+// come from the asset cache (atlas pages) replay untextured
+class FileBackend : public RenderBackend
+{
+    public:
+        FileBackend(const std::string &filename, AssetCache &_assets, RenderBackend *_next = NULL);
+        bool isOpen();
+        int framesWritten();
+        void submit(const CommandBuffer &commands) override;
+        void present() override;
+    private:
+        std::ofstream file;
+        AssetCache &assets;
+        RenderBackend *next;
+        int frames;
+};
+
+// Reads frames written by FileBackend back into command buffers
+class CommandReplay
+{
+    public:
+        CommandReplay(const std::string &filename, AssetCache &_assets);
+        bool isOpen();
+        // False at the end of the file or on a damaged frame
+        bool readFrame(CommandBuffer &commands);
+        void rewind();
+    private:
+        SDL_Texture *resolveTexture(const std::string &filename);
+
+        std::ifstream file;
+        AssetCache &assets;
+        // Holds textures for the whole replay so they aren't reloaded each frame
+        std::unordered_map<std::string, std::shared_ptr<SDL_Texture>> textures;
+};
+
+#endif
@@ -0,0 +1,184 @@
+#include <SDL2/SDL.h>
+#include "scene.h"
+#include "terrain.h"
+#include <iostream>
+#include <sstream>
+
+bool loadSceneFile(const std::string &filename, AssetCache &assets, std::vector<meshInstance> &instances,
+                   std::vector<sceneLight> &lights, std::vector<particleEmitter> &emitters,
+                   MeshStorage storage)
+{
+    std::ifstream file(filename);
+    if (!file.is_open())
+    {
+        std::cout << "Failed to open scene: " << filename << std::endl;
+        return false;
+    }
+
+    std::vector<meshInstance> loaded;
+    std::vector<sceneLight> loadedLights;
+    std::vector<particleEmitter> loadedEmitters;
+    int lineNumber = 0;
+
+    std::string line;
+    while (std::getline(file, line))
+    {
+        lineNumber++;
+        std::istringstream ss(line);
+        std::string prefix;
+        ss >> prefix;
+
+        if (prefix.empty() || prefix[0] == '#')
+        {
+            continue;
+        }
+
+        if (prefix == "light" || prefix == "spot")
+        {
+            sceneLight light;
+            ss >> light.position.x >> light.position.y >> light.position.z;
+            if (prefix == "spot")
+                ss >> light.direction.x >> light.direction.y >> light.direction.z;
+            ss >> light.radius;
+            if (prefix == "spot")
+                ss >> light.coneAngle;
+            if (ss.fail() || light.radius <= 0.0f)
+            {
+                std::cout << filename << ":" << lineNumber << ": expected a position" << (prefix == "spot" ? ", a direction" : "")
+                          << " and a radius" << (prefix == "spot" ? " and a cone angle" : "") << std::endl;
+                return false;
+            }
+            // Colour is optional, white when missing
+            vertex color;
+            if (ss >> color.x >> color.y >> color.z)
+                light.color = color;
+            loadedLights.push_back(light);
+            continue;
+        }
+
+        if (prefix == "emitter")
+        {
+            particleEmitter emitter;
+            std::string textureName;
+            ss >> textureName >> emitter.position.x >> emitter.position.y >> emitter.position.z
+               >> emitter.velocity.x >> emitter.velocity.y >> emitter.velocity.z >> emitter.spread
+               >> emitter.rate >> emitter.lifetime >> emitter.size >> emitter.gravity >> emitter.drag;
+            if (ss.fail() || emitter.rate < 0.0f || emitter.lifetime <= 0.0f)
+            {
+                std::cout << filename << ":" << lineNumber << ": expected a texture (or -), a position, a velocity, a spread, "
+                          << "a rate, a lifetime, a size, gravity and drag" << std::endl;
+                return false;
+            }
+            // Colour is optional, white when missing, and alpha opaque
+            int r, g, b, a;
+            if (ss >> r >> g >> b)
+            {
+                emitter.color = { Uint8(r), Uint8(g), Uint8(b), 255 };
+                if (ss >> a)
+                    emitter.color.a = Uint8(a);
+            }
+            if (textureName != "-")
+            {
+                emitter.texture = assets.loadTexture(textureName);
+                if (!emitter.texture)
+                {
+                    return false;
+                }
+            }
+            loadedEmitters.push_back(emitter);
+            continue;
+        }
+
+        if (prefix == "terrain")
+        {
+            meshInstance instance;
+            terrainSettings settings;
+            std::string heightmapName;
+            std::string textureName;
+            ss >> heightmapName >> textureName >> instance.position.x >> instance.position.y >> instance.position.z
+               >> settings.spacing >> settings.heightScale;
+            if (ss.fail() || settings.spacing <= 0.0f)
+            {
+                std::cout << filename << ":" << lineNumber << ": expected a heightmap, a texture (or -), a position, "
+                          << "a spacing and a height scale" << std::endl;
+                return false;
+            }
+            // Budget and error are optional, the defaults when missing
+            if (ss >> settings.triangleBudget)
+                ss >> settings.pixelError;
+            instance.terrain = assets.loadTerrain(heightmapName, settings);
+            if (!instance.terrain)
+            {
+                return false;
+            }
+            if (textureName != "-")
+            {
+                instance.texture = assets.loadTexture(textureName);
+                if (!instance.texture)
+                {
+                    return false;
+                }
+            }
+            loaded.push_back(instance);
+            continue;
+        }
+
+        if (prefix != "instance" && prefix != "animated")
+        {
+            std::cout << filename << ":" << lineNumber << ": unknown entry '" << prefix << "'" << std::endl;
+            return false;
+        }
+
+        std::string meshName;
+        std::string rigName;
+        std::string textureName;
+        ss >> meshName;
+        if (prefix == "animated")
+            ss >> rigName;
+        ss >> textureName;
+        if (meshName.empty() || textureName.empty())
+        {
+            std::cout << filename << ":" << lineNumber << ": expected a mesh" << (prefix == "animated" ? ", a rig" : "")
+                      << " and a texture (or -)" << std::endl;
+            return false;
+        }
+
+        meshInstance instance;
+        bool textured = textureName != "-";
+
+        // Transform fields are optional, stop at the first one missing
+        float yaw = 0.0f;
+        float pitch = 0.0f;
+        ss >> instance.position.x >> instance.position.y >> instance.position.z >> yaw >> pitch >> instance.scale;
+        instance.yaw = yaw / 180.0f * 3.14159f;
+        instance.pitch = pitch / 180.0f * 3.14159f;
+
+        if (!rigName.empty())
+        {
+            instance.skinned = assets.loadSkinnedMesh(meshName, rigName);
+            if (!instance.skinned)
+            {
+                return false;
+            }
+        }
+        else if (!assets.loadInstanceMesh(meshName, textured, storage, instance))
+        {
+            return false;
+        }
+        if (textured)
+        {
+            instance.texture = assets.loadTexture(textureName);
+            if (!instance.texture)
+            {
+                return false;
+            }
+        }
+
+        loaded.push_back(instance);
+    }
+
+    instances = loaded;
+    lights = loadedLights;
+    emitters = loadedEmitters;
+    return true;
+}
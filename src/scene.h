@@ -0,0 +1,23 @@
+#include "graphicsEngine.h"
+
+#ifndef SCENE_H
+#define SCENE_H
+
+// Scene files list one mesh instance per line:
+//     instance <mesh.obj> <texture.bmp | -> [x y z [yaw pitch [scale]]]
+//     animated <mesh.obj> <rig> <texture.bmp | -> [x y z [yaw pitch [scale]]]
+// heightmap terrain, its corner at x y z, with the texture stretched over all of it:
+//     terrain <heightmap.bmp> <texture.bmp | -> <x y z> <spacing> <height scale> [triangle budget [pixel error]]
+// and lights, one per line, colour channels from 0 to 1 (or above for brighter):
+//     light <x y z> <radius> [r g b]
+//     spot <x y z> <dx dy dz> <radius> <cone angle> [r g b]
+// and particle emitters, colour and alpha from 0 to 255:
+//     emitter <texture.bmp | -> <x y z> <vx vy vz> <spread> <rate> <lifetime> <size> <gravity> <drag> [r g b [a]]
+// Angles are in degrees. Lines starting with '#' are comments.
+// Meshes and textures go through the asset cache, so repeated paths are shared.
+// Static meshes are held in the given storage, animated ones always skinned.
+bool loadSceneFile(const std::string &filename, AssetCache &assets, std::vector<meshInstance> &instances,
+                   std::vector<sceneLight> &lights, std::vector<particleEmitter> &emitters,
+                   MeshStorage storage = MeshStorage::Float);
+
+#endif
@@ -0,0 +1,314 @@
+#include <SDL2/SDL.h>
+#include "stressScene.h"
+#include <iostream>
+#include <sstream>
+#include <fstream>
+#include <chrono>
+#include <cmath>
+#include <algorithm>
+
+// Generated textures are small, the point is how many there are
+static const int stressTextureSize = 64;
+// Distance of the first instance in each column, the rest follow at the same spacing
+static const float layerSpacing = 4.0f;
+// Part of the screen the columns are spread over, and of each column's cell an instance fills
+static const float screenFill = 0.8f;
+static const float cellFill = 0.9f;
+
+static Uint32 nextRandom(Uint32 &seed)
+{
+    seed = seed * 1664525u + 1013904223u;
+    return seed >> 8;
+}
+
+bool parseStressSettings(const std::string &spec, stressSettings &settings)
+{
+    if (spec == "-")
+        return true;
+
+    std::stringstream ss(spec);
+    std::string pair;
+    while (std::getline(ss, pair, ','))
+    {
+        size_t equals = pair.find('=');
+        if (equals == std::string::npos)
+        {
+            std::cout << "Failed to parse stress setting: " << pair << std::endl;
+            return false;
+        }
+        std::string key = pair.substr(0, equals);
+        // Read as a double so counts can be written as 1e7
+        double value = std::atof(pair.c_str() + equals + 1);
+        if (key == "triangles")
+            settings.triangles = std::max(1LL, (long long)value);
+        else if (key == "instances")
+            settings.instances = std::max(1, int(value));
+        else if (key == "depth")
+            settings.depthComplexity = std::max(1, int(value));
+        else if (key == "textures")
+            settings.textures = std::max(0, int(value));
+        else if (key == "offscreen")
+            settings.offscreen = std::max(0.0f, std::min(1.0f, float(value)));
+        else if (key == "seed")
+            settings.seed = Uint32(value);
+        else
+        {
+            std::cout << "Failed to parse stress setting: " << pair << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+void buildStressMesh(int triangles, mesh &m)
+{
+    // A fan at each pole and two triangles per slice in every band between,
+    // 2 * slices * (stacks - 1) in all
+    int stacks = std::max(2, int(sqrtf(triangles / 4.0f) + 0.5f));
+    int slices = std::max(3, triangles / (2 * (stacks - 1)));
+
+    auto point = [&](int stack, int slice, vertex &v, coord &t)
+    {
+        float phi = 3.14159265f * stack / stacks;
+        float theta = 2.0f * 3.14159265f * slice / slices;
+        v = { sinf(phi) * cosf(theta), cosf(phi), sinf(phi) * sinf(theta) };
+        t = { float(slice) / slices, 1.0f - float(stack) / stacks };
+    };
+    auto add = [&](int s0, int l0, int s1, int l1, int s2, int l2)
+    {
+        triangle tri;
+        point(s0, l0, tri.v[0], tri.t[0]);
+        point(s1, l1, tri.v[1], tri.t[1]);
+        point(s2, l2, tri.v[2], tri.t[2]);
+        tri.lightIntensity = 1.0f;
+        // Wound so the normal points away from the centre, which is what survives backface culling
+        vertex normal = crossProduct(subtractV(tri.v[1], tri.v[0]), subtractV(tri.v[2], tri.v[0]));
+        if (dotProduct(normal, addV(addV(tri.v[0], tri.v[1]), tri.v[2])) < 0.0f)
+        {
+            std::swap(tri.v[1], tri.v[2]);
+            std::swap(tri.t[1], tri.t[2]);
+        }
+        m.triangles.push_back(tri);
+    };
+
+    m.triangles.clear();
+    m.triangles.reserve(size_t(2) * slices * (stacks - 1));
+    for (int stack = 0; stack < stacks; stack++)
+    {
+        for (int slice = 0; slice < slices; slice++)
+        {
+            if (stack > 0)
+                add(stack, slice, stack, slice + 1, stack + 1, slice);
+            if (stack < stacks - 1)
+                add(stack, slice + 1, stack + 1, slice + 1, stack + 1, slice);
+        }
+    }
+}
+
+static std::shared_ptr<SDL_Texture> createStressTexture(SDL_Renderer *render, Uint32 &seed)
+{
+    // A checkerboard in two random colours
+    Uint32 colors[2];
+    for (Uint32 &color : colors)
+    {
+        Uint32 bits = nextRandom(seed);
+        color = 0xFF000000u | (bits & 0x00FFFFFFu);
+    }
+    std::vector<Uint32> pixels(size_t(stressTextureSize) * stressTextureSize);
+    for (int y = 0; y < stressTextureSize; y++)
+        for (int x = 0; x < stressTextureSize; x++)
+            pixels[size_t(y) * stressTextureSize + x] = colors[((x / 8) + (y / 8)) & 1];
+
+    SDL_Texture *created = SDL_CreateTexture(render, SDL_PIXELFORMAT_RGBA32, SDL_TEXTUREACCESS_STATIC, stressTextureSize, stressTextureSize);
+    if (!created)
+    {
+        std::cout << "Failed to create stress texture: " << SDL_GetError() << std::endl;
+        return nullptr;
+    }
+    SDL_UpdateTexture(created, NULL, pixels.data(), stressTextureSize * 4);
+    return trackedTexture(created, pixels.size() * 4);
+}
+
+bool generateStressScene(const stressSettings &settings, SDL_Renderer *render, const vertex &cameraPosition,
+                         float projectX, float projectY, std::vector<meshInstance> &instances)
+{
+    // One mesh shared by every instance, the way the asset cache shares a model
+    int perInstance = int(std::max(8LL, std::min<long long>(settings.triangles / settings.instances, 1 << 30)));
+    std::shared_ptr<mesh> sphere = std::make_shared<mesh>();
+    buildStressMesh(perInstance, *sphere);
+
+    Uint32 seed = settings.seed;
+    std::vector<std::shared_ptr<SDL_Texture>> textures;
+    for (int i = 0; i < settings.textures; i++)
+    {
+        textures.push_back(createStressTexture(render, seed));
+        if (!textures.back())
+            return false;
+    }
+
+    // Columns on a grid across the screen. Each instance in a column sits further
+    // away and is scaled up with distance, so it covers exactly the ones in front
+    int offscreen = int(settings.offscreen * settings.instances + 0.5f);
+    int onscreen = settings.instances - offscreen;
+    int columns = std::max(1, (onscreen + settings.depthComplexity - 1) / settings.depthComplexity);
+    int gridX = int(ceilf(sqrtf(float(columns))));
+    int gridY = (columns + gridX - 1) / gridX;
+    float cellX = screenFill / gridX;
+    float cellY = screenFill / gridY;
+    float radius = cellFill * std::min(cellX / projectX, cellY / projectY);
+
+    instances.clear();
+    instances.reserve(settings.instances);
+    for (int i = 0; i < settings.instances; i++)
+    {
+        // Off-screen instances take the same places mirrored behind the camera
+        bool behind = i >= onscreen;
+        int slot = behind ? i - onscreen : i;
+        int column = slot % columns;
+        int layer = slot / columns;
+        float ndcX = -screenFill + cellX * (2 * (column % gridX) + 1);
+        float ndcY = screenFill - cellY * (2 * (column / gridX) + 1);
+        float distance = layerSpacing * (layer + 1);
+
+        meshInstance instance;
+        instance.model = sphere;
+        if (!textures.empty())
+            instance.texture = textures[i % textures.size()];
+        instance.position = { cameraPosition.x + ndcX * distance / projectX, cameraPosition.y + ndcY * distance / projectY,
+                              cameraPosition.z + (behind ? -distance : distance) };
+        instance.scale = radius * distance;
+        instance.yaw = float(nextRandom(seed) % 360);
+        instances.push_back(instance);
+    }
+    return true;
+}
+
+// The values one setting is swept over, small to large
+struct sweepAxis
+{
+    const char *name;
+    std::vector<double> values;
+};
+
+static void setAxis(stressSettings &settings, const std::string &name, double value)
+{
+    if (name == "triangles")
+        settings.triangles = (long long)value;
+    else if (name == "instances")
+        settings.instances = int(value);
+    else if (name == "depth")
+        settings.depthComplexity = int(value);
+    else if (name == "textures")
+        settings.textures = int(value);
+    else if (name == "offscreen")
+        settings.offscreen = float(value);
+}
+
+bool runStressSweep(Renderer &renderer, const stressSettings &base, long long maxTriangles, const std::string &csvFile)
+{
+    std::ofstream csv(csvFile, std::ios::trunc);
+    if (!csv.is_open())
+    {
+        std::cout << "Failed to open sweep output: " << csvFile << std::endl;
+        return false;
+    }
+    csv << "setting,value,triangles,instances,depth,textures,offscreen,batches,geometry_ms,sort_ms,shading_ms,record_ms,submit_ms,frame_ms"
+        << std::endl;
+
+    std::vector<double> triangleCounts;
+    for (long long count = 16384; count <= maxTriangles; count *= 4)
+        triangleCounts.push_back(double(count));
+    std::vector<sweepAxis> axes = {
+        { "triangles", triangleCounts },
+        { "instances", { 1, 4, 16, 64, 256, 1024, 4096 } },
+        { "depth", { 1, 2, 4, 8, 16, 32 } },
+        { "textures", { 0, 1, 4, 16, 64, 256 } },
+        { "offscreen", { 0.0, 0.25, 0.5, 0.75, 0.9 } },
+    };
+
+    // Frames per point, the first few to warm up
+    const int warmupFrames = 2;
+    const int timedFrames = 8;
+    const char stageMarks[] = "gslrb";
+    const char *stageNames[] = { "geometry", "sort", "shading", "record", "submit" };
+
+    // The HUD is the same at every point and would only blur the record stage
+    renderer.setShowHud(false);
+    renderer.setFixedTimestep(1.0f / 60.0f);
+    for (const sweepAxis &axis : axes)
+    {
+        std::vector<std::pair<double, std::vector<double>>> points;
+        for (double value : axis.values)
+        {
+            stressSettings settings = base;
+            setAxis(settings, axis.name, value);
+            if (settings.triangles > maxTriangles)
+                continue;
+
+            // Generated around the camera as it starts, so every point sees the same view
+            renderer.getCamera() = cameraState();
+            if (!renderer.loadStressScene(settings))
+                return false;
+
+            std::vector<double> stages(6, 0.0);
+            for (int frame = 0; frame < warmupFrames + timedFrames; frame++)
+            {
+                auto frameStart = std::chrono::high_resolution_clock::now();
+                renderer.frameRender();
+                double frameTime = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - frameStart).count();
+                if (frame < warmupFrames)
+                    continue;
+                const frameStages &times = renderer.getStageTimes();
+                stages[0] += times.geometry;
+                stages[1] += times.sort;
+                stages[2] += times.shading;
+                stages[3] += times.record;
+                stages[4] += times.submit;
+                stages[5] += frameTime;
+            }
+            for (double &stage : stages)
+                stage = stage * 1000.0 / timedFrames;
+
+            csv << axis.name << "," << value << "," << settings.triangles << "," << settings.instances << ","
+                << settings.depthComplexity << "," << settings.textures << "," << settings.offscreen << ","
+                << renderer.getDrawBatches();
+            for (double stage : stages)
+                csv << "," << stage;
+            csv << std::endl;
+            points.push_back({ value, stages });
+
+            // Past a second per frame the next point only says the same thing slower
+            if (stages[5] > 1000.0)
+                break;
+        }
+        if (points.empty())
+            continue;
+
+        // One bar per point, a letter per stage in proportion to its share of the slowest frame
+        double slowest = 0.0;
+        for (const auto &point : points)
+            slowest = std::max(slowest, point.second[5]);
+        std::cout << axis.name << "  (g geometry, s sort, l shading, r record, b submit)" << std::endl;
+        for (const auto &point : points)
+        {
+            char label[64];
+            snprintf(label, sizeof(label), "%12g %9.3f ms |", point.first, point.second[5]);
+            std::string bar;
+            for (int stage = 0; stage < 5; stage++)
+                bar.append(size_t(60.0 * point.second[stage] / std::max(slowest, 1e-9) + 0.5), stageMarks[stage]);
+            std::cout << label << bar << std::endl;
+        }
+
+        // The stage that moves the most from the first point to the last is the one this setting loads
+        int worst = 0;
+        for (int stage = 1; stage < 5; stage++)
+        {
+            if (fabs(points.back().second[stage] - points.front().second[stage]) >
+                fabs(points.back().second[worst] - points.front().second[worst]))
+                worst = stage;
+        }
+        std::cout << "  " << stageNames[worst] << " follows " << axis.name << " the most" << std::endl << std::endl;
+    }
+    std::cout << "Sweep written to " << csvFile << std::endl;
+    return true;
+}
@@ -0,0 +1,39 @@
+#include <SDL2/SDL.h>
+#include <vector>
+#include <string>
+#include "graphicsEngine.h"
+
+#ifndef STRESSSCENE_H
+#define STRESSSCENE_H
+
+// Shape of a synthetic scene, for finding where the engine stops scaling.
+// Every setting can be moved on its own while the others stay put
+struct stressSettings
+{
+    long long triangles = 1000000;  // over all instances, on screen or not
+    int instances = 64;
+    int depthComplexity = 4;        // instances lined up behind each other on screen
+    int textures = 4;               // 0 draws untextured
+    float offscreen = 0.0f;         // fraction of the instances placed behind the camera
+    Uint32 seed = 1;
+};
+
+// Comma separated key=value pairs, any subset of
+//     triangles=1000000,instances=64,depth=4,textures=4,offscreen=0,seed=1
+// or "-" for the defaults
+bool parseStressSettings(const std::string &spec, stressSettings &settings);
+// A UV sphere of radius 1 with about this many triangles, facing outwards
+void buildStressMesh(int triangles, mesh &m);
+// Meshes and textures are made in memory, nothing is read from disk. Instances
+// are laid out in screen columns for a camera at cameraPosition looking down +z
+// with the given projection scales, each column depthComplexity instances deep
+// and every instance in it covering the same part of the screen
+bool generateStressScene(const stressSettings &settings, SDL_Renderer *render, const vertex &cameraPosition,
+                         float projectX, float projectY, std::vector<meshInstance> &instances);
+
+// Moves each setting away from base in turn, timing every stage of the frame at
+// each point. A row per point goes to csvFile and a chart per setting to stdout.
+// Points above maxTriangles are skipped, and a setting stops once a frame takes a second
+bool runStressSweep(Renderer &renderer, const stressSettings &base, long long maxTriangles, const std::string &csvFile);
+
+#endif
@@ -0,0 +1,464 @@
+#include <SDL2/SDL.h>
+#include "terrain.h"
+#include <iostream>
+#include <cmath>
+#include <algorithm>
+
+// Cells per side of every chunk, whatever its level
+static const int chunkCells = 16;
+
+Terrain::Terrain(const std::string &heightmap, TextureLoader &loader, const terrainSettings &_settings)
+{
+    settings = _settings;
+    open = false;
+    width = 0;
+    height = 0;
+    root = -1;
+    frame = 0;
+    leavesX = 0;
+    leavesY = 0;
+    triangles = 0;
+    resident = 0;
+    stopping = false;
+
+    std::vector<Uint32> pixels;
+    if (!loader.decodeBMP(heightmap, SDL_PIXELFORMAT_ARGB8888, pixels, width, height))
+        return;
+    if (width < 2 || height < 2)
+    {
+        std::cout << "Failed to load heightmap: " << heightmap << " needs at least 2x2 samples" << std::endl;
+        return;
+    }
+    heights.resize(pixels.size());
+    for (size_t i = 0; i < pixels.size(); i++)
+        heights[i] = float(((pixels[i] >> 16) & 0xFF) * 256 + ((pixels[i] >> 8) & 0xFF)) / 65535.0f;
+
+    // Enough levels for the root chunk to cover the whole map
+    int rootLevel = 0;
+    while ((chunkCells << rootLevel) < std::max(width, height) - 1)
+        rootLevel++;
+    leavesX = (width - 2) / chunkCells + 1;
+    leavesY = (height - 2) / chunkCells + 1;
+    levels.assign(size_t(leavesX) * leavesY, rootLevel);
+    root = buildNode(rootLevel, 0, 0);
+
+    // The root is the fallback for everything else, so it is there from the start
+    std::shared_ptr<meshVector<vertex>> grid = std::make_shared<meshVector<vertex>>();
+    buildGrid(nodes[root], *grid);
+    nodes[root].grid = grid;
+    nodes[root].state = ChunkState::Resident;
+    resident = 1;
+    cut.push_back(root);
+    open = true;
+
+    std::cout << "Loaded terrain " << heightmap << ": " << width << "x" << height << " samples, " << nodes.size()
+              << " chunks over " << rootLevel + 1 << " levels" << std::endl;
+
+    for (int i = 0; i < std::max(1, settings.buildThreads); i++)
+        workers.emplace_back(&Terrain::buildLoop, this);
+}
+
+Terrain::~Terrain()
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+    requestReady.notify_all();
+    for (auto &worker : workers)
+        worker.join();
+}
+
+bool Terrain::isOpen()
+{
+    return open;
+}
+
+float Terrain::sample(int x, int y) const
+{
+    x = std::min(std::max(x, 0), width - 1);
+    y = std::min(std::max(y, 0), height - 1);
+    return heights[size_t(y) * width + x];
+}
+
+int Terrain::buildNode(int level, int x, int y)
+{
+    if (x >= width - 1 || y >= height - 1)
+        return -1;
+
+    int index = int(nodes.size());
+    nodes.emplace_back();
+    nodes[index].level = level;
+    nodes[index].x = x;
+    nodes[index].y = y;
+
+    int half = (chunkCells << level) / 2;
+    if (level > 0)
+    {
+        // Children first, they bound the error from below
+        int children[4];
+        for (int c = 0; c < 4; c++)
+            children[c] = buildNode(level - 1, x + (c & 1) * half, y + (c >> 1) * half);
+        std::copy(children, children + 4, nodes[index].children);
+    }
+
+    // Heights are clamped past the right and bottom edges, those cells have no area
+    int step = 1 << level;
+    int endX = std::min(x + (chunkCells << level), width - 1);
+    int endY = std::min(y + (chunkCells << level), height - 1);
+    float low = sample(x, y);
+    float high = low;
+    float error = 0.0f;
+    for (int cy = y; cy < endY; cy += step)
+    {
+        for (int cx = x; cx < endX; cx += step)
+        {
+            // Each cell is drawn as two triangles split from top right to bottom
+            // left. How far the samples inside are from those is the error
+            int x1 = std::min(cx + step, width - 1);
+            int y1 = std::min(cy + step, height - 1);
+            float h00 = sample(cx, cy);
+            float h10 = sample(x1, cy);
+            float h01 = sample(cx, y1);
+            float h11 = sample(x1, y1);
+            for (int py = cy; py <= y1; py++)
+            {
+                for (int px = cx; px <= x1; px++)
+                {
+                    float h = sample(px, py);
+                    low = std::min(low, h);
+                    high = std::max(high, h);
+                    if (level == 0)
+                        continue;
+                    float fx = float(px - cx) / float(x1 - cx);
+                    float fy = float(py - cy) / float(y1 - cy);
+                    float drawn = fx + fy <= 1.0f ? h00 + fx * (h10 - h00) + fy * (h01 - h00)
+                                                  : h11 + (1.0f - fx) * (h01 - h11) + (1.0f - fy) * (h10 - h11);
+                    error = std::max(error, fabsf(h - drawn));
+                }
+            }
+        }
+    }
+
+    terrainNode &node = nodes[index];
+    node.error = error * settings.heightScale;
+    for (int child : node.children)
+    {
+        if (child >= 0)
+            node.error = std::max(node.error, nodes[child].error);
+    }
+    node.boundsMin = { x * settings.spacing, low * settings.heightScale, y * settings.spacing };
+    node.boundsMax = { endX * settings.spacing, high * settings.heightScale, endY * settings.spacing };
+    return index;
+}
+
+void Terrain::buildGrid(const terrainNode &node, meshVector<vertex> &out)
+{
+    int step = 1 << node.level;
+    out.resize(size_t(chunkCells + 1) * (chunkCells + 1));
+    for (int j = 0; j <= chunkCells; j++)
+    {
+        int sy = std::min(node.y + j * step, height - 1);
+        for (int i = 0; i <= chunkCells; i++)
+        {
+            int sx = std::min(node.x + i * step, width - 1);
+            out[size_t(j) * (chunkCells + 1) + i] = { sx * settings.spacing, sample(sx, sy) * settings.heightScale, sy * settings.spacing };
+        }
+    }
+}
+
+size_t Terrain::gridBytes()
+{
+    return size_t(chunkCells + 1) * (chunkCells + 1) * sizeof(vertex);
+}
+
+void Terrain::buildLoop()
+{
+    while (true)
+    {
+        int index;
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            requestReady.wait(guard, [this] { return stopping || !requests.empty(); });
+            if (stopping)
+                return;
+            index = requests.front();
+            requests.pop_front();
+            nodes[index].state = ChunkState::Building;
+        }
+
+        // Level, position and the heights never change, so no lock is needed to read them
+        std::shared_ptr<meshVector<vertex>> grid = std::make_shared<meshVector<vertex>>();
+        buildGrid(nodes[index], *grid);
+
+        std::lock_guard<std::mutex> guard(lock);
+        nodes[index].grid = grid;
+        nodes[index].state = ChunkState::Resident;
+        resident++;
+    }
+}
+
+void Terrain::visit(int index, const vertex &eye, const matrix4 &modelToClip, float screenScale)
+{
+    terrainNode &node = nodes[index];
+    node.lastUsed = frame;
+    node.visible = boxVisible(node.boundsMin, node.boundsMax, modelToClip);
+    cut.push_back(index);
+    if (!node.visible)
+        return;
+    triangles += chunkTriangles();
+
+    // Chunks out of view or already close enough are never split
+    if (node.level == 0)
+        return;
+    float distance = boxDistance(eye, node.boundsMin, node.boundsMax);
+    float pixels = distance > 0.0f ? node.error * screenScale / distance : INFINITY;
+    if (pixels > settings.pixelError)
+    {
+        refining.push_back({ pixels, index });
+        std::push_heap(refining.begin(), refining.end());
+    }
+}
+
+void Terrain::update(const vertex &eye, const matrix4 &modelToClip, float screenScale)
+{
+    if (!open)
+        return;
+
+    std::lock_guard<std::mutex> guard(lock);
+    frame++;
+    cut.clear();
+    refining.clear();
+    wanted.clear();
+    triangles = 0;
+    visit(root, eye, modelToClip, screenScale);
+
+    // Worst chunk first, split while the budget has room for its children
+    while (!refining.empty())
+    {
+        std::pop_heap(refining.begin(), refining.end());
+        std::pair<float, int> worst = refining.back();
+        refining.pop_back();
+        terrainNode &node = nodes[worst.second];
+
+        bool ready = true;
+        int added = -1;
+        for (int child : node.children)
+        {
+            if (child < 0)
+                continue;
+            ready = ready && nodes[child].state == ChunkState::Resident;
+            if (boxVisible(nodes[child].boundsMin, nodes[child].boundsMax, modelToClip))
+                added++;
+        }
+        if (triangles + added * chunkTriangles() > settings.triangleBudget)
+            continue;
+        if (!ready)
+        {
+            // Drawn as it is until all four are built
+            for (int child : node.children)
+            {
+                if (child < 0)
+                    continue;
+                nodes[child].lastUsed = frame;
+                if (nodes[child].state == ChunkState::Unloaded || nodes[child].state == ChunkState::Queued)
+                    wanted.push_back({ worst.first, child });
+            }
+            continue;
+        }
+
+        node.splitFrame = frame;
+        triangles -= chunkTriangles();
+        for (int child : node.children)
+        {
+            if (child >= 0)
+                visit(child, eye, modelToClip, screenScale);
+        }
+    }
+
+    // Split chunks stay in the list, they are dropped here
+    cut.erase(std::remove_if(cut.begin(), cut.end(), [this](int index) { return nodes[index].splitFrame == frame; }), cut.end());
+    for (int index : cut)
+    {
+        const terrainNode &node = nodes[index];
+        int first = node.x / chunkCells;
+        int row = node.y / chunkCells;
+        int span = 1 << node.level;
+        for (int ly = row; ly < std::min(row + span, leavesY); ly++)
+            std::fill(levels.begin() + size_t(ly) * leavesX + first, levels.begin() + size_t(ly) * leavesX + std::min(first + span, leavesX), node.level);
+    }
+
+    // Queued builds that are no longer wanted are dropped, the rest go worst first
+    for (int index : requests)
+        nodes[index].state = ChunkState::Unloaded;
+    requests.clear();
+    std::sort(wanted.begin(), wanted.end(), [](const std::pair<float, int> &a, const std::pair<float, int> &b) { return a.first > b.first; });
+    for (const auto &request : wanted)
+    {
+        if (nodes[request.second].state == ChunkState::Unloaded)
+        {
+            nodes[request.second].state = ChunkState::Queued;
+            requests.push_back(request.second);
+        }
+    }
+    if (!requests.empty())
+        requestReady.notify_all();
+
+    // Least recently walked chunks go first once over budget. Anything walked
+    // this frame stays, or the cut could not be found from the root next frame
+    if (size_t(resident) * gridBytes() > settings.budgetBytes)
+    {
+        stale.clear();
+        for (size_t i = 0; i < nodes.size(); i++)
+        {
+            if (nodes[i].state == ChunkState::Resident && nodes[i].lastUsed != frame)
+                stale.push_back({ nodes[i].lastUsed, int(i) });
+        }
+        std::sort(stale.begin(), stale.end());
+        for (size_t i = 0; i < stale.size() && size_t(resident) * gridBytes() > settings.budgetBytes; i++)
+        {
+            nodes[stale[i].second].grid = nullptr;
+            nodes[stale[i].second].state = ChunkState::Unloaded;
+            resident--;
+        }
+    }
+}
+
+void Terrain::pullEdge(const terrainNode &node, int edge)
+{
+    // Edges: 0 left, 1 right, 2 top, 3 bottom. The neighbour is the finest
+    // chunk just past the edge, a coarser one covers the whole edge
+    int span = 1 << node.level;
+    int leafX = node.x / chunkCells;
+    int leafY = node.y / chunkCells;
+    if (edge == 0)
+        leafX--;
+    else if (edge == 1)
+        leafX += span;
+    else if (edge == 2)
+        leafY--;
+    else
+        leafY += span;
+    if (leafX < 0 || leafY < 0 || leafX >= leavesX || leafY >= leavesY)
+        return;
+    int neighbour = levels[size_t(leafY) * leavesX + leafX];
+    if (neighbour <= node.level)
+        return;
+
+    bool vertical = edge < 2;
+    int step = 1 << neighbour;
+    int limit = vertical ? height - 1 : width - 1;
+    int fixed = vertical ? std::min(node.x + (edge == 1 ? chunkCells * span : 0), width - 1)
+                         : std::min(node.y + (edge == 3 ? chunkCells * span : 0), height - 1);
+    for (int k = 0; k <= chunkCells; k++)
+    {
+        // Heights between the neighbour's vertices follow its straight edge
+        int along = std::min((vertical ? node.y : node.x) + k * span, limit);
+        int lo = along / step * step;
+        int hi = std::min(lo + step, limit);
+        if (along == lo || hi == lo)
+            continue;
+        float t = float(along - lo) / float(hi - lo);
+        float h0 = vertical ? sample(fixed, lo) : sample(lo, fixed);
+        float h1 = vertical ? sample(fixed, hi) : sample(hi, fixed);
+        int i = vertical ? (edge == 1 ? chunkCells : 0) : k;
+        int j = vertical ? k : (edge == 3 ? chunkCells : 0);
+        edged[size_t(j) * (chunkCells + 1) + i].y = (h0 + (h1 - h0) * t) * settings.heightScale;
+    }
+}
+
+void Terrain::gather(const matrix4 &world, frameVector<triangle> &out, bool culled)
+{
+    out.clear();
+    if (!open)
+        return;
+
+    // Model matrices are affine, as in transformTriangles
+    const float m00 = world.m[0][0], m01 = world.m[0][1], m02 = world.m[0][2];
+    const float m10 = world.m[1][0], m11 = world.m[1][1], m12 = world.m[1][2];
+    const float m20 = world.m[2][0], m21 = world.m[2][1], m22 = world.m[2][2];
+    const float m30 = world.m[3][0], m31 = world.m[3][1], m32 = world.m[3][2];
+    const int row = chunkCells + 1;
+
+    std::lock_guard<std::mutex> guard(lock);
+    for (int index : cut)
+    {
+        const terrainNode &node = nodes[index];
+        if (culled && !node.visible)
+            continue;
+
+        edged.assign(node.grid->begin(), node.grid->end());
+        for (int edge = 0; edge < 4; edge++)
+            pullEdge(node, edge);
+
+        // Every vertex is moved once, then shared by the triangles around it
+        placed.resize(edged.size());
+        for (size_t n = 0; n < edged.size(); n++)
+        {
+            const vertex &v = edged[n];
+            placed[n] = { v.x * m00 + v.y * m10 + v.z * m20 + m30,
+                          v.x * m01 + v.y * m11 + v.z * m21 + m31,
+                          v.x * m02 + v.y * m12 + v.z * m22 + m32 };
+        }
+
+        // Cells past the edge of the map were clamped flat and are left out
+        int step = 1 << node.level;
+        int columns = std::min(chunkCells, (width - 2 - node.x) / step + 1);
+        int rows = std::min(chunkCells, (height - 2 - node.y) / step + 1);
+        float toU = 1.0f / float(width - 1);
+        float toV = 1.0f / float(height - 1);
+        for (int j = 0; j < rows; j++)
+        {
+            float v0 = std::min(node.y + j * step, height - 1) * toV;
+            float v1 = std::min(node.y + (j + 1) * step, height - 1) * toV;
+            for (int i = 0; i < columns; i++)
+            {
+                float u0 = std::min(node.x + i * step, width - 1) * toU;
+                float u1 = std::min(node.x + (i + 1) * step, width - 1) * toU;
+                const vertex &a = placed[size_t(j) * row + i];
+                const vertex &b = placed[size_t(j + 1) * row + i];
+                const vertex &c = placed[size_t(j) * row + i + 1];
+                const vertex &d = placed[size_t(j + 1) * row + i + 1];
+                // Wound to face up
+                triangle first = { { a, b, c }, { { u0, v0 }, { u0, v1 }, { u1, v0 } }, 0.0f };
+                triangle second = { { c, b, d }, { { u1, v0 }, { u0, v1 }, { u1, v1 } }, 0.0f };
+                out.push_back(first);
+                out.push_back(second);
+            }
+        }
+    }
+}
+
+void Terrain::bounds(vertex &boundsMin, vertex &boundsMax)
+{
+    if (!open)
+    {
+        boundsMin = boundsMax = { 0.0f, 0.0f, 0.0f };
+        return;
+    }
+    boundsMin = nodes[root].boundsMin;
+    boundsMax = nodes[root].boundsMax;
+}
+
+int Terrain::drawnChunks()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    int count = 0;
+    for (int index : cut)
+    {
+        if (nodes[index].visible)
+            count++;
+    }
+    return count;
+}
+
+int Terrain::residentChunks()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    return resident;
+}
+
+int Terrain::chunkTriangles()
+{
+    return 2 * chunkCells * chunkCells;
+}
@@ -0,0 +1,109 @@
+#include <SDL2/SDL.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "graphicsEngine.h"
+#include "textureLoader.h"
+
+#ifndef TERRAIN_H
+#define TERRAIN_H
+
+struct terrainSettings
+{
+    float spacing = 8.0f;           // world units between heightmap samples
+    float heightScale = 100.0f;     // height of a full white sample
+    int triangleBudget = 100000;    // most triangles drawn in a frame
+    float pixelError = 2.0f;        // chunks split while they are further than this off the full heightmap on screen
+    size_t budgetBytes = size_t(16) * 1024 * 1024;  // built chunks kept around
+    int buildThreads = 2;
+};
+
+// Heightmap terrain as a quadtree of square chunks. Every chunk has the same
+// number of cells and each level down halves their size, so detail goes
+// where the coarser chunk would be visibly wrong from where the camera is.
+// Chunks are culled against the frustum, and refined worst first until the
+// triangle budget is used up.
+// Chunk vertices are built on background threads. A chunk only splits once
+// all four children are in, so nothing disappears while they are built.
+// Where a neighbour is coarser, edge vertices are pulled onto its edge, so
+// there are no cracks between levels
+class Terrain
+{
+    public:
+        // Heights come from the red channel with green as the low byte, so grey
+        // images give red / 255 and 16 bit heights fit in two channels
+        Terrain(const std::string &heightmap, TextureLoader &loader, const terrainSettings &_settings);
+        ~Terrain();
+        bool isOpen();
+        // Picks the chunks to draw from the eye and model to clip matrix, both in
+        // the terrain's model space, queues builds and evicts what no longer fits.
+        // screenScale turns size over distance into pixels
+        void update(const vertex &eye, const matrix4 &modelToClip, float screenScale);
+        // World space triangles of the chunks picked, only those in view unless culled is false
+        void gather(const matrix4 &world, frameVector<triangle> &out, bool culled = true);
+        void bounds(vertex &boundsMin, vertex &boundsMax);
+        int drawnChunks();
+        int residentChunks();
+        int chunkTriangles();
+
+    private:
+        enum class ChunkState { Unloaded, Queued, Building, Resident };
+
+        struct terrainNode
+        {
+            int level;              // 0 for the finest chunks
+            int x, y;               // first sample covered
+            int children[4] = { -1, -1, -1, -1 };  // -1 past the edge of the map or below the finest
+            vertex boundsMin, boundsMax;
+            float error = 0.0f;     // most any height is off from the full heightmap, in world units
+            ChunkState state = ChunkState::Unloaded;
+            std::shared_ptr<const meshVector<vertex>> grid;
+            int lastUsed = -1;      // frame it was last part of the tree walked
+            int splitFrame = -1;    // frame its children were drawn in its place
+            bool visible = false;
+        };
+
+        float sample(int x, int y) const;
+        int buildNode(int level, int x, int y);
+        void buildGrid(const terrainNode &node, meshVector<vertex> &out);
+        void buildLoop();
+        void visit(int index, const vertex &eye, const matrix4 &modelToClip, float screenScale);
+        void pullEdge(const terrainNode &node, int edge);
+        size_t gridBytes();
+
+        terrainSettings settings;
+        bool open;
+        int width;
+        int height;
+        std::vector<float> heights;
+        std::vector<terrainNode> nodes;
+        int root;
+        int frame;
+
+        // Chosen by the last update: the chunks drawn in place of the whole
+        // map, in view or not, and the level drawn over each finest chunk's
+        // area, which is what edges are matched against
+        std::vector<int> cut;
+        std::vector<int> levels;
+        int leavesX;
+        int leavesY;
+        std::vector<std::pair<float, int>> refining;
+        std::vector<std::pair<float, int>> wanted;
+        std::vector<std::pair<int, int>> stale;
+        int triangles;
+        frameVector<vertex> edged;
+        frameVector<vertex> placed;
+
+        std::vector<std::thread> workers;
+        std::mutex lock;
+        std::condition_variable requestReady;
+        std::deque<int> requests;
+        int resident;
+        bool stopping;
+};
+
+#endif
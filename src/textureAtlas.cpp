@@ -0,0 +1,348 @@
+#include <SDL2/SDL.h>
+#include "textureAtlas.h"
+#include "quantizedMesh.h"
+#include "meshOptimizer.h"
+#include "bspTree.h"
+#include "animation.h"
+#include <iostream>
+#include <cmath>
+#include <climits>
+#include <cstring>
+#include <algorithm>
+#include <unordered_map>
+
+SkylinePacker::SkylinePacker(int _width, int _height)
+{
+    width = _width;
+    height = _height;
+    usedArea = 0;
+    skyline.push_back({0, 0, width});
+}
+
+// Height the rectangle would sit at if its left edge starts at node index, -1 if it can't
+int SkylinePacker::fit(int index, int w, int h)
+{
+    int x = skyline[index].x;
+    if (x + w > width)
+        return -1;
+
+    int y = skyline[index].y;
+    int widthLeft = w;
+    while (widthLeft > 0)
+    {
+        y = std::max(y, skyline[index].y);
+        if (y + h > height)
+            return -1;
+        widthLeft -= skyline[index].width;
+        index++;
+    }
+    return y;
+}
+
+bool SkylinePacker::insert(int w, int h, int &x, int &y)
+{
+    int bestIndex = -1;
+    int bestTop = INT_MAX;
+    int bestWidth = INT_MAX;
+    for (size_t i = 0; i < skyline.size(); i++)
+    {
+        int top = fit(int(i), w, h);
+        if (top < 0)
+            continue;
+        // Lowest top edge first, then the narrowest ledge to keep wide ones free
+        if (top + h < bestTop || (top + h == bestTop && skyline[i].width < bestWidth))
+        {
+            bestIndex = int(i);
+            bestTop = top + h;
+            bestWidth = skyline[i].width;
+            x = skyline[i].x;
+            y = top;
+        }
+    }
+    if (bestIndex < 0)
+        return false;
+
+    skyline.insert(skyline.begin() + bestIndex, {x, y + h, w});
+
+    // Trim or drop the ledges now under the new one
+    for (size_t i = size_t(bestIndex) + 1; i < skyline.size();)
+    {
+        int covered = skyline[i - 1].x + skyline[i - 1].width - skyline[i].x;
+        if (covered <= 0)
+            break;
+        skyline[i].x += covered;
+        skyline[i].width -= covered;
+        if (skyline[i].width > 0)
+            break;
+        skyline.erase(skyline.begin() + i);
+    }
+
+    // Merge neighbours at the same height
+    for (size_t i = 0; i + 1 < skyline.size();)
+    {
+        if (skyline[i].y == skyline[i + 1].y)
+        {
+            skyline[i].width += skyline[i + 1].width;
+            skyline.erase(skyline.begin() + i + 1);
+        }
+        else
+            i++;
+    }
+
+    usedArea += (long long)w * h;
+    return true;
+}
+
+float SkylinePacker::occupancy()
+{
+    return float(double(usedArea) / (double(width) * height));
+}
+
+// Everything the atlas needs to know about one source texture
+struct atlasImage
+{
+    SDL_Texture *source;
+    std::vector<Uint32> pixels;     // RGBA32
+    int width;
+    int height;
+    // UV range used by the instances, in SDL's orientation (v flipped)
+    float minU, maxU, minV, maxV;
+    // Wrapped border on each side, the overhang of the UVs plus padding
+    int left, right, top, bottom;
+    int page;
+    int x;
+    int y;
+};
+
+static void growUVRange(atlasImage &image, const coord &t)
+{
+    float v = 1.0f - t.v;
+    image.minU = std::min(image.minU, t.u);
+    image.maxU = std::max(image.maxU, t.u);
+    image.minV = std::min(image.minV, v);
+    image.maxV = std::max(image.maxV, v);
+}
+
+static void instanceUVRange(const meshInstance &instance, atlasImage &image)
+{
+    if (instance.model)
+    {
+        for (const auto &tri : instance.model->triangles)
+            for (int i = 0; i < 3; i++)
+                growUVRange(image, tri.t[i]);
+    }
+    else if (instance.packed)
+    {
+        const quantizedMesh &packed = *instance.packed;
+        growUVRange(image, packed.uvOrigin);
+        growUVRange(image, { packed.uvOrigin.u + packed.uvStep.u * 65535.0f, packed.uvOrigin.v + packed.uvStep.v * 65535.0f });
+    }
+    else if (instance.indexed)
+    {
+        for (const auto &t : instance.indexed->uvs)
+            growUVRange(image, t);
+    }
+    else if (instance.bsp)
+    {
+        for (const auto &tri : instance.bsp->geometry.triangles)
+            for (int i = 0; i < 3; i++)
+                growUVRange(image, tri.t[i]);
+    }
+    else if (instance.skinned)
+    {
+        for (const auto &t : instance.skinned->uvs)
+            growUVRange(image, t);
+    }
+    else if (instance.streamed || instance.terrain)
+    {
+        // Most of a streamed mesh or terrain isn't built, assume it stays inside the texture
+        growUVRange(image, { 0.0f, 0.0f });
+        growUVRange(image, { 1.0f, 1.0f });
+    }
+}
+
+static bool loadImage(TextureLoader &loader, const std::string &filename, int maxTextureSize, atlasImage &image)
+{
+    if (!loader.decodeBMP(filename, SDL_PIXELFORMAT_RGBA32, image.pixels, image.width, image.height))
+        return false;
+
+    // Box filter down by halves, so no texel weighs more than another
+    while (maxTextureSize > 0 && std::max(image.width, image.height) > maxTextureSize && std::min(image.width, image.height) > 1)
+    {
+        int w = image.width / 2;
+        int h = image.height / 2;
+        std::vector<Uint32> half(size_t(w) * h);
+        for (int y = 0; y < h; y++)
+        {
+            for (int x = 0; x < w; x++)
+            {
+                const Uint8 *a = reinterpret_cast<const Uint8*>(&image.pixels[size_t(y * 2) * image.width + x * 2]);
+                const Uint8 *b = a + 4;
+                const Uint8 *c = a + size_t(image.width) * 4;
+                const Uint8 *d = c + 4;
+                Uint8 *out = reinterpret_cast<Uint8*>(&half[size_t(y) * w + x]);
+                for (int i = 0; i < 4; i++)
+                    out[i] = Uint8((a[i] + b[i] + c[i] + d[i] + 2) / 4);
+            }
+        }
+        image.pixels.swap(half);
+        image.width = w;
+        image.height = h;
+    }
+    return true;
+}
+
+int buildTextureAtlas(SDL_Renderer *render, AssetCache &assets, std::vector<meshInstance> &instances, const atlasSettings &settings)
+{
+    int pageSize = settings.pageSize;
+    SDL_RendererInfo info;
+    if (SDL_GetRendererInfo(render, &info) == 0 && info.max_texture_width > 0)
+        pageSize = std::min(pageSize, std::min(info.max_texture_width, info.max_texture_height));
+
+    // One image per distinct texture, with the UV range of every instance using it
+    std::vector<atlasImage> images;
+    std::unordered_map<SDL_Texture*, int> imageIndex;
+    for (const auto &instance : instances)
+    {
+        SDL_Texture *texture = instance.texture.get();
+        if (!texture)
+            continue;
+        auto found = imageIndex.find(texture);
+        if (found == imageIndex.end())
+        {
+            atlasImage image = {};
+            image.source = texture;
+            image.minU = image.minV = 1e30f;
+            image.maxU = image.maxV = -1e30f;
+            found = imageIndex.emplace(texture, int(images.size())).first;
+            images.push_back(image);
+        }
+        instanceUVRange(instance, images[found->second]);
+    }
+
+    std::vector<atlasImage*> packable;
+    for (auto &image : images)
+    {
+        image.page = -1;
+        // Beyond one repeat the border would outgrow the image, keep those standalone
+        if (image.minU < -1.0f || image.minV < -1.0f || image.maxU > 2.0f || image.maxV > 2.0f)
+            continue;
+        std::string filename = assets.textureFile(image.source);
+        if (filename.empty() || !loadImage(assets.textureLoader(), filename, settings.maxTextureSize, image))
+            continue;
+
+        image.left = int(ceilf(std::max(0.0f, -image.minU) * image.width)) + settings.padding;
+        image.right = int(ceilf(std::max(0.0f, image.maxU - 1.0f) * image.width)) + settings.padding;
+        image.top = int(ceilf(std::max(0.0f, -image.minV) * image.height)) + settings.padding;
+        image.bottom = int(ceilf(std::max(0.0f, image.maxV - 1.0f) * image.height)) + settings.padding;
+        if (image.left + image.width + image.right > pageSize || image.top + image.height + image.bottom > pageSize)
+            continue;
+        packable.push_back(&image);
+    }
+    if (packable.empty())
+        return 0;
+
+    // A white block for untextured meshes, so they draw in the same batch
+    atlasImage white = {};
+    white.source = NULL;
+    white.width = 1;
+    white.height = 1;
+    white.pixels.assign(1, 0xFFFFFFFF);
+    white.left = white.right = white.top = white.bottom = settings.padding;
+    packable.push_back(&white);
+
+    // Tallest first keeps the skyline flat
+    std::sort(packable.begin(), packable.end(), [](const atlasImage *a, const atlasImage *b)
+    {
+        return a->top + a->height + a->bottom > b->top + b->height + b->bottom;
+    });
+
+    std::vector<SkylinePacker> packers;
+    for (atlasImage *image : packable)
+    {
+        int w = image->left + image->width + image->right;
+        int h = image->top + image->height + image->bottom;
+        image->page = -1;
+        for (size_t page = 0; page < packers.size() && image->page < 0; page++)
+        {
+            if (packers[page].insert(w, h, image->x, image->y))
+                image->page = int(page);
+        }
+        if (image->page < 0)
+        {
+            packers.emplace_back(pageSize, pageSize);
+            packers.back().insert(w, h, image->x, image->y);
+            image->page = int(packers.size()) - 1;
+        }
+        // x, y now point at the image itself rather than its border
+        image->x += image->left;
+        image->y += image->top;
+    }
+
+    // Copy every image in with its border filled by wrapping, as a repeating texture would sample
+    std::vector<std::vector<Uint32>> pixels(packers.size(), std::vector<Uint32>(size_t(pageSize) * pageSize, 0));
+    for (const atlasImage *image : packable)
+    {
+        std::vector<Uint32> &page = pixels[image->page];
+        for (int y = -image->top; y < image->height + image->bottom; y++)
+        {
+            int sourceY = ((y % image->height) + image->height) % image->height;
+            Uint32 *row = &page[size_t(image->y + y) * pageSize + image->x];
+            const Uint32 *sourceRow = &image->pixels[size_t(sourceY) * image->width];
+            for (int x = -image->left; x < image->width + image->right; x++)
+            {
+                int sourceX = ((x % image->width) + image->width) % image->width;
+                row[x] = sourceRow[sourceX];
+            }
+        }
+    }
+
+    std::vector<std::shared_ptr<SDL_Texture>> pages;
+    for (size_t i = 0; i < packers.size(); i++)
+    {
+        SDL_Texture *created = SDL_CreateTexture(render, SDL_PIXELFORMAT_RGBA32, SDL_TEXTUREACCESS_STATIC, pageSize, pageSize);
+        if (!created)
+        {
+            std::cout << "Failed to create atlas page: " << SDL_GetError() << std::endl;
+            return 0;
+        }
+        SDL_UpdateTexture(created, NULL, pixels[i].data(), pageSize * 4);
+        SDL_SetTextureBlendMode(created, SDL_BLENDMODE_BLEND);
+        pages.push_back(trackedTexture(created, size_t(pageSize) * pageSize * 4));
+    }
+
+    // Map 0..1 onto the image's square in the page. SDL's v runs the other way,
+    // which fillTriangle flips, so the offset is taken from the bottom edge
+    float size = float(pageSize);
+    for (auto &instance : instances)
+    {
+        const atlasImage *image = &white;
+        if (instance.texture)
+        {
+            image = &images[imageIndex[instance.texture.get()]];
+            if (image->page < 0)
+                continue;
+        }
+
+        instance.texture = pages[image->page];
+        if (image == &white)
+        {
+            // Every UV lands on the middle of the white texel
+            instance.uvScale = { 0.0f, 0.0f };
+            instance.uvOffset = { (white.x + 0.5f) / size, 1.0f - (white.y + 0.5f) / size };
+        }
+        else
+        {
+            instance.uvScale = { image->width / size, image->height / size };
+            instance.uvOffset = { image->x / size, 1.0f - (image->y + image->height) / size };
+        }
+    }
+
+    int packed = int(packable.size()) - 1;
+    std::cout << "Atlas: " << packed << " of " << images.size() << " textures on " << pages.size() << " page"
+              << (pages.size() == 1 ? "" : "s") << " of " << pageSize << "x" << pageSize;
+    for (auto &packer : packers)
+        std::cout << ", " << int(packer.occupancy() * 100.0f + 0.5f) << "% used";
+    std::cout << std::endl;
+    return int(pages.size());
+}
@@ -0,0 +1,47 @@
+#include <SDL2/SDL.h>
+#include <memory>
+#include <vector>
+#include "graphicsEngine.h"
+
+#ifndef TEXTUREATLAS_H
+#define TEXTUREATLAS_H
+
+// Skyline bottom-left rectangle packer: the free space is kept as the top
+// edge of everything placed so far, and each rectangle goes where it ends lowest
+class SkylinePacker
+{
+    public:
+        SkylinePacker(int _width, int _height);
+        bool insert(int w, int h, int &x, int &y);
+        float occupancy();
+    private:
+        struct skylineNode
+        {
+            int x;
+            int y;
+            int width;
+        };
+
+        int fit(int index, int w, int h);
+
+        int width;
+        int height;
+        long long usedArea;
+        std::vector<skylineNode> skyline;
+};
+
+struct atlasSettings
+{
+    int pageSize = 2048;        // clamped to what the renderer supports
+    int padding = 2;            // texels of wrapped border around every image
+    int maxTextureSize = 0;     // halve textures until they fit, 0 keeps full size
+};
+
+// Packs every texture used by the instances into as few pages as possible and
+// points the instances at them, with their UVs remapped through uvOffset/uvScale.
+// Untextured instances sample a white block so they join the same batch.
+// Textures whose UVs wrap by more than one repeat, or that can't be reloaded,
+// are left as they are. Returns the number of pages created.
+int buildTextureAtlas(SDL_Renderer *render, AssetCache &assets, std::vector<meshInstance> &instances, const atlasSettings &settings);
+
+#endif
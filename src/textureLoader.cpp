@@ -0,0 +1,437 @@
+#include <SDL2/SDL.h>
+#include "textureLoader.h"
+#include "memoryTracker.h"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <cstring>
+#include <cstdlib>
+#include <filesystem>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+mappedFile::mappedFile(const std::string &filename)
+{
+#ifndef _WIN32
+    int descriptor = open(filename.c_str(), O_RDONLY);
+    if (descriptor < 0)
+        return;
+    struct stat status;
+    if (fstat(descriptor, &status) == 0 && status.st_size > 0)
+    {
+        void *view = mmap(NULL, size_t(status.st_size), PROT_READ, MAP_PRIVATE, descriptor, 0);
+        if (view != MAP_FAILED)
+        {
+            data = static_cast<const Uint8*>(view);
+            size = size_t(status.st_size);
+            mapped = true;
+        }
+    }
+    close(descriptor);
+#else
+    std::ifstream file(filename, std::ios::binary | std::ios::ate);
+    if (!file.is_open())
+        return;
+    buffer.resize(size_t(file.tellg()));
+    file.seekg(0);
+    if (!buffer.empty() && file.read(reinterpret_cast<char*>(buffer.data()), std::streamsize(buffer.size())))
+    {
+        data = buffer.data();
+        size = buffer.size();
+    }
+#endif
+}
+
+mappedFile::~mappedFile()
+{
+#ifndef _WIN32
+    if (mapped)
+        munmap(const_cast<Uint8*>(data), size);
+#endif
+}
+
+// Where the pixels of a BMP sit in the file and how they are laid out
+struct bmpLayout
+{
+    int width;
+    int height;
+    int bitsPerPixel;
+    bool bottomUp;
+    bool alpha;
+    const Uint8 *pixels;
+    size_t pitch;
+};
+
+static Uint16 read16(const Uint8 *p)
+{
+    return Uint16(p[0] | (p[1] << 8));
+}
+
+static Uint32 read32(const Uint8 *p)
+{
+    return Uint32(p[0]) | (Uint32(p[1]) << 8) | (Uint32(p[2]) << 16) | (Uint32(p[3]) << 24);
+}
+
+// Only the layouts the fast path converts, false sends the file through SDL
+static bool parseBMP(const mappedFile &file, bmpLayout &layout)
+{
+    const Uint8 *d = file.data;
+    if (file.size < 54 || d[0] != 'B' || d[1] != 'M')
+        return false;
+
+    Uint32 offset = read32(d + 10);
+    Uint32 headerSize = read32(d + 14);
+    Sint32 width = Sint32(read32(d + 18));
+    Sint32 height = Sint32(read32(d + 22));
+    int bitsPerPixel = read16(d + 28);
+    Uint32 compression = read32(d + 30);
+    if (headerSize < 40 || width <= 0 || height == 0 || (bitsPerPixel != 24 && bitsPerPixel != 32))
+        return false;
+
+    // Masks follow a plain info header, or sit inside a V4/V5 one, at the same place
+    Uint32 alphaMask = bitsPerPixel == 32 ? 0xFF000000 : 0;
+    if (compression == 3)
+    {
+        if (file.size < 66 || read32(d + 54) != 0x00FF0000 || read32(d + 58) != 0x0000FF00 || read32(d + 62) != 0x000000FF)
+            return false;
+        alphaMask = headerSize >= 56 && file.size >= 70 ? read32(d + 66) : 0;
+        if (alphaMask != 0 && alphaMask != 0xFF000000)
+            return false;
+    }
+    else if (compression != 0)
+        return false;
+
+    layout.width = width;
+    layout.height = height < 0 ? -height : height;
+    layout.bitsPerPixel = bitsPerPixel;
+    layout.bottomUp = height > 0;
+    layout.alpha = alphaMask != 0;
+    layout.pitch = ((size_t(width) * bitsPerPixel + 31) / 32) * 4;
+    if (offset > file.size || layout.pitch * layout.height > file.size - offset)
+        return false;
+    layout.pixels = d + offset;
+    return true;
+}
+
+// One row to 32 bit words, ARGB8888 or with red and blue swapped ABGR8888.
+// Word at a time with no branches inside, so the compiler can vectorize the
+// loops. Returns the alpha bits seen, all zero means the channel is unused
+static Uint32 convertRow(const Uint8 *src, Uint32 *dst, int width, int bitsPerPixel, bool swapRB, bool alpha)
+{
+    Uint32 alphaSeen = 0;
+    if (bitsPerPixel == 32)
+    {
+        Uint32 fill = alpha ? 0 : 0xFF000000;
+        // The destination may be write combined texture memory, so it is never read back
+        Uint32 keep = swapRB ? 0xFF00FF00 : 0xFFFFFFFF;
+        Uint32 moved = swapRB ? 0xFF : 0;
+        for (int x = 0; x < width; x++)
+        {
+            Uint32 p;
+            memcpy(&p, src + size_t(x) * 4, 4);
+            alphaSeen |= p;
+            dst[x] = (p & keep) | ((p >> 16) & moved) | ((p & moved) << 16) | fill;
+        }
+        return alphaSeen & 0xFF000000;
+    }
+
+    // 24 bit rows are B, G, R bytes
+    int redShift = swapRB ? 0 : 16;
+    int blueShift = swapRB ? 16 : 0;
+    for (int x = 0; x < width; x++)
+    {
+        const Uint8 *p = src + size_t(x) * 3;
+        dst[x] = 0xFF000000 | (Uint32(p[2]) << redShift) | (Uint32(p[1]) << 8) | (Uint32(p[0]) << blueShift);
+    }
+    return 0xFF000000;
+}
+
+// Rows into any destination pitch, flipped from the file's bottom up order
+static void convertImage(const bmpLayout &layout, bool swapRB, Uint8 *dst, size_t dstPitch)
+{
+    Uint32 alphaSeen = 0;
+    for (int y = 0; y < layout.height; y++)
+    {
+        int sourceRow = layout.bottomUp ? layout.height - 1 - y : y;
+        alphaSeen |= convertRow(layout.pixels + size_t(sourceRow) * layout.pitch, reinterpret_cast<Uint32*>(dst + size_t(y) * dstPitch),
+                                layout.width, layout.bitsPerPixel, swapRB, layout.alpha);
+    }
+
+    // Like SDL_LoadBMP, an alpha channel that is all zero means opaque
+    if (layout.alpha && alphaSeen == 0)
+    {
+        for (int y = 0; y < layout.height; y++)
+        {
+            Uint32 *row = reinterpret_cast<Uint32*>(dst + size_t(y) * dstPitch);
+            for (int x = 0; x < layout.width; x++)
+                row[x] |= 0xFF000000;
+        }
+    }
+}
+
+static bool formatSupported(Uint32 format)
+{
+    return format == SDL_PIXELFORMAT_ARGB8888 || format == SDL_PIXELFORMAT_ABGR8888;
+}
+
+TextureLoader::TextureLoader(SDL_Renderer *_render)
+{
+    render = _render;
+    nativeFormat = SDL_PIXELFORMAT_UNKNOWN;
+
+    // First of the renderer's own formats we can write, in its order of preference
+    SDL_RendererInfo info;
+    if (render && SDL_GetRendererInfo(render, &info) == 0)
+    {
+        for (Uint32 i = 0; i < info.num_texture_formats && i < 16; i++)
+        {
+            if (formatSupported(info.texture_formats[i]))
+            {
+                nativeFormat = info.texture_formats[i];
+                break;
+            }
+        }
+    }
+}
+
+void TextureLoader::setCacheDirectory(const std::string &directory)
+{
+    cacheDirectory = directory;
+    if (cacheDirectory.empty())
+        return;
+    std::error_code error;
+    std::filesystem::create_directories(cacheDirectory, error);
+    if (error)
+    {
+        std::cout << "Failed to create texture cache: " << cacheDirectory << std::endl;
+        cacheDirectory.clear();
+    }
+}
+
+SDL_Texture *TextureLoader::loadFallback(const std::string &filename, int &width, int &height)
+{
+    SDL_Surface *surface = SDL_LoadBMP(filename.c_str());
+    if (!surface)
+    {
+        std::cout << "Failed to open texture: " << filename << std::endl;
+        return NULL;
+    }
+    width = surface->w;
+    height = surface->h;
+    SDL_Texture *texture = SDL_CreateTextureFromSurface(render, surface);
+    SDL_FreeSurface(surface);
+    if (!texture)
+        std::cout << "Failed to create texture: " << filename << std::endl;
+    return texture;
+}
+
+SDL_Texture *TextureLoader::createTexture(const Uint32 *pixels, int width, int height, bool alpha)
+{
+    SDL_Texture *texture = SDL_CreateTexture(render, nativeFormat, SDL_TEXTUREACCESS_STREAMING, width, height);
+    if (!texture)
+        return NULL;
+    void *locked;
+    int pitch;
+    if (SDL_LockTexture(texture, NULL, &locked, &pitch) != 0)
+    {
+        SDL_DestroyTexture(texture);
+        return NULL;
+    }
+    for (int y = 0; y < height; y++)
+        memcpy(static_cast<Uint8*>(locked) + size_t(y) * pitch, pixels + size_t(y) * width, size_t(width) * 4);
+    SDL_UnlockTexture(texture);
+    if (alpha)
+        SDL_SetTextureBlendMode(texture, SDL_BLENDMODE_BLEND);
+    return texture;
+}
+
+SDL_Texture *TextureLoader::loadBMP(const std::string &filename, int &width, int &height)
+{
+    if (nativeFormat == SDL_PIXELFORMAT_UNKNOWN)
+        return loadFallback(filename, width, height);
+
+    if (!cacheDirectory.empty())
+    {
+        SDL_Texture *cached = loadCached(filename, width, height);
+        if (cached)
+            return cached;
+    }
+
+    mappedFile file(filename);
+    if (!file.isOpen())
+    {
+        std::cout << "Failed to open texture: " << filename << std::endl;
+        return NULL;
+    }
+    bmpLayout layout;
+    if (!parseBMP(file, layout))
+        return loadFallback(filename, width, height);
+    width = layout.width;
+    height = layout.height;
+    bool swapRB = nativeFormat == SDL_PIXELFORMAT_ABGR8888;
+
+    // Converted once in memory so the same pixels can go to the cache
+    if (!cacheDirectory.empty())
+    {
+        std::vector<Uint32> pixels(size_t(width) * height);
+        trackAllocation(MemoryTag::Textures, pixels.size() * 4);
+        convertImage(layout, swapRB, reinterpret_cast<Uint8*>(pixels.data()), size_t(width) * 4);
+        writeCache(filename, pixels.data(), width, height, layout.alpha);
+        SDL_Texture *texture = createTexture(pixels.data(), width, height, layout.alpha);
+        trackFree(MemoryTag::Textures, pixels.size() * 4);
+        if (!texture)
+            std::cout << "Failed to create texture: " << filename << std::endl;
+        return texture;
+    }
+
+    // Straight from the mapped file into the texture's staging memory
+    SDL_Texture *texture = SDL_CreateTexture(render, nativeFormat, SDL_TEXTUREACCESS_STREAMING, width, height);
+    void *locked;
+    int pitch;
+    if (!texture || SDL_LockTexture(texture, NULL, &locked, &pitch) != 0)
+    {
+        if (texture)
+            SDL_DestroyTexture(texture);
+        std::cout << "Failed to create texture: " << filename << std::endl;
+        return NULL;
+    }
+    convertImage(layout, swapRB, static_cast<Uint8*>(locked), size_t(pitch));
+    SDL_UnlockTexture(texture);
+    if (layout.alpha)
+        SDL_SetTextureBlendMode(texture, SDL_BLENDMODE_BLEND);
+    return texture;
+}
+
+bool TextureLoader::decodeBMP(const std::string &filename, Uint32 format, std::vector<Uint32> &pixels, int &width, int &height)
+{
+    mappedFile file(filename);
+    bmpLayout layout;
+    if (file.isOpen() && formatSupported(format) && parseBMP(file, layout))
+    {
+        width = layout.width;
+        height = layout.height;
+        pixels.resize(size_t(width) * height);
+        convertImage(layout, format == SDL_PIXELFORMAT_ABGR8888, reinterpret_cast<Uint8*>(pixels.data()), size_t(width) * 4);
+        return true;
+    }
+
+    SDL_Surface *loaded = SDL_LoadBMP(filename.c_str());
+    if (!loaded)
+    {
+        std::cout << "Failed to open texture: " << filename << std::endl;
+        return false;
+    }
+    SDL_Surface *surface = SDL_ConvertSurfaceFormat(loaded, format, 0);
+    SDL_FreeSurface(loaded);
+    if (!surface)
+    {
+        std::cout << "Failed to convert texture: " << filename << std::endl;
+        return false;
+    }
+    width = surface->w;
+    height = surface->h;
+    pixels.resize(size_t(width) * height);
+    SDL_LockSurface(surface);
+    for (int y = 0; y < height; y++)
+        memcpy(&pixels[size_t(y) * width], static_cast<const Uint8*>(surface->pixels) + size_t(y) * surface->pitch, size_t(width) * 4);
+    SDL_UnlockSurface(surface);
+    SDL_FreeSurface(surface);
+    return true;
+}
+
+// Cache files: header, the source path to rule out hash collisions, then
+// tightly packed pixels in the format the header names
+struct textureCacheHeader
+{
+    char magic[4];
+    Uint32 version;
+    Uint64 sourceSize;
+    Sint64 sourceTime;
+    Uint32 format;
+    Sint32 width;
+    Sint32 height;
+    Uint32 alpha;
+    Uint32 pathLength;
+};
+
+static const char cacheMagic[4] = { 'T', 'X', 'C', 'H' };
+static const Uint32 cacheVersion = 1;
+
+static bool sourceStamp(const std::string &filename, Uint64 &size, Sint64 &time)
+{
+    std::error_code error;
+    size = Uint64(std::filesystem::file_size(filename, error));
+    if (error)
+        return false;
+    time = Sint64(std::filesystem::last_write_time(filename, error).time_since_epoch().count());
+    return !error;
+}
+
+std::string TextureLoader::cacheFile(const std::string &filename)
+{
+    Uint64 hash = 14695981039346656037ull;
+    for (char c : filename)
+        hash = (hash ^ Uint8(c)) * 1099511628211ull;
+    std::ostringstream name;
+    name << cacheDirectory << "/" << std::hex << std::setw(16) << std::setfill('0') << hash << ".tex";
+    return name.str();
+}
+
+SDL_Texture *TextureLoader::loadCached(const std::string &filename, int &width, int &height)
+{
+    Uint64 sourceSize;
+    Sint64 sourceTime;
+    if (!sourceStamp(filename, sourceSize, sourceTime))
+        return NULL;
+
+    mappedFile file(cacheFile(filename));
+    if (!file.isOpen() || file.size < sizeof(textureCacheHeader))
+        return NULL;
+    textureCacheHeader header;
+    memcpy(&header, file.data, sizeof(header));
+    size_t pixelOffset = sizeof(header) + header.pathLength;
+    // Stale or foreign entries are just missed, the load rewrites them
+    if (memcmp(header.magic, cacheMagic, sizeof(cacheMagic)) != 0 || header.version != cacheVersion ||
+        header.sourceSize != sourceSize || header.sourceTime != sourceTime || header.format != nativeFormat ||
+        header.width <= 0 || header.height <= 0 || pixelOffset > file.size ||
+        size_t(header.width) * header.height * 4 > file.size - pixelOffset ||
+        std::string(reinterpret_cast<const char*>(file.data + sizeof(header)),
+                    strnlen(reinterpret_cast<const char*>(file.data + sizeof(header)), header.pathLength)) != filename)
+        return NULL;
+
+    // Page aligned mapping plus a 4 byte aligned header keeps the words aligned
+    // as long as the path length is, which writeCache pads for
+    width = header.width;
+    height = header.height;
+    return createTexture(reinterpret_cast<const Uint32*>(file.data + pixelOffset), width, height, header.alpha != 0);
+}
+
+void TextureLoader::writeCache(const std::string &filename, const Uint32 *pixels, int width, int height, bool alpha)
+{
+    textureCacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, cacheMagic, sizeof(cacheMagic));
+    header.version = cacheVersion;
+    if (!sourceStamp(filename, header.sourceSize, header.sourceTime))
+        return;
+    header.format = nativeFormat;
+    header.width = width;
+    header.height = height;
+    header.alpha = alpha ? 1 : 0;
+    std::string path = filename;
+    header.pathLength = Uint32((path.size() + 3) & ~size_t(3));
+    path.resize(header.pathLength, '\0');
+
+    std::string name = cacheFile(filename);
+    std::ofstream file(name, std::ios::binary | std::ios::trunc);
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(path.data(), std::streamsize(path.size()));
+    file.write(reinterpret_cast<const char*>(pixels), std::streamsize(size_t(width) * height * 4));
+    if (!file)
+        std::cout << "Failed to write texture cache: " << name << std::endl;
+}
@@ -0,0 +1,54 @@
+#include <SDL2/SDL.h>
+#include <string>
+#include <vector>
+
+#ifndef TEXTURELOADER_H
+#define TEXTURELOADER_H
+
+// A file mapped read only, or read into memory where mapping isn't available
+class mappedFile
+{
+    public:
+        mappedFile(const std::string &filename);
+        ~mappedFile();
+        mappedFile(const mappedFile &) = delete;
+        mappedFile &operator=(const mappedFile &) = delete;
+        bool isOpen() const { return data != NULL; }
+
+        const Uint8 *data = NULL;
+        size_t size = 0;
+    private:
+        std::vector<Uint8> buffer;
+        bool mapped = false;
+};
+
+// Decodes uncompressed 24 and 32 bit BMPs from a mapped file straight into
+// the pixel format the renderer keeps textures in, skipping the surface
+// SDL_LoadBMP builds and the conversion SDL_CreateTextureFromSurface does.
+// Anything else (palettes, RLE, 16 bit) goes through SDL as before.
+// With a cache directory set, converted pixels are also kept on disk and
+// later loads are a single copy
+class TextureLoader
+{
+    public:
+        TextureLoader(SDL_Renderer *_render);
+        // Empty turns the cache off, which is the default
+        void setCacheDirectory(const std::string &directory);
+        SDL_Texture *loadBMP(const std::string &filename, int &width, int &height);
+        // Same decode into memory, pixels come out as format
+        // (SDL_PIXELFORMAT_ARGB8888 or SDL_PIXELFORMAT_ABGR8888)
+        bool decodeBMP(const std::string &filename, Uint32 format, std::vector<Uint32> &pixels, int &width, int &height);
+
+    private:
+        SDL_Texture *loadFallback(const std::string &filename, int &width, int &height);
+        SDL_Texture *loadCached(const std::string &filename, int &width, int &height);
+        void writeCache(const std::string &filename, const Uint32 *pixels, int width, int height, bool alpha);
+        SDL_Texture *createTexture(const Uint32 *pixels, int width, int height, bool alpha);
+        std::string cacheFile(const std::string &filename);
+
+        SDL_Renderer *render;
+        Uint32 nativeFormat;        // SDL_PIXELFORMAT_UNKNOWN when the renderer has none we convert to
+        std::string cacheDirectory;
+};
+
+#endif
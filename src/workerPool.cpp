@@ -0,0 +1,99 @@
+#include "workerPool.h"
+#include <algorithm>
+
+WorkerPool::WorkerPool(int threads)
+{
+    currentTask = nullptr;
+    taskCount = 0;
+    nextIndex = 0;
+    busyWorkers = 0;
+    generation = 0;
+    stopping = false;
+
+    // One less than the core count, parallelFor also runs on the caller
+    if (threads <= 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    for (int i = 1; i < threads; i++)
+    {
+        workers.emplace_back(&WorkerPool::workerLoop, this);
+    }
+}
+
+WorkerPool::~WorkerPool()
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+    workReady.notify_all();
+    for (auto &worker : workers)
+    {
+        worker.join();
+    }
+}
+
+int WorkerPool::threadCount()
+{
+    return int(workers.size()) + 1;
+}
+
+void WorkerPool::parallelFor(int count, const std::function<void(int)> &task)
+{
+    if (count <= 0)
+        return;
+
+    if (workers.empty() || count == 1)
+    {
+        for (int i = 0; i < count; i++)
+            task(i);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        currentTask = &task;
+        taskCount = count;
+        nextIndex = 0;
+        busyWorkers = int(workers.size());
+        generation++;
+    }
+    workReady.notify_all();
+
+    runTasks();
+
+    std::unique_lock<std::mutex> guard(lock);
+    workDone.wait(guard, [this] { return busyWorkers == 0; });
+    currentTask = nullptr;
+}
+
+void WorkerPool::runTasks()
+{
+    int index;
+    while ((index = nextIndex++) < taskCount)
+    {
+        (*currentTask)(index);
+    }
+}
+
+void WorkerPool::workerLoop()
+{
+    int seen = 0;
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            workReady.wait(guard, [this, seen] { return stopping || generation != seen; });
+            if (stopping)
+                return;
+            seen = generation;
+        }
+
+        runTasks();
+
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            busyWorkers--;
+        }
+        workDone.notify_one();
+    }
+}
@@ -0,0 +1,40 @@
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+
+#ifndef WORKERPOOL_H
+#define WORKERPOOL_H
+
+// A fixed set of threads kept around between frames, so per-frame work can be
+// split up without paying for thread creation every time
+class WorkerPool
+{
+    public:
+        WorkerPool(int threads = 0);
+        ~WorkerPool();
+        // Calls task(i) for every i in [0, count) and returns once all are done.
+        // The calling thread takes part too.
+        void parallelFor(int count, const std::function<void(int)> &task);
+        int threadCount();
+
+    private:
+        void workerLoop();
+        void runTasks();
+
+        std::vector<std::thread> workers;
+        std::mutex lock;
+        std::condition_variable workReady;
+        std::condition_variable workDone;
+
+        const std::function<void(int)> *currentTask;
+        int taskCount;
+        std::atomic<int> nextIndex;
+        int busyWorkers;
+        int generation;
+        bool stopping;
+};
+
+#endif